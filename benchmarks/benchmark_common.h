@@ -0,0 +1,131 @@
+/*
+ * Helpers shared by the segwayrmp benchmarks.
+ */
+
+#ifndef SEGWAYRMP_BENCHMARK_COMMON_H
+#define SEGWAYRMP_BENCHMARK_COMMON_H
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <boost/chrono.hpp>
+
+#include "segwayrmp/segwayrmp.h"
+#include "segwayrmp/impl/rmp_io.h"
+
+namespace benchmark {
+
+typedef boost::chrono::high_resolution_clock Clock;
+
+inline double
+secondsSince(Clock::time_point start)
+{
+  return boost::chrono::duration<double>(Clock::now() - start).count();
+}
+
+inline long long
+nanosecondsSince(Clock::time_point start)
+{
+  return boost::chrono::duration_cast<boost::chrono::nanoseconds>(
+    Clock::now() - start).count();
+}
+
+/*!
+ * Returns the p'th percentile (0.0 - 1.0) of samples, sorting them in place.
+ */
+template<typename T> T
+percentile(std::vector<T> &samples, double p)
+{
+  if (samples.empty())
+    return T();
+  std::sort(samples.begin(), samples.end());
+  size_t index = (size_t)(p * (samples.size() - 1) + 0.5);
+  return samples[index];
+}
+
+/*!
+ * Builds a valid 18 byte usb packet like the ones the RMP sends.
+ */
+inline void
+appendUSBPacket(std::vector<unsigned char> &stream, unsigned short id,
+                unsigned char channel, const unsigned char *data)
+{
+  unsigned char usb_packet[18] = {0xF0, 0x55, channel, 0x00,
+                                  (unsigned char)(id >> 3),
+                                  (unsigned char)((id & 7) << 5),
+                                  0x00, 0x00, 0x08};
+  memcpy(usb_packet + 9, data, 8);
+  unsigned short checksum = 0;
+  for (int i = 0; i < 17; ++i)
+    checksum += usb_packet[i];
+  checksum = (checksum & 0xff) + (checksum >> 8);
+  checksum = (checksum & 0xff) + (checksum >> 8);
+  usb_packet[17] = (unsigned char)((~checksum + 1) & 0xff);
+  stream.insert(stream.end(), usb_packet, usb_packet + 18);
+}
+
+/*!
+ * Appends one status cycle (0x0400 through 0x0407 on channel A) to stream.
+ */
+inline void
+appendStatusCycle(std::vector<unsigned char> &stream, unsigned char seed = 0)
+{
+  unsigned char data[8];
+  for (int i = 0; i < 8; ++i)
+    data[i] = (unsigned char)(seed + i);
+  for (unsigned short id = 0x0400; id <= 0x0407; ++id)
+    appendUSBPacket(stream, id, 0xAA, data);
+}
+
+/*!
+ * An RMPIO which replays an in memory byte stream forever, handing out at
+ * most chunk_size bytes per read to mimic the granularity of the transport.
+ */
+class ReplayRMPIO : public segwayrmp::RMPIO {
+public:
+  ReplayRMPIO(const std::vector<unsigned char> &stream, int chunk_size)
+  : stream_(stream), position_(0), chunk_size_(chunk_size), bytes_read_(0),
+    reads_(0)
+  {
+    this->connected = true;
+  }
+
+  void connect() {}
+  void disconnect() {}
+
+  int read(unsigned char *buffer, int size) {
+    int length = std::min(size, chunk_size_);
+    int remaining = length;
+    while (remaining > 0) {
+      size_t available = stream_.size() - position_;
+      size_t n = std::min((size_t)remaining, available);
+      memcpy(buffer, &stream_[position_], n);
+      buffer += n;
+      remaining -= (int)n;
+      position_ = (position_ + n) % stream_.size();
+    }
+    bytes_read_ += length;
+    reads_ += 1;
+    return length;
+  }
+
+  int write(unsigned char *, int size) {
+    return size;
+  }
+
+  unsigned long long bytesRead() const {return bytes_read_;}
+  unsigned long long reads() const {return reads_;}
+
+private:
+  const std::vector<unsigned char> &stream_;
+  size_t position_;
+  int chunk_size_;
+  unsigned long long bytes_read_;
+  unsigned long long reads_;
+};
+
+} // namespace benchmark
+
+#endif
@@ -0,0 +1,105 @@
+/*
+ * Measures the latency from a status cycle arriving to the status callback
+ * being called, with the callback on its own thread and inline on the read
+ * thread.
+ *
+ * A SegwayRMP reads the slave side of a pty pair with the termios serial
+ * interface.  One status cycle (0x0400 through 0x0407) at a time is written
+ * into the master side, waiting for the callback before writing the next, so
+ * every cycle finds the read thread (and the callback thread) asleep like
+ * they are between the RMP's 100 Hz cycles.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+
+#include "benchmark_common.h"
+
+using namespace segwayrmp;
+using namespace benchmark;
+
+namespace {
+
+Clock::time_point epoch;
+boost::atomic<long long> sent_at(0);
+boost::atomic<size_t> received(0);
+std::vector<long long> latencies;
+
+void
+handleStatus(SegwayStatus::Ptr)
+{
+  latencies.push_back(nanosecondsSince(epoch) - sent_at.load());
+  received += 1;
+}
+
+void
+ignoreMessage(const std::string &)
+{
+}
+
+bool
+runMode(const char *name, StatusDeliveryMode mode, size_t cycles)
+{
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+    std::cerr << "Could not open a pty pair" << std::endl;
+    return false;
+  }
+  std::vector<unsigned char> stream;
+  appendStatusCycle(stream);
+  latencies.clear();
+  latencies.reserve(cycles);
+  received = 0;
+  {
+    SegwayRMP segway_rmp(serial, rmp200, mode);
+    segway_rmp.setStatusCallback(handleStatus);
+    segway_rmp.setLogMsgCallback("error", ignoreMessage);
+    segway_rmp.configureSerial(ptsname(master));
+    segway_rmp.connect(false);
+    epoch = Clock::now();
+    for (size_t i = 0; i < cycles; ++i) {
+      sent_at = nanosecondsSince(epoch);
+      ssize_t written = ::write(master, &stream[0], stream.size());
+      if (written != (ssize_t)stream.size()) {
+        std::cerr << "short write to the pty" << std::endl;
+        return false;
+      }
+      while (received.load() <= i) {
+        boost::this_thread::yield();
+      }
+    }
+  }
+  close(master);
+  std::cout << std::fixed << std::setprecision(1)
+            << "  " << std::setw(18) << std::left << name << std::right
+            << "  p50 " << std::setw(7) << percentile(latencies, 0.50) / 1e3
+            << " us  p99 " << std::setw(7)
+            << percentile(latencies, 0.99) / 1e3
+            << " us  max " << std::setw(8) << percentile(latencies, 1.0) / 1e3
+            << " us" << std::endl;
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  size_t cycles = 5000;
+  if (argc > 1) {
+    cycles = (size_t)atol(argv[1]);
+  }
+  std::cout << "Status cycle to callback latency through a pty over " << cycles
+            << " cycles:" << std::endl;
+  if (!runMode("status_callbacks", status_callbacks, cycles)
+      || !runMode("status_inline", status_inline, cycles)) {
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,151 @@
+/*
+ * Measures the cost of encoding a command into a usb packet.
+ *
+ * The encoder as it was before is reproduced here for comparison: it filled
+ * the 18 bytes from a template one data byte at a time and then summed all
+ * 17 bytes for the checksum.  RMPIO::encodePacket copies a whole move
+ * frame from a template and only stores and sums the four count bytes, any
+ * other packet gets the fixed header, whose sum is a compile time constant,
+ * and only the channel, the id and the data are summed.  The moves have
+ * changing velocities, like a control loop sends, the other packets are
+ * configuration commands.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+
+#include <stdlib.h>
+
+#include "benchmark_common.h"
+
+using namespace segwayrmp;
+using namespace benchmark;
+
+namespace {
+
+// Exposes the encoder, nothing is read or written
+class EncodingRMPIO : public RMPIO {
+public:
+  void connect() {}
+  void disconnect() {}
+  int read(unsigned char *, int) {return 0;}
+  int write(unsigned char *, int size) {return size;}
+  using RMPIO::encodePacket;
+  using RMPIO::computeChecksum;
+};
+
+// The encoder as it was, kept for comparison
+void
+legacyEncodePacket(EncodingRMPIO &rmp_io, const Packet &packet,
+                   unsigned char *usb_packet)
+{
+  unsigned char usb_template[18] = {0xF0, 0x55, 0x00, 0x00, 0x00, 0x00, 0x04,
+                                    0x13, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                                    0x00, 0x00, 0x00, 0x00};
+  memcpy(usb_packet, usb_template, 18);
+  usb_packet[6] = (packet.id & 0xFF00) >> 8;
+  usb_packet[7] = packet.id & 0x00FF;
+  usb_packet[2] = packet.channel;
+  for (int i = 0; i < 8; ++i) {
+    usb_packet[9 + i] = packet.data[i];
+  }
+  usb_packet[17] = rmp_io.computeChecksum(usb_packet);
+}
+
+void
+makeMove(Packet &packet, int i)
+{
+  short lc = (short)(i % 1176);
+  short ac = (short)(-(i % 1024));
+  packet.id = 0x0413;
+  packet.data[0] = (unsigned char)((lc & 0xFF00) >> 8);
+  packet.data[1] = (unsigned char)(lc & 0x00FF);
+  packet.data[2] = (unsigned char)((ac & 0xFF00) >> 8);
+  packet.data[3] = (unsigned char)(ac & 0x00FF);
+}
+
+void
+makeConfiguration(Packet &packet, int i)
+{
+  packet.id = 0x0413;
+  packet.data[5] = (unsigned char)(0x0A + i % 4);
+  packet.data[7] = (unsigned char)(i % 17);
+}
+
+// Returns nanoseconds per packet, sink keeps the work from being dropped
+template<typename Encode, typename Make> double
+measure(Encode encode, Make make, size_t packets, unsigned int &sink)
+{
+  EncodingRMPIO rmp_io;
+  Packet packet;
+  unsigned char usb_packet[18];
+  Clock::time_point start = Clock::now();
+  for (size_t i = 0; i < packets; ++i) {
+    make(packet, (int)i);
+    encode(rmp_io, packet, usb_packet);
+    sink += usb_packet[17];
+  }
+  return nanosecondsSince(start) / (double)packets;
+}
+
+void
+currentEncodePacket(EncodingRMPIO &rmp_io, const Packet &packet,
+                    unsigned char *usb_packet)
+{
+  rmp_io.encodePacket(packet, usb_packet);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  size_t packets = 50000000;
+  if (argc > 1) {
+    packets = (size_t)atol(argv[1]);
+  }
+  // Both must produce the same bytes, for moves and for everything else
+  EncodingRMPIO rmp_io;
+  for (int i = 0; i < 300000; ++i) {
+    Packet packet;
+    if (i % 3 == 0) {
+      makeMove(packet, i);
+    } else if (i % 3 == 1) {
+      makeConfiguration(packet, i);
+    } else {
+      makeMove(packet, i);
+      packet.channel = (unsigned char)i;
+      packet.data[7] = (unsigned char)(i * 7);
+    }
+    unsigned char legacy[18], current[18];
+    legacyEncodePacket(rmp_io, packet, legacy);
+    rmp_io.encodePacket(packet, current);
+    if (memcmp(legacy, current, 18) != 0) {
+      std::cerr << "The encoders disagree on packet " << i << std::endl;
+      return 1;
+    }
+  }
+  unsigned int sink = 0;
+  double legacy_move = measure(legacyEncodePacket, makeMove, packets, sink);
+  double current_move =
+    measure(currentEncodePacket, makeMove, packets, sink);
+  double legacy_configuration =
+    measure(legacyEncodePacket, makeConfiguration, packets, sink);
+  double current_configuration =
+    measure(currentEncodePacket, makeConfiguration, packets, sink);
+  std::cout << std::fixed << std::setprecision(2)
+            << "Encoding " << packets << " move commands:" << std::endl
+            << "  legacy template + 17 byte checksum "
+            << std::setw(8) << legacy_move << " ns/packet" << std::endl
+            << "  move template + 4 byte checksum    "
+            << std::setw(8) << current_move << " ns/packet" << std::endl
+            << "Encoding " << packets << " configuration commands:"
+            << std::endl
+            << "  legacy template + 17 byte checksum "
+            << std::setw(8) << legacy_configuration << " ns/packet"
+            << std::endl
+            << "  header template + partial checksum "
+            << std::setw(8) << current_configuration << " ns/packet"
+            << std::endl
+            << "  (" << (sink & 1) << ")" << std::endl;
+  return 0;
+}
@@ -0,0 +1,201 @@
+/*
+ * Measures the worst case latency of shutdown() while the link is saturated
+ * with motion and configuration commands.
+ *
+ * The SegwayRMP talks to the slave side of a pty pair with the termios
+ * serial interface.  A reader thread drains the master side no faster than
+ * the bytes would cross a 460800 baud link, so the writes back up like they
+ * do on a busy usb serial adapter.  Several threads call move() flat out and
+ * one more changes a scale factor every millisecond.  The latency is from
+ * calling shutdown() to its frame coming out of the master side.
+ *
+ * With the commands written on the calling threads, the shutdown waits for
+ * the write lock behind every other thread and then for the backlog in the
+ * tty buffer.  With a command rate the motion commands are sent at that
+ * rate, and the shutdown goes out ahead of every queued configuration
+ * command.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "benchmark_common.h"
+
+using namespace segwayrmp;
+using namespace benchmark;
+
+namespace {
+
+const int BAUDRATE = 460800;
+const int MOTION_THREADS = 4;
+// Each rate stops taking trials after this long, without a command rate
+// every shutdown waits a second or two behind the backlog in the tty
+const long long RUN_BUDGET_NS = 20000000000LL;
+
+Clock::time_point epoch;
+boost::atomic<long long> shutdown_seen_at(-1);
+boost::atomic<bool> reading(true);
+boost::atomic<bool> loading(true);
+
+// Drains the master side at the pace of the link, looking for the shutdown
+void
+readLink(int master)
+{
+  unsigned char frame[18];
+  size_t filled = 0;
+  Clock::time_point next = Clock::now();
+  while (reading) {
+    struct pollfd pfd;
+    pfd.fd = master;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, 10) <= 0) {
+      next = Clock::now();
+      continue;
+    }
+    ssize_t length = ::read(master, frame + filled, sizeof(frame) - filled);
+    if (length <= 0) {
+      continue;
+    }
+    filled += (size_t)length;
+    // Ten bits on the wire for every byte
+    next += boost::chrono::nanoseconds(length * 10000000000LL / BAUDRATE);
+    boost::this_thread::sleep_until(next);
+    if (filled < sizeof(frame)) {
+      continue;
+    }
+    filled = 0;
+    if (frame[6] == 0x04 && frame[7] == 0x12) {
+      shutdown_seen_at = nanosecondsSince(epoch);
+    }
+  }
+}
+
+void
+moveFlatOut(SegwayRMP *segway_rmp)
+{
+  while (loading) {
+    try {
+      segway_rmp->move(0.1f, 0.0f);
+    } catch (std::exception &) {
+    }
+  }
+}
+
+void
+configureEveryMillisecond(SegwayRMP *segway_rmp)
+{
+  while (loading) {
+    try {
+      segway_rmp->setMaxVelocityScaleFactor(1.0);
+    } catch (std::exception &) {
+    }
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(1));
+  }
+}
+
+void
+ignoreMessage(const std::string &)
+{
+}
+
+void
+ignoreException(const std::exception &)
+{
+}
+
+bool
+run(double command_rate_hz, size_t trials)
+{
+  int master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+    std::cerr << "Could not open a pty pair" << std::endl;
+    return false;
+  }
+  epoch = Clock::now();
+  reading = true;
+  loading = true;
+  boost::thread reader(readLink, master);
+  SegwayRMP *segway_rmp = new SegwayRMP(serial, rmp200);
+  segway_rmp->setLogMsgCallback("error", ignoreMessage);
+  segway_rmp->setExceptionCallback(ignoreException);
+  segway_rmp->configureSerial(ptsname(master), BAUDRATE);
+  segway_rmp->setCommandRate(command_rate_hz);
+  segway_rmp->connect(false);
+  boost::thread_group load;
+  for (int i = 0; i < MOTION_THREADS; ++i) {
+    load.create_thread(boost::bind(moveFlatOut, segway_rmp));
+  }
+  load.create_thread(boost::bind(configureEveryMillisecond, segway_rmp));
+  // Let the backlog build up
+  boost::this_thread::sleep_for(boost::chrono::milliseconds(200));
+
+  std::vector<long long> latencies;
+  long long started_at = nanosecondsSince(epoch);
+  bool failed = false;
+  for (size_t i = 0; i < trials; ++i) {
+    if (nanosecondsSince(epoch) - started_at > RUN_BUDGET_NS) {
+      break;
+    }
+    boost::this_thread::sleep_for(
+      boost::chrono::microseconds(2000 + rand() % 5000));
+    shutdown_seen_at = -1;
+    long long called_at = nanosecondsSince(epoch);
+    segway_rmp->shutdown();
+    while (shutdown_seen_at < 0 && nanosecondsSince(epoch) - called_at
+                                   < 5000000000LL) {
+      boost::this_thread::sleep_for(boost::chrono::microseconds(50));
+    }
+    if (shutdown_seen_at < 0) {
+      std::cerr << "The shutdown was never seen" << std::endl;
+      failed = true;
+      break;
+    }
+    latencies.push_back(shutdown_seen_at - called_at);
+  }
+
+  loading = false;
+  load.join_all();
+  delete segway_rmp;
+  reading = false;
+  reader.join();
+  close(master);
+
+  std::cout << std::fixed << std::setprecision(1)
+            << std::setw(12) << command_rate_hz
+            << std::setw(12) << percentile(latencies, 0.50) / 1e3 << " us"
+            << std::setw(12) << percentile(latencies, 0.99) / 1e3 << " us"
+            << std::setw(12) << percentile(latencies, 1.0) / 1e3 << " us"
+            << std::setw(10) << latencies.size() << std::endl;
+  return !failed && !latencies.empty();
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  size_t trials = 200;
+  if (argc > 1) {
+    trials = (size_t)atol(argv[1]);
+  }
+  std::cout << "shutdown() latency at " << BAUDRATE << " baud with "
+            << MOTION_THREADS << " threads moving flat out, " << trials
+            << " trials or " << RUN_BUDGET_NS / 1000000000LL
+            << " s per rate (rate 0 writes on the calling threads):"
+            << std::endl
+            << "   rate (Hz)         p50             p99             max"
+            << "    trials" << std::endl;
+  if (!run(0.0, trials) || !run(100.0, trials) || !run(1000.0, trials)) {
+    return 1;
+  }
+  return 0;
+}
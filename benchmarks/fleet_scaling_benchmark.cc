@@ -0,0 +1,161 @@
+/*
+ * Measures how the CPU cost and latency of driving many bases scale, with a
+ * read thread and a callback thread per SegwayRMP and with one
+ * SegwayRMPFleet event loop thread for all of them.
+ *
+ * Every simulated base is a pty pair read with the termios serial interface.
+ * One writer thread sends a status cycle (0x0400 through 0x0407) to every
+ * base at 100 Hz, like the RMP does.  The latency is from writing a cycle to
+ * its status callback.  The CPU% is that of the whole process, writer
+ * included, divided by the number of bases.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "benchmark_common.h"
+
+using namespace segwayrmp;
+using namespace benchmark;
+
+namespace {
+
+Clock::time_point epoch;
+
+struct Base {
+  int master;
+  SegwayRMP *segway_rmp;
+  boost::atomic<long long> sent_at;
+  std::vector<long long> latencies;
+};
+
+void
+handleStatus(Base *base, SegwayStatus::Ptr)
+{
+  base->latencies.push_back(nanosecondsSince(epoch) - base->sent_at.load());
+}
+
+void
+ignoreMessage(const std::string &)
+{
+}
+
+double
+cpuSeconds()
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6
+       + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+void
+writeCycles(std::vector<Base *> *bases, double seconds)
+{
+  std::vector<unsigned char> stream;
+  appendStatusCycle(stream);
+  Clock::time_point start = Clock::now();
+  for (int cycle = 0; cycle < (int)(seconds * 100); ++cycle) {
+    boost::this_thread::sleep_until(
+      start + boost::chrono::milliseconds(10 * cycle));
+    for (size_t i = 0; i < bases->size(); ++i) {
+      Base *base = (*bases)[i];
+      base->sent_at = nanosecondsSince(epoch);
+      if (::write(base->master, &stream[0], stream.size()) < 0) {
+        std::cerr << "write to the pty failed" << std::endl;
+        return;
+      }
+    }
+  }
+  // Let the last cycle arrive
+  boost::this_thread::sleep_for(boost::chrono::milliseconds(20));
+}
+
+bool
+run(size_t count, bool use_fleet, double seconds)
+{
+  std::vector<Base *> bases;
+  SegwayRMPFleet fleet(1);
+  for (size_t i = 0; i < count; ++i) {
+    Base *base = new Base();
+    bases.push_back(base);
+    base->master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (base->master < 0 || grantpt(base->master) != 0
+        || unlockpt(base->master) != 0) {
+      std::cerr << "Could not open a pty pair" << std::endl;
+      return false;
+    }
+    base->sent_at = 0;
+    base->latencies.reserve((size_t)(seconds * 100) + 10);
+    base->segway_rmp = new SegwayRMP(serial, rmp200,
+      use_fleet ? status_inline : status_callbacks);
+    base->segway_rmp->setStatusCallback(
+      boost::bind(handleStatus, base, _1));
+    base->segway_rmp->setLogMsgCallback("error", ignoreMessage);
+    base->segway_rmp->configureSerial(ptsname(base->master));
+    if (use_fleet) {
+      fleet.add(*base->segway_rmp, false);
+    } else {
+      base->segway_rmp->connect(false);
+    }
+  }
+  if (use_fleet) {
+    fleet.start();
+  }
+  epoch = Clock::now();
+  double cpu_start = cpuSeconds();
+  Clock::time_point start = Clock::now();
+  writeCycles(&bases, seconds);
+  double cpu = cpuSeconds() - cpu_start;
+  double wall = secondsSince(start);
+  fleet.stop();
+  std::vector<long long> latencies;
+  for (size_t i = 0; i < count; ++i) {
+    delete bases[i]->segway_rmp;
+    close(bases[i]->master);
+    latencies.insert(latencies.end(), bases[i]->latencies.begin(),
+                     bases[i]->latencies.end());
+    delete bases[i];
+  }
+  std::cout << std::fixed << std::setprecision(2)
+            << "  " << std::setw(6) << count
+            << std::setw(12) << (use_fleet ? "fleet" : "threads")
+            << std::setw(10) << 100.0 * cpu / wall / count << " %"
+            << std::setprecision(1)
+            << std::setw(10) << percentile(latencies, 0.50) / 1e3 << " us"
+            << std::setw(10) << percentile(latencies, 0.99) / 1e3 << " us"
+            << std::endl;
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  size_t max_bases = 64;
+  double seconds = 2.0;
+  if (argc > 1) {
+    max_bases = (size_t)atol(argv[1]);
+  }
+  if (argc > 2) {
+    seconds = atof(argv[2]);
+  }
+  std::cout << "Bases at 100 Hz for " << seconds << " s each:" << std::endl
+            << "   bases        mode  CPU/base         p50         p99"
+            << std::endl;
+  for (size_t count = 1; count <= max_bases; count *= 2) {
+    if (!run(count, false, seconds) || !run(count, true, seconds)) {
+      return 1;
+    }
+  }
+  return 0;
+}
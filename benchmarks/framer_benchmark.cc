@@ -0,0 +1,249 @@
+/*
+ * Measures the throughput of the usb packet framer in RMPIO::getPacket.
+ *
+ * The stream is replayed from memory, handing the framer as many bytes per
+ * read as the line would deliver in one millisecond, so the numbers show the
+ * CPU cost of framing alone.  The original std::vector::erase based framer is
+ * reproduced here for comparison, as is taking one packet per call instead
+ * of every buffered packet with getPackets.  The last section replays a noisy
+ * line to show the cost of resynchronizing on the packet header.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+
+#include "benchmark_common.h"
+
+using namespace segwayrmp;
+using namespace benchmark;
+
+namespace {
+
+// The framer as it was before the ring buffer, kept for comparison.
+class VectorFramer {
+public:
+  explicit VectorFramer(RMPIO &rmp_io) : rmp_io_(rmp_io) {}
+
+  size_t getPackets() {
+    this->getPacket(packet_);
+    return 1;
+  }
+
+  void getPacket(Packet &packet) {
+    unsigned char usb_packet[18];
+    int packet_index = 0;
+    while (packet_index != 18) {
+      if (data_buffer_.size() < 18) {
+        unsigned char buffer[256];
+        int bytes_read = rmp_io_.read(buffer, 256 - data_buffer_.size());
+        data_buffer_.insert(data_buffer_.end(), buffer, buffer + bytes_read);
+      }
+      if (packet_index == 0 && data_buffer_[0] == 0xF0) {
+        usb_packet[packet_index++] = data_buffer_[0];
+        data_buffer_.erase(data_buffer_.begin());
+      } else if (packet_index == 0) {
+        data_buffer_.erase(data_buffer_.begin());
+      }
+      if (packet_index == 1 && data_buffer_[0] == 0x55) {
+        usb_packet[packet_index++] = data_buffer_[0];
+        data_buffer_.erase(data_buffer_.begin());
+      } else if (packet_index == 1) {
+        packet_index = 0;
+      }
+      if (packet_index == 2 &&
+          (data_buffer_[0] == 0xAA || data_buffer_[0] == 0xBB)) {
+        usb_packet[packet_index++] = data_buffer_[0];
+        data_buffer_.erase(data_buffer_.begin());
+      } else if (packet_index == 2) {
+        packet_index = 0;
+      }
+      if (packet_index >= 3) {
+        usb_packet[packet_index++] = data_buffer_[0];
+        data_buffer_.erase(data_buffer_.begin());
+      }
+    }
+    packet.channel = usb_packet[2];
+    packet.id = ((usb_packet[4] << 3) | ((usb_packet[5] >> 5) & 7)) & 0x0fff;
+    memcpy(packet.data, usb_packet + 9, 8);
+  }
+
+private:
+  RMPIO &rmp_io_;
+  std::vector<unsigned char> data_buffer_;
+  Packet packet_;
+};
+
+struct Result {
+  double bytes_per_second;
+  double ns_per_frame;
+  double reads_per_frame;
+};
+
+template<typename Framer> Result
+run(Framer &framer, ReplayRMPIO &rmp_io, size_t frames)
+{
+  unsigned long long start_bytes = rmp_io.bytesRead();
+  unsigned long long start_reads = rmp_io.reads();
+  Clock::time_point start = Clock::now();
+  for (size_t i = 0; i < frames;) {
+    i += framer.getPackets();
+  }
+  double elapsed = secondsSince(start);
+  Result result;
+  result.bytes_per_second = (rmp_io.bytesRead() - start_bytes) / elapsed;
+  result.ns_per_frame = elapsed * 1e9 / frames;
+  result.reads_per_frame = (double)(rmp_io.reads() - start_reads) / frames;
+  return result;
+}
+
+// Drives RMPIO::getPacket one packet at a time.
+struct RingFramer {
+  explicit RingFramer(RMPIO &rmp_io) : rmp_io_(rmp_io) {}
+  size_t getPackets() {
+    rmp_io_.getPacket(packet_);
+    return 1;
+  }
+  RMPIO &rmp_io_;
+  Packet packet_;
+};
+
+// Drives RMPIO::getPackets, taking every buffered packet at once.
+struct BatchFramer {
+  explicit BatchFramer(RMPIO &rmp_io) : rmp_io_(rmp_io) {}
+  size_t getPackets() {return rmp_io_.getPackets(packets_, 16);}
+  RMPIO &rmp_io_;
+  Packet packets_[16];
+};
+
+void
+report(const std::string &name, const Result &result, double line_rate)
+{
+  // Frames per second that the line can carry at this byte rate
+  double frames_per_second = line_rate / 18.0;
+  double cpu = frames_per_second * result.ns_per_frame / 1e9 * 100.0;
+  std::cout << "  " << std::left << std::setw(8) << name << std::right
+            << std::setw(12) << std::fixed << std::setprecision(1)
+            << result.bytes_per_second / 1e6 << " MB/s"
+            << std::setw(10) << std::setprecision(1) << result.ns_per_frame
+            << " ns/frame"
+            << std::setw(8) << std::setprecision(3) << result.reads_per_frame
+            << " reads/frame";
+  if (line_rate > 0.0) {
+    std::cout << std::setw(10) << std::setprecision(4) << cpu
+              << " % of a core at line rate";
+  }
+  std::cout << std::endl;
+}
+
+void
+scenario(double baudrate, size_t frames)
+{
+  // 8N1 framing puts 10 bits on the wire per byte
+  double line_rate = baudrate / 10.0;
+  // Bytes delivered per read, assuming one read per millisecond
+  int chunk_size = std::max(1, (int)(line_rate / 1000.0));
+
+  std::vector<unsigned char> stream;
+  for (int cycle = 0; cycle < 64; ++cycle) {
+    appendStatusCycle(stream, (unsigned char)cycle);
+  }
+
+  std::cout << std::fixed << std::setprecision(0) << baudrate << " baud ("
+            << line_rate << " bytes/s, " << chunk_size
+            << " bytes per read):" << std::endl;
+
+  ReplayRMPIO vector_io(stream, chunk_size);
+  VectorFramer vector_framer(vector_io);
+  report("vector", run(vector_framer, vector_io, frames), line_rate);
+
+  ReplayRMPIO ring_io(stream, chunk_size);
+  RingFramer ring_framer(ring_io);
+  report("ring", run(ring_framer, ring_io, frames), line_rate);
+
+  ReplayRMPIO batch_io(stream, chunk_size);
+  BatchFramer batch_framer(batch_io);
+  report("batch", run(batch_framer, batch_io, frames), line_rate);
+}
+
+// Searches for a header the way the original framer did, a byte at a time.
+size_t
+byteAtATimeFindPacketHeader(const unsigned char *data, size_t length)
+{
+  for (size_t i = 0; i + 2 < length; ++i) {
+    if (data[i] == 0xF0 && data[i + 1] == 0x55 &&
+        (data[i + 2] == 0xAA || data[i + 2] == 0xBB))
+      return i;
+  }
+  return length;
+}
+
+template<typename Search> double
+nsPerByte(Search search, const std::vector<unsigned char> &noise, int runs)
+{
+  size_t found = 0;
+  Clock::time_point start = Clock::now();
+  for (int i = 0; i < runs; ++i) {
+    found += search(&noise[0], noise.size());
+  }
+  double elapsed = secondsSince(start);
+  // Keep the searches from being optimized away
+  if (found != noise.size() * runs)
+    std::cerr << "unexpected header in the noise" << std::endl;
+  return elapsed * 1e9 / ((double)noise.size() * runs);
+}
+
+void
+resyncScenario(size_t frames)
+{
+  // Line noise which never contains a header, but does contain 0xF0
+  std::vector<unsigned char> noise(4096);
+  unsigned int seed = 1;
+  for (size_t i = 0; i < noise.size(); ++i) {
+    seed = seed * 1103515245 + 12345;
+    noise[i] = (unsigned char)(seed >> 16);
+    if (noise[i] == 0x55)
+      noise[i] = 0x54;
+  }
+
+  std::cout << "Header search over " << noise.size() << " bytes of noise:"
+            << std::endl;
+  std::cout << "  byte at a time " << std::setprecision(3)
+            << nsPerByte(byteAtATimeFindPacketHeader, noise, 2000)
+            << " ns/byte" << std::endl;
+  std::cout << "  findPacketHeader " << std::setprecision(3)
+            << nsPerByte(findPacketHeader, noise, 2000)
+            << " ns/byte" << std::endl;
+
+  // Every status cycle is followed by a burst of noise
+  std::vector<unsigned char> stream;
+  for (int cycle = 0; cycle < 16; ++cycle) {
+    appendStatusCycle(stream, (unsigned char)cycle);
+    stream.insert(stream.end(), noise.begin(), noise.begin() + 512);
+  }
+  std::cout << "Noisy line (512 bytes of noise per 144 byte cycle):"
+            << std::endl;
+  ReplayRMPIO vector_io(stream, 256);
+  VectorFramer vector_framer(vector_io);
+  report("vector", run(vector_framer, vector_io, frames / 10), 0.0);
+  ReplayRMPIO ring_io(stream, 256);
+  RingFramer ring_framer(ring_io);
+  report("ring", run(ring_framer, ring_io, frames / 10), 0.0);
+  ReplayRMPIO batch_io(stream, 256);
+  BatchFramer batch_framer(batch_io);
+  report("batch", run(batch_framer, batch_io, frames / 10), 0.0);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  size_t frames = 2000000;
+  if (argc > 1) {
+    frames = (size_t)atol(argv[1]);
+  }
+  std::cout << "Framing " << frames << " frames per run" << std::endl;
+  scenario(460800.0, frames);
+  scenario(460800.0 * 100.0, frames);
+  resyncScenario(frames);
+  return 0;
+}
@@ -0,0 +1,226 @@
+/*
+ * Measures the latency of handing a SegwayStatus from the read thread to the
+ * callback thread.
+ *
+ * A producer thread enqueues one status at a time and waits for the consumer
+ * to take it before enqueuing the next, so every handoff includes waking a
+ * consumer which is blocked on an empty queue, which is the common case when
+ * the RMP sends at 100 Hz.  The time from the enqueue to the dequeue
+ * returning is reported for the mutex and condition variable based
+ * FiniteConcurrentSharedQueue and for the SPSCRing which replaced it.  A
+ * burst section then pushes statuses through as fast as possible.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <queue>
+#include <string>
+
+#include <stdlib.h>
+
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+
+#include "benchmark_common.h"
+#include "segwayrmp/impl/spsc_ring.h"
+
+using namespace segwayrmp;
+using namespace benchmark;
+
+namespace {
+
+Clock::time_point epoch;
+
+// The queue the callbacks were handed statuses through before the SPSCRing,
+// kept here for comparison
+template<typename T>
+class FiniteConcurrentSharedQueue {
+  std::queue<boost::shared_ptr<T> > queue_;
+  boost::mutex mutex_;
+  boost::condition_variable condition_variable_;
+  size_t size_;
+  bool canceled_;
+public:
+  FiniteConcurrentSharedQueue(size_t size = 1024)
+    : size_(size), canceled_(false) {}
+  ~FiniteConcurrentSharedQueue() {}
+  
+  size_t size() {
+    boost::mutex::scoped_lock lock(mutex_);
+    return queue_.size();
+  }
+  
+  bool empty() {
+    return this->size() == 0;
+  }
+  
+  bool enqueue(boost::shared_ptr<T> element) {
+    bool dropped_element = false;
+    {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      if (queue_.size() == size_) {
+        queue_.pop();
+        dropped_element = true;
+      }
+      queue_.push(element);
+    }
+    condition_variable_.notify_one();
+    return dropped_element;
+  }
+  
+  boost::shared_ptr<T> dequeue() {
+    boost::unique_lock<boost::mutex> lock(mutex_);
+    while (queue_.empty()) {
+      // Checked before waiting too, a cancel() may already have notified
+      if (this->canceled_) {
+        return boost::shared_ptr<T>();
+      }
+      condition_variable_.wait(lock);
+    }
+    boost::shared_ptr<T> element = queue_.front();
+    queue_.pop();
+    return element;
+  }
+  
+  void cancel() {
+    {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      this->canceled_ = true;
+    }
+    condition_variable_.notify_all();
+  }
+  
+  void reset() {
+    {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      this->canceled_ = false;
+    }
+    condition_variable_.notify_all();
+  }
+};
+
+// Gives both queues the same interface
+class MutexQueue {
+public:
+  bool tryEnqueue(const SegwayStatus::Ptr &status) {
+    // Refuse like the ring does rather than dropping the oldest
+    if (queue_.size() >= 1024) {
+      return false;
+    }
+    return !queue_.enqueue(status);
+  }
+  bool dequeue(SegwayStatus::Ptr &status) {
+    status = queue_.dequeue();
+    return (bool)status;
+  }
+  void cancel() {
+    queue_.cancel();
+  }
+private:
+  FiniteConcurrentSharedQueue<SegwayStatus> queue_;
+};
+
+struct Results {
+  std::vector<long long> latencies;
+  boost::atomic<size_t> received;
+  Results() : received(0) {}
+};
+
+template<typename Queue> void
+consume(Queue *queue, Results *results, size_t count)
+{
+  SegwayStatus::Ptr status;
+  while (results->received.load() < count && queue->dequeue(status)) {
+    // The enqueue time travels in the timestamp
+    long long sent = (long long)status->timestamp.sec * 1000000000LL
+                   + status->timestamp.nsec;
+    results->latencies.push_back(nanosecondsSince(epoch) - sent);
+    status.reset();
+    results->received += 1;
+  }
+}
+
+template<typename Queue> void
+runPingPong(const char *name, size_t count)
+{
+  Queue queue;
+  Results results;
+  results.latencies.reserve(count);
+  std::vector<SegwayStatus::Ptr> statuses(count);
+  for (size_t i = 0; i < count; ++i) {
+    statuses[i] = SegwayStatus::Ptr(new SegwayStatus());
+  }
+  epoch = Clock::now();
+  boost::thread consumer(consume<Queue>, &queue, &results, count);
+  for (size_t i = 0; i < count; ++i) {
+    long long now = nanosecondsSince(epoch);
+    statuses[i]->timestamp = SegwayTime((uint32_t)(now / 1000000000LL),
+                                        (uint32_t)(now % 1000000000LL));
+    queue.tryEnqueue(statuses[i]);
+    statuses[i].reset();
+    // Wait for the consumer so that it is blocked when the next one comes
+    while (results.received.load() <= i) {
+      boost::this_thread::yield();
+    }
+  }
+  consumer.join();
+  std::cout << std::fixed << std::setprecision(1)
+            << "  " << std::setw(28) << std::left << name << std::right
+            << "  p50 " << std::setw(7)
+            << percentile(results.latencies, 0.50) / 1e3 << " us"
+            << "  p99 " << std::setw(7)
+            << percentile(results.latencies, 0.99) / 1e3 << " us"
+            << "  max " << std::setw(8)
+            << percentile(results.latencies, 1.0) / 1e3 << " us"
+            << std::endl;
+}
+
+template<typename Queue> void
+drain(Queue *queue, size_t *received, size_t count)
+{
+  SegwayStatus::Ptr status;
+  while (*received < count && queue->dequeue(status)) {
+    *received += 1;
+  }
+}
+
+template<typename Queue> void
+runBurst(const char *name, size_t count)
+{
+  Queue queue;
+  SegwayStatus::Ptr status(new SegwayStatus());
+  size_t received = 0;
+  Clock::time_point start = Clock::now();
+  boost::thread consumer(drain<Queue>, &queue, &received, count);
+  for (size_t i = 0; i < count; ++i) {
+    while (!queue.tryEnqueue(status)) {
+      boost::this_thread::yield();
+    }
+  }
+  consumer.join();
+  double seconds = secondsSince(start);
+  std::cout << std::fixed << std::setprecision(2)
+            << "  " << std::setw(28) << std::left << name << std::right
+            << std::setw(8) << count / seconds / 1e6 << " M statuses/s"
+            << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  size_t count = 20000;
+  if (argc > 1) {
+    count = (size_t)atol(argv[1]);
+  }
+
+  std::cout << "Enqueue to dequeue latency, consumer blocked, over " << count
+            << " statuses:" << std::endl;
+  runPingPong<MutexQueue>("FiniteConcurrentSharedQueue", count);
+  runPingPong<SPSCRing<SegwayStatus::Ptr> >("SPSCRing", count);
+
+  std::cout << "Burst throughput over " << count * 50 << " statuses:"
+            << std::endl;
+  runBurst<MutexQueue>("FiniteConcurrentSharedQueue", count * 50);
+  runBurst<SPSCRing<SegwayStatus::Ptr> >("SPSCRing", count * 50);
+  return 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * Measures the per frame latency of the termios serial interface.
+ *
+ * A thread writes one usb packet at a time into the master side of a pty
+ * pair, waiting for each one to come out of TermiosRMPIO::tryGetPackets on
+ * the slave side before writing the next.  The time from the write to the
+ * packet being returned is the latency of the kernel tty layer, the wakeup
+ * and the framer.  A pty has no baudrate, so wire time is not included.
+ * Optionally a tty device can be given to report whether the driver took
+ * the low latency setting.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+
+#include "benchmark_common.h"
+#include "segwayrmp/impl/rmp_termios.h"
+
+using namespace segwayrmp;
+using namespace benchmark;
+
+namespace {
+
+Clock::time_point epoch;
+boost::atomic<long long> sent_at(0);
+boost::atomic<size_t> received(0);
+
+void
+writeFrames(int master, size_t frames, std::vector<unsigned char> *stream)
+{
+  size_t cycle_frames = stream->size() / 18;
+  for (size_t i = 0; i < frames; ++i) {
+    const unsigned char *frame = &(*stream)[(i % cycle_frames) * 18];
+    sent_at = nanosecondsSince(epoch);
+    if (::write(master, frame, 18) != 18) {
+      std::cerr << "short write to the pty" << std::endl;
+      return;
+    }
+    // Wait for the reader so that only one frame is in flight
+    while (received.load() <= i) {
+      boost::this_thread::yield();
+    }
+  }
+}
+
+void
+reportLowLatency(const char *port)
+{
+  TermiosRMPIO rmp_io;
+  rmp_io.configure(port, 460800);
+  try {
+    rmp_io.connect();
+  } catch (std::exception &e) {
+    std::cout << "Could not open " << port << ": " << e.what() << std::endl;
+    return;
+  }
+  std::cout << port << " low latency: "
+            << (rmp_io.isLowLatency() ? "enabled" : "not supported")
+            << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  size_t frames = 20000;
+  if (argc > 1) {
+    frames = (size_t)atol(argv[1]);
+  }
+  if (argc > 2) {
+    reportLowLatency(argv[2]);
+  }
+
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+    std::cerr << "Could not open a pty pair" << std::endl;
+    return 1;
+  }
+  TermiosRMPIO rmp_io;
+  rmp_io.configure(ptsname(master), 460800);
+  rmp_io.connect();
+
+  std::vector<unsigned char> stream;
+  appendStatusCycle(stream);
+
+  std::vector<long long> latencies;
+  latencies.reserve(frames);
+  epoch = Clock::now();
+  boost::thread writer(writeFrames, master, frames, &stream);
+  Packet packets[16];
+  size_t count = 0;
+  while (received.load() < frames) {
+    if (rmp_io.tryGetPackets(packets, 16, count) != packet_ok)
+      continue;
+    long long now = nanosecondsSince(epoch);
+    for (size_t i = 0; i < count; ++i) {
+      latencies.push_back(now - sent_at.load());
+    }
+    received += count;
+  }
+  writer.join();
+  rmp_io.disconnect();
+  close(master);
+
+  PacketStatistics statistics = rmp_io.getStatistics();
+  std::cout << "Frame latency through a pty over " << frames << " frames:"
+            << std::endl;
+  std::cout << std::fixed << std::setprecision(1)
+            << "  p50 " << percentile(latencies, 0.50) / 1e3 << " us"
+            << "  p99 " << percentile(latencies, 0.99) / 1e3 << " us"
+            << "  max " << percentile(latencies, 1.0) / 1e3 << " us"
+            << std::endl;
+  std::cout << "  timeouts " << statistics.timeouts
+            << ", checksum mismatches " << statistics.checksum_mismatches
+            << std::endl;
+  return 0;
+}
@@ -0,0 +1,13 @@
+# If asked to and there are some benchmark src files
+if(SEGWAYRMP_BUILD_BENCHMARKS AND DEFINED SEGWAYRMP_BENCHMARK_SRCS)
+  message("-- Building SegwayRMP Benchmarks")
+  # The benchmarks time themselves with boost::chrono
+  find_package(Boost COMPONENTS chrono system REQUIRED)
+  # Compile each benchmark into its own executable
+  foreach(benchmark_src ${SEGWAYRMP_BENCHMARK_SRCS})
+    get_filename_component(benchmark_name ${benchmark_src} NAME_WE)
+    add_executable(segwayrmp_${benchmark_name} ${benchmark_src})
+    target_link_libraries(segwayrmp_${benchmark_name}
+      ${SEGWAYRMP_BENCHMARK_LINK_LIBS} ${Boost_CHRONO_LIBRARY})
+  endforeach(benchmark_src)
+endif(SEGWAYRMP_BUILD_BENCHMARKS AND DEFINED SEGWAYRMP_BENCHMARK_SRCS)
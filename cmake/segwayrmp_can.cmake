@@ -0,0 +1,13 @@
+# Build the SocketCAN support if requested and on Linux
+if(SEGWAYRMP_USE_CAN)
+  if(${CMAKE_SYSTEM_NAME} MATCHES "Linux")
+    message("-- Building SegwayRMP with SocketCAN support")
+    list(APPEND SEGWAYRMP_SRCS src/impl/rmp_can.cc)
+    add_definitions(-DSEGWAYRMP_USE_CAN)
+  else(${CMAKE_SYSTEM_NAME} MATCHES "Linux")
+    set(SEGWAYRMP_USE_CAN FALSE)
+    message("--")
+    message("-- SocketCAN support disabled: Only available on Linux.")
+    message("--")
+  endif(${CMAKE_SYSTEM_NAME} MATCHES "Linux")
+endif(SEGWAYRMP_USE_CAN)
@@ -0,0 +1,13 @@
+# Build the UDP ethernet support if requested and on Linux
+if(SEGWAYRMP_USE_ETHERNET)
+  if(${CMAKE_SYSTEM_NAME} MATCHES "Linux")
+    message("-- Building SegwayRMP with ethernet support")
+    list(APPEND SEGWAYRMP_SRCS src/impl/rmp_udp.cc)
+    add_definitions(-DSEGWAYRMP_USE_ETHERNET)
+  else(${CMAKE_SYSTEM_NAME} MATCHES "Linux")
+    set(SEGWAYRMP_USE_ETHERNET FALSE)
+    message("--")
+    message("-- Ethernet support disabled: Only available on Linux.")
+    message("--")
+  endif(${CMAKE_SYSTEM_NAME} MATCHES "Linux")
+endif(SEGWAYRMP_USE_ETHERNET)
@@ -1,4 +1,8 @@
-# Find Serial if support requested
+# Find Serial if support requested, the termios support replaces it
+if(SEGWAYRMP_USE_SERIAL AND SEGWAYRMP_USE_TERMIOS)
+  message("-- Serial library not needed: using termios serial support")
+  set(SEGWAYRMP_USE_SERIAL FALSE)
+endif()
 if(SEGWAYRMP_USE_SERIAL)
   find_package(serial QUIET)
 
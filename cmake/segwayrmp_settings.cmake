@@ -6,9 +6,21 @@ option(SEGWAYRMP_BUILD_EXAMPLES "Build the examples?" ON)
 # Should the tests be built?
 option(SEGWAYRMP_BUILD_TESTS "Build the tests?" OFF)
 
+# Should the benchmarks be built?
+option(SEGWAYRMP_BUILD_BENCHMARKS "Build the benchmarks?" OFF)
+
 # Should support for control via Serial be built?
 option(SEGWAYRMP_USE_SERIAL "Build with Serial (RS-232) Support?" ON)
 
+# Should the built in POSIX termios serial support be built?
+option(SEGWAYRMP_USE_TERMIOS "Build with native termios Serial Support?" ON)
+
+# Should support for control via SocketCAN be built?
+option(SEGWAYRMP_USE_CAN "Build with SocketCAN Support?" ON)
+
+# Should support for control via UDP ethernet be built?
+option(SEGWAYRMP_USE_ETHERNET "Build with UDP Ethernet Support?" ON)
+
 # Set the default path for built executables to the "bin" directory
 set(EXECUTABLE_OUTPUT_PATH ${PROJECT_SOURCE_DIR}/bin)
 # set the default path for built libraries to the "lib" directory
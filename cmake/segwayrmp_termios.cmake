@@ -0,0 +1,13 @@
+# Build the native termios serial support if requested and on a POSIX system
+if(SEGWAYRMP_USE_TERMIOS)
+  if(UNIX)
+    message("-- Building SegwayRMP with termios serial support")
+    list(APPEND SEGWAYRMP_SRCS src/impl/rmp_termios.cc)
+    add_definitions(-DSEGWAYRMP_USE_TERMIOS)
+  else(UNIX)
+    set(SEGWAYRMP_USE_TERMIOS FALSE)
+    message("--")
+    message("-- Termios serial support disabled: Not a POSIX system.")
+    message("--")
+  endif(UNIX)
+endif(SEGWAYRMP_USE_TERMIOS)
@@ -2,6 +2,7 @@
 #define SEGWAYRMP_GUI_H
 
 #include <QtGui/QMainWindow>
+#include <QtCore/QAtomicInt>
 #include <QtCore/QMutex>
 
 #include <SDL/SDL.h>
@@ -38,11 +39,14 @@ public slots:
     void onBalanceLockout();
     void onBalanceUnlock();
     void onSendConfig();
+    void handleConfigApplied();
+    void onConfigTimeout();
 
 signals:
     void USBUpdateComplete();
     void segwayLog(QString);
     void segwayStatus(QString);
+    void configApplied();
 
 public:
     explicit MainWindow(QWidget *parent = 0);
@@ -61,6 +65,8 @@ private:
     SDL_Joystick * joystick_;
     QMutex joy_mutex_;
     bool running_;
+    // Gain schedule sent by onSendConfig and not yet reported, -1 if none
+    QAtomicInt pending_gain_schedule_;
 
     void updateUSBList_();
 
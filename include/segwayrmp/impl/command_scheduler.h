@@ -0,0 +1,190 @@
+/*!
+ * \file command_scheduler.h
+ * \author  William Woodall <wjwwood@gmail.com>
+ * \version 0.1
+ *
+ * \section LICENSE
+ *
+ * The BSD License
+ *
+ * Copyright (c) 2013 William Woodall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * \section DESCRIPTION
+ *
+ * This provides a thread which sends the latest motion command at a fixed
+ * rate, and queued safety and configuration commands ahead of it.
+ */
+
+#ifndef COMMAND_SCHEDULER_H
+#define COMMAND_SCHEDULER_H
+
+#include <deque>
+
+#include <boost/atomic.hpp>
+#include <boost/chrono.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+#include "segwayrmp/segwayrmp.h"
+#include "segwayrmp/impl/rmp_io.h"
+#include "segwayrmp/impl/wakeup_event.h"
+
+namespace segwayrmp {
+
+/*!
+ * The classes of queued packets, in the order they are sent.
+ */
+typedef enum {
+  /*! Shutdown and power down, sent before anything else. */
+  transmit_safety = 0,
+  /*! Mode and configuration changes, sent before the motion setpoint. */
+  transmit_config = 1
+} TransmitPriority;
+
+/*!
+ * Sends a motion setpoint from a thread of its own, once every period, and
+ * every packet posted to it as soon as it can.
+ *
+ * The setpoint is a single latest-wins slot, setting it never blocks and
+ * only the latest setpoint set between two ticks is sent. The setpoint is
+ * sent again every tick until it is replaced, which keeps the Segway from
+ * timing out while the application is idle. Nothing is sent until the
+ * first setpoint is set.
+ *
+ * Posted packets are queued by TransmitPriority. Before every send the
+ * thread takes the oldest safety packet if there is one, then the oldest
+ * configuration packet, and only then the setpoint, so a safety packet
+ * waits for at most the one send already in progress.
+ *
+ * On Linux the ticks come from a timerfd, elsewhere from timed waits.
+ */
+class CommandScheduler {
+public:
+    typedef boost::function<void(Packet&)> SendCallback;
+
+    /*!
+     * Constructs a stopped scheduler.
+     *
+     * \param send Sends a packet, called on the scheduler's thread.
+     * \param handle_exception Called with whatever send throws.
+     */
+    CommandScheduler(SendCallback send, ExceptionCallback handle_exception);
+    ~CommandScheduler();
+
+    /*!
+     * Starts the thread. Can throw ConfigurationException.
+     *
+     * \param rate_hz The setpoints sent per second.
+     * \param setpoint_id The packet id the setpoint is sent with.
+     */
+    void start(double rate_hz, unsigned short setpoint_id);
+
+    /*!
+     * Stops the thread once every posted packet is sent, the setpoint is
+     * kept.
+     */
+    void stop();
+
+    bool isRunning() const {
+        return this->running_;
+    }
+
+    /*!
+     * Replaces the setpoint, it is sent on the next tick.
+     *
+     * \param data The eight data bytes of the setpoint packet.
+     */
+    void setSetpoint(const unsigned char *data);
+
+    /*!
+     * Queues a packet to be sent ahead of the setpoint. A safety packet
+     * also drops the setpoint, nothing drives the base after it until the
+     * next setSetpoint.
+     *
+     * \param packet The packet to send.
+     * \param priority The TransmitPriority of the packet.
+     */
+    void post(const Packet &packet, TransmitPriority priority);
+
+    /*!
+     * Returns the send counts and jitter so far. Safe to call from any
+     * thread.
+     */
+    CommandStatistics getStatistics() const;
+
+private:
+    // Disable Copy Constructor
+    CommandScheduler(const CommandScheduler &);
+    void operator=(const CommandScheduler &);
+
+    typedef boost::chrono::steady_clock Clock;
+
+    struct QueuedPacket {
+        Packet packet;
+        Clock::time_point posted;
+    };
+
+    void Run_();
+    // Waits for the next tick or a post, returns the ticks since the last
+    // one, 0 if woken by a post or stop
+    boost::uint64_t WaitForTick_();
+    // Sends every posted packet, highest priority first
+    void SendQueued_();
+    // Records the jitter of this tick and sends the setpoint
+    void Tick_(boost::uint64_t ticks);
+
+    SendCallback send_;
+    ExceptionCallback handle_exception_;
+    unsigned short setpoint_id_;
+    Clock::duration period_;
+    Clock::time_point started_;
+    boost::uint64_t tick_count_;
+    int timer_fd_;
+    // Set by a post or stop
+    WakeupEvent wake_event_;
+    boost::atomic<bool> stopping_;
+    boost::thread thread_;
+    // Written by start and stop, read by the threads sending commands
+    boost::atomic<bool> running_;
+
+    // Posted packets, one queue per TransmitPriority
+    boost::mutex queue_mutex_;
+    std::deque<QueuedPacket> queues_[2];
+
+    // The setpoint's data bytes, stored whole so it is never torn
+    boost::atomic<boost::uint64_t> setpoint_;
+    boost::atomic<bool> has_setpoint_;
+
+    // Only the scheduler's thread updates these, others may read them
+    boost::atomic<unsigned long long> sent_count_;
+    boost::atomic<unsigned long long> missed_tick_count_;
+    boost::atomic<unsigned long long> wakeup_count_;
+    boost::atomic<unsigned long long> jitter_sum_ns_;
+    boost::atomic<unsigned long long> max_jitter_ns_;
+    boost::atomic<unsigned long long> safety_sent_count_;
+    boost::atomic<unsigned long long> config_sent_count_;
+    boost::atomic<unsigned long long> max_safety_latency_ns_;
+};
+
+} // namespace segwayrmp
+
+#endif
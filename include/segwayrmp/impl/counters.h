@@ -0,0 +1,58 @@
+/*!
+ * \file counters.h
+ * \author  William Woodall <wjwwood@gmail.com>
+ * \version 0.1
+ *
+ * \section LICENSE
+ *
+ * The BSD License
+ *
+ * Copyright (c) 2013 William Woodall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * \section DESCRIPTION
+ *
+ * This provides the increment used by the statistics counters.
+ */
+
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#include <boost/atomic.hpp>
+
+namespace segwayrmp {
+
+/*!
+ * Adds n to a counter which only one thread writes.
+ * 
+ * The counters have a single writer, so a plain load and store is enough,
+ * readers on other threads may see the old value a little longer.
+ */
+inline void
+increment(boost::atomic<unsigned long long> &counter,
+          unsigned long long n = 1)
+{
+    counter.store(counter.load(boost::memory_order_relaxed) + n,
+                  boost::memory_order_relaxed);
+}
+
+} // namespace segwayrmp
+
+#endif
@@ -0,0 +1,146 @@
+/*!
+ * \file rmp_can.h
+ * \author  William Woodall <wjwwood@gmail.com>
+ * \version 0.1
+ *
+ * \section LICENSE
+ *
+ * The BSD License
+ *
+ * Copyright (c) 2013 William Woodall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * \section DESCRIPTION
+ *
+ * This provides a Linux SocketCAN based implementation of the rmp_io
+ * interface.
+ */
+
+#ifndef RMP_CAN_H
+#define RMP_CAN_H
+
+#include <string>
+
+#include <sys/socket.h>
+#include <linux/can.h>
+
+#include "segwayrmp/impl/rmp_io.h"
+
+namespace segwayrmp {
+
+/*!
+ * Provides a SocketCAN based interface for reading and writing packets.
+ * 
+ * Every CAN frame is a packet, so there is no usb framing or checksum,
+ * and frames are received in batches with a single recvmmsg call.  Only the
+ * status messages the RMP sends are let through the socket's filter.
+ */
+class CanRMPIO : public RMPIO {
+public:
+    /*!
+     * The most frames received by one call to tryGetPackets.
+     */
+    static const size_t batch_size = 32;
+    
+    /*!
+     * Constructs the CanRMPIO object.
+     */
+    CanRMPIO();
+    ~CanRMPIO();
+    
+    /*!
+     * Connects to the CAN interface if it has been configured. Can throw ConnectionFailedException.
+     */
+    void connect();
+    
+    /*!
+     * Disconnects from the CAN interface if it is open.
+     */
+    void disconnect();
+    
+    /*!
+     * CAN carries whole packets rather than a byte stream, always throws
+     * ReadFailedException, use tryGetPackets.
+     */
+    int read(unsigned char* buffer, int size);
+    
+    /*!
+     * CAN carries whole packets rather than a byte stream, always throws
+     * WriteFailedException, use sendPacket.
+     */
+    int write(unsigned char* buffer, int size);
+    
+    int getFileDescriptor() {return this->fd;}
+    
+    /*!
+     * Returns the received CAN frames as packets, waiting up to the read
+     * timeout, a second by default, for the first one.
+     * 
+     * \param packets An array of packets to be read into.
+     * \param max The size of the packets array.
+     * \param count Set to the number of packets read.
+     * \return PacketStatus packet_ok if any packets were read, else the reason
+     *  none were.
+     */
+    PacketStatus
+    tryGetPackets(Packet *packets, size_t max, size_t &count) SEGWAYRMP_NOEXCEPT;
+    
+    /*!
+     * Sends a packet as a single CAN frame.
+     * 
+     * \param packet A packet by reference to be written.
+     */
+    void sendPacket(Packet &packet);
+    
+    /*!
+     * Sends the packets as CAN frames with as few calls as the transmit
+     * queue allows.
+     * 
+     * \param packets An array of packets to be written.
+     * \param count The number of packets.
+     */
+    void sendPackets(Packet *packets, size_t count);
+    
+    /*!
+     * Configures the CAN interface.
+     * 
+     * \param interface_name The network interface of the CAN bus, like 'can0'.
+     */
+    void configure(std::string interface_name);
+    
+private:
+    PacketStatus readFailed(const char *what);
+    void waitWritable();
+    
+    bool configured;
+    
+    std::string interface_name;
+    
+    int fd;
+    
+    // Set up once so that receiving doesn't touch them again
+    struct can_frame frames[batch_size];
+    struct iovec iovecs[batch_size];
+    struct mmsghdr messages[batch_size];
+};
+
+}
+
+#endif
@@ -92,6 +92,11 @@ public:
      */
     int write(unsigned char* buffer, int size);
     
+    /*!
+     * Cancels any currently being processed packets, waking a blocked read.
+     */
+    void cancel();
+    
     /*!
      * Configures the usb port using the devices Serial Number.
      * 
@@ -122,6 +127,7 @@ private:
     void connectBySerial();
     void connectByDescription();
     void connectByIndex();
+    DWORD waitForData_();
     
     bool configured;
     
@@ -136,6 +142,13 @@ private:
     int baudrate;
     
     FT_HANDLE usb_port_handle;
+    
+    // Signaled by the driver when bytes arrive, and by cancel()
+#if defined(_WIN32)
+    HANDLE rx_event;
+#else
+    EVENT_HANDLE rx_event;
+#endif
 };
 
 }
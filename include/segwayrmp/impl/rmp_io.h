@@ -39,15 +39,61 @@
 #ifndef RMP_IO_H
 #define RMP_IO_H
 
+#include <algorithm>
 #include <vector>
 #include <cstdio>
+#include <cstring>
 
+#include <boost/atomic.hpp>
 #include <boost/thread.hpp>
 
 #include <segwayrmp/segwayrmp.h>
+#include <segwayrmp/impl/counters.h>
+#include <segwayrmp/impl/wakeup_event.h>
+
+// Marks functions which never throw
+#if __cplusplus >= 201103L
+# define SEGWAYRMP_NOEXCEPT noexcept
+#else
+# define SEGWAYRMP_NOEXCEPT throw()
+#endif
 
 namespace segwayrmp {
 
+/*!
+* Defines the outcomes of trying to retrieve packets from the RMP, the
+* values match the error numbers of PacketRetrievalException.
+*/
+typedef enum {
+  packet_ok                = 0, /*!< At least one packet was retrieved. */
+  packet_not_connected     = 1, /*!< The I/O interface is not connected. */
+  packet_checksum_mismatch = 2, /*!< A packet failed its checksum. */
+  packet_no_data           = 3, /*!< The read returned without any data. */
+  packet_canceled          = 4, /*!< Retrieval was canceled. */
+  packet_read_failed       = 5  /*!< The underlying read failed. */
+} PacketStatus;
+
+/*!
+* Counts the outcomes of packet retrieval.
+*/
+struct PacketStatistics {
+  unsigned long long packets; /*!< Packets retrieved. */
+  unsigned long long checksum_mismatches; /*!< Packets with bad checksums. */
+  unsigned long long timeouts; /*!< Reads which returned no data. */
+  unsigned long long read_failures; /*!< Reads which failed. */
+  /*! Bytes discarded searching for packets, e.g. line noise. */
+  unsigned long long skipped_bytes;
+  /*!
+   * Packets found by rescanning the bytes of a packet which failed its
+   * checksum, which would have been lost by discarding the whole packet.
+   */
+  unsigned long long recovered_packets;
+
+  PacketStatistics()
+  : packets(0), checksum_mismatches(0), timeouts(0), read_failures(0),
+    skipped_bytes(0), recovered_packets(0) {}
+};
+
 /*!
 * Represents the structure of a usb packet to be sent or received over
 * the wire.
@@ -56,18 +102,130 @@ struct Packet {
   unsigned short id; /*!< Packet ID. */
   unsigned char channel; /*!< CAN Bus Channel. */
   unsigned char data[8]; /*!< Data bytes. */
+  /*!
+   * Time the kernel received the packet, for interfaces which timestamp
+   * packets, otherwise zero.
+   */
+  SegwayTime timestamp;
+  /*!
+   * For interfaces whose messages don't fit in the data bytes, the whole
+   * received message, valid until packets are next retrieved, else NULL.
+   */
+  const unsigned char *payload;
+  size_t payload_length; /*!< Length of the payload. */
 
-  Packet() : id(0), channel(0) {
+  Packet() : id(0), channel(0), payload(NULL), payload_length(0) {
     for (int i = 0; i < 8; ++i) { data[i] = 0x00; }
   }
 };
 
+/*!
+* Fixed capacity byte ring buffer used to frame packets out of the raw byte
+* stream.
+*
+* Bytes are appended at the tail by reading directly into writeRegion() and
+* consumed from the head by moving a cursor, so no bytes are ever shifted and
+* no memory is allocated after construction.
+*/
+class RingBuffer {
+public:
+  /*! Capacity in bytes, must be a power of two. */
+  static const size_t capacity = 256;
+
+  RingBuffer() : head(0), tail(0) {}
+
+  /*! Number of buffered bytes. */
+  size_t size() const {return this->tail - this->head;}
+
+  /*! Number of bytes which can still be appended. */
+  size_t space() const {return capacity - this->size();}
+
+  /*! Returns the i'th buffered byte, counting from the head. */
+  unsigned char operator[](size_t i) const {
+    return this->data[(this->head + i) & (capacity - 1)];
+  }
+
+  /*!
+   * Copies the first length buffered bytes into destination without
+   * consuming them.
+   */
+  void copy(unsigned char *destination, size_t length) const {
+    size_t offset = this->head & (capacity - 1);
+    size_t first = std::min(length, capacity - offset);
+    memcpy(destination, this->data + offset, first);
+    memcpy(destination + first, this->data, length - first);
+  }
+
+  /*!
+   * Gives the largest contiguous region of buffered bytes at the head of the
+   * buffer.
+   *
+   * \param region Set to the start of the buffered region.
+   * \return size_t The length of the buffered region.
+   */
+  size_t readRegion(const unsigned char *&region) const {
+    size_t offset = this->head & (capacity - 1);
+    region = this->data + offset;
+    return std::min(this->size(), capacity - offset);
+  }
+
+  /*! Discards the first length buffered bytes. */
+  void consume(size_t length) {this->head += length;}
+
+  /*!
+   * Gives the largest contiguous free region at the tail of the buffer.
+   *
+   * \param region Set to the start of the free region.
+   * \return size_t The length of the free region.
+   */
+  size_t writeRegion(unsigned char *&region) {
+    size_t offset = this->tail & (capacity - 1);
+    region = this->data + offset;
+    return std::min(this->space(), capacity - offset);
+  }
+
+  /*! Appends length bytes previously written into writeRegion(). */
+  void commit(size_t length) {this->tail += length;}
+
+  /*! Discards all of the buffered bytes. */
+  void clear() {this->head = this->tail = 0;}
+
+private:
+  size_t head;
+  size_t tail;
+  unsigned char data[capacity];
+};
+
+/*!
+* Finds the first usb packet header, 0xF0 0x55 followed by the channel 0xAA
+* or 0xBB, in a block of data.
+*
+* Uses AVX2 or SSE2 compares when the library is compiled for them and
+* memchr otherwise.
+*
+* \param data The data to search.
+* \param length The length of data.
+* \return size_t The offset of the first header. If there is none, the offset
+*  of the trailing one or two bytes which could still be the start of a
+*  header, else length.
+*/
+size_t findPacketHeader(const unsigned char *data, size_t length);
+
 /*!
 * Provides a generic interface for getting, building, manipulating, and sending packets.
 */
 class RMPIO {
 public:
-    RMPIO() : canceled(false) {}
+    RMPIO()
+    : canceled(false), read_timeout_ms(1000), rescan_remaining(0),
+      packet_count(0),
+      checksum_mismatch_count(0), timeout_count(0), read_failure_count(0),
+      skipped_byte_count(0), recovered_packet_count(0)
+    {
+      this->read_error[0] = '\0';
+    }
+  virtual ~RMPIO() {}
+
   /*!
    * Abstract Connect Function, implemented by subclass.
    */
@@ -103,12 +261,53 @@ public:
    */
   void getPacket(Packet &packet);
   
+  /*!
+   * This function returns every complete packet which is already buffered,
+   * reading from the RMP once first only if there are none.
+   * 
+   * If a packet fails its checksum after other packets were taken from the
+   * buffer those packets are returned and the mismatch is thrown by the
+   * next call.  Only the 0xF0 of a packet failing its checksum is discarded,
+   * the search for the next packet resumes right after it.
+   * 
+   * \param packets An array of packets to be read into.
+   * \param max The size of the packets array.
+   * \return size_t The number of packets read, at least one.
+   */
+  size_t getPackets(Packet *packets, size_t max);
+  
+  /*!
+   * Like getPackets, but reports failures with a status instead of throwing,
+   * so it can be used in the reading loop without exception overhead.
+   * 
+   * Subclasses whose transport already delivers whole packets override
+   * this, and sendPacket, to bypass the usb framing.
+   * 
+   * \param packets An array of packets to be read into.
+   * \param max The size of the packets array.
+   * \param count Set to the number of packets read.
+   * \return PacketStatus packet_ok if any packets were read, else the reason
+   *  none were.
+   */
+  virtual PacketStatus
+  tryGetPackets(Packet *packets, size_t max, size_t &count) SEGWAYRMP_NOEXCEPT;
+  
   /*!
    * This function validates and writes a packet to the RMP.
    * 
    * \param packet A packet by reference to be written.
    */
-  void sendPacket(Packet &packet);
+  virtual void sendPacket(Packet &packet);
+  
+  /*!
+   * Writes several packets to the RMP at once, in order. The usb framing
+   * encodes them all into one buffer and writes it with a single call, so
+   * a burst costs one transfer instead of one per packet.
+   * 
+   * \param packets An array of packets to be written.
+   * \param count The number of packets.
+   */
+  virtual void sendPackets(Packet *packets, size_t count);
   
   /*!
    * A function to see if the underlying I/O interface is connected.
@@ -119,17 +318,66 @@ public:
 
   /*!
    * Cancels any currently being processed packets, should be called at shudown.
+   * 
+   * A read blocked waiting for data returns immediately, subclasses which
+   * can't wait on cancel_event must override this to wake their read.
+   */
+  virtual void cancel() {
+    this->canceled = true;
+    this->cancel_event.set();
+  }
+
+  /*!
+   * Returns a descriptor which polls readable when there is data to read,
+   * or -1 if the interface has none.
    */
-  void cancel() {this->canceled = true;}
+  virtual int getFileDescriptor() {return -1;}
+
+  /*!
+   * Sets how long a read waits for data before giving up, 0 makes reads
+   * return right away when nothing is waiting.  Only interfaces with a
+   * file descriptor honor this, the default is a second.
+   * 
+   * \param timeout_ms Milliseconds to wait.
+   */
+  void setReadTimeout(int timeout_ms) {this->read_timeout_ms = timeout_ms;}
+
+  /*!
+   * Returns the counts of packet retrieval outcomes so far.
+   */
+  PacketStatistics getStatistics();
+
+  /*!
+   * Returns the message of the last failed read, see packet_read_failed.
+   */
+  const char * getReadError() {return this->read_error;}
   
 protected:
-  void fillBuffer();
+  PacketStatus fillBuffer() SEGWAYRMP_NOEXCEPT;
+  size_t skipToPacketHeader();
   unsigned char computeChecksum(unsigned char* usb_packet);
+  // Encodes packet into the 18 bytes of a usb packet, checksum included
+  void encodePacket(const Packet &packet, unsigned char *usb_packet);
   
   bool connected;
-  bool canceled;
+  boost::atomic<bool> canceled;
+  // Set by cancel(), reads should wait on this along with their data
+  WakeupEvent cancel_event;
+  // Milliseconds a read waits for data, see setReadTimeout
+  int read_timeout_ms;
+  char read_error[256];
+  
+  RingBuffer data_buffer;
+  // Bytes left to rescan of the last packet to fail its checksum
+  size_t rescan_remaining;
   
-  std::vector<unsigned char> data_buffer;
+  // Only the thread retrieving packets updates these, others may read them
+  boost::atomic<unsigned long long> packet_count;
+  boost::atomic<unsigned long long> checksum_mismatch_count;
+  boost::atomic<unsigned long long> timeout_count;
+  boost::atomic<unsigned long long> read_failure_count;
+  boost::atomic<unsigned long long> skipped_byte_count;
+  boost::atomic<unsigned long long> recovered_packet_count;
 };
 
 DEFINE_EXCEPTION(PacketRetrievalException, "Error retrieving a packet from the"
@@ -0,0 +1,124 @@
+/*!
+ * \file rmp_termios.h
+ * \author  William Woodall <wjwwood@gmail.com>
+ * \version 0.1
+ *
+ * \section LICENSE
+ *
+ * The BSD License
+ *
+ * Copyright (c) 2013 William Woodall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * \section DESCRIPTION
+ *
+ * This provides a POSIX termios based serial implementation of the rmp_io
+ * interface, which needs no libraries beyond the C library.
+ */
+
+#ifndef RMP_TERMIOS_H
+#define RMP_TERMIOS_H
+
+#include <string>
+
+#include "segwayrmp/impl/rmp_io.h"
+
+namespace segwayrmp {
+
+/*!
+ * Provides a serial based interface for reading and writing packets which
+ * talks to the tty directly.
+ * 
+ * The port is opened exclusively and non-blocking, in raw mode, and reads
+ * wake when a whole 18 byte usb packet has arrived rather than on every byte.
+ * On Linux the driver is also asked for low latency where it supports it.
+ */
+class TermiosRMPIO : public RMPIO {
+public:
+    /*!
+     * Constructs the TermiosRMPIO object.
+     */
+    TermiosRMPIO();
+    ~TermiosRMPIO();
+    
+    /*!
+     * Connects to the serial port if it has been configured. Can throw ConnectionFailedException.
+     */
+    void connect();
+    
+    /*!
+     * Disconnects from the serial port if it is open.
+     */
+    void disconnect();
+    
+    /*!
+     * Read Function, reads from the serial port.
+     * 
+     * Waits up to the read timeout, a second by default, for data, or until
+     * canceled.
+     * 
+     * \param buffer An unsigned char array for data to be read into.
+     * \param size The amount of data to be read.
+     * \return int Bytes read.
+     */
+    int read(unsigned char* buffer, int size);
+    
+    /*!
+     * Write Function, writes to the serial port.
+     * 
+     * \param buffer An unsigned char array of data to be written.
+     * \param size The amount of data to be written.
+     * \return int Bytes written.
+     */
+    int write(unsigned char* buffer, int size);
+    
+    int getFileDescriptor() {return this->fd;}
+    
+    /*!
+     * Configures the serial port.
+     * 
+     * \param port The tty device like '/dev/ttyUSB0'.
+     * \param baudrate The speed of the serial communication.
+     * \param low_latency Ask the driver to push received bytes immediately
+     *  (ASYNC_LOW_LATENCY), ignored where unsupported.
+     */
+    void configure(std::string port, int baudrate, bool low_latency = true);
+    
+    /*!
+     * Returns true if the driver accepted the low latency setting.
+     */
+    bool isLowLatency() {return this->low_latency_enabled;}
+    
+private:
+    void configurePort();
+    
+    bool configured;
+    
+    std::string port;
+    int baudrate;
+    bool low_latency;
+    bool low_latency_enabled;
+    
+    int fd;
+};
+
+}
+
+#endif
@@ -0,0 +1,198 @@
+/*!
+ * \file rmp_udp.h
+ * \author  William Woodall <wjwwood@gmail.com>
+ * \version 0.1
+ *
+ * \section LICENSE
+ *
+ * The BSD License
+ *
+ * Copyright (c) 2013 William Woodall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * \section DESCRIPTION
+ *
+ * This provides a UDP based ethernet implementation of the rmp_io interface.
+ */
+
+#ifndef RMP_UDP_H
+#define RMP_UDP_H
+
+#include <string>
+
+#include <sys/socket.h>
+
+#include "segwayrmp/impl/rmp_io.h"
+
+namespace segwayrmp {
+
+/*!
+ * Provides a UDP based interface for reading and writing packets.
+ * 
+ * Each datagram carries one packet as a CAN message would, the big endian
+ * 16 bit id followed by the 8 data bytes.  Datagrams are received in batches
+ * with a single recvmmsg call, and each packet is stamped with the time the
+ * kernel received its datagram.
+ */
+class UdpRMPIO : public RMPIO {
+public:
+    /*!
+     * The most datagrams received by one call to tryGetPackets.
+     */
+    static const size_t batch_size = 32;
+    
+    /*!
+     * The largest datagram which is received whole.
+     */
+    static const size_t max_datagram_size = 512;
+    
+    /*!
+     * Constructs the UdpRMPIO object.
+     */
+    UdpRMPIO();
+    ~UdpRMPIO();
+    
+    /*!
+     * Connects to the base if it has been configured. Can throw ConnectionFailedException.
+     */
+    void connect();
+    
+    /*!
+     * Disconnects from the base if it is connected.
+     */
+    void disconnect();
+    
+    /*!
+     * UDP carries whole packets rather than a byte stream, always throws
+     * ReadFailedException, use tryGetPackets.
+     */
+    int read(unsigned char* buffer, int size);
+    
+    /*!
+     * Write Function, sends buffer to the base as one datagram.
+     * 
+     * \param buffer An unsigned char array of data to be written.
+     * \param size The amount of data to be written.
+     * \return int Bytes written.
+     */
+    int write(unsigned char* buffer, int size);
+    
+    int getFileDescriptor() {return this->fd;}
+    
+    /*!
+     * Returns the received datagrams as packets, waiting up to the read
+     * timeout, a second by default, for the first one.
+     * 
+     * \param packets An array of packets to be read into.
+     * \param max The size of the packets array.
+     * \param count Set to the number of packets read.
+     * \return PacketStatus packet_ok if any packets were read, else the reason
+     *  none were.
+     */
+    PacketStatus
+    tryGetPackets(Packet *packets, size_t max, size_t &count) SEGWAYRMP_NOEXCEPT;
+    
+    /*!
+     * Sends a packet to the base as one datagram.
+     * 
+     * \param packet A packet by reference to be written.
+     */
+    void sendPacket(Packet &packet);
+    
+    /*!
+     * Sends the packets to the base as one datagram each, with as few calls
+     * as the send buffer allows.
+     * 
+     * \param packets An array of packets to be written.
+     * \param count The number of packets.
+     */
+    void sendPackets(Packet *packets, size_t count);
+    
+    /*!
+     * Configures the connection to the base.
+     * 
+     * \param address The IPv4 address of the base, like '192.168.0.40'.
+     * \param port The UDP port of the base, like 8080.
+     * \param receive_buffer_size The socket receive buffer size in bytes, or
+     *  0 to keep the system default.
+     * \param send_buffer_size The socket send buffer size in bytes, or 0 to
+     *  keep the system default.
+     */
+    void configure(std::string address, int port,
+                   int receive_buffer_size = 0, int send_buffer_size = 0);
+    
+protected:
+    /*!
+     * Decodes a received datagram, which stays in place until the next call
+     * to tryGetPackets, into packet.
+     * 
+     * \return bool false if the datagram isn't a valid packet.
+     */
+    virtual bool
+    decodeDatagram(const unsigned char *datagram, size_t length,
+                   Packet &packet);
+    
+    /*!
+     * Encodes packet into a datagram of at most max_datagram_size bytes.
+     * 
+     * \return size_t The length of the datagram.
+     */
+    virtual size_t encodePacket(const Packet &packet, unsigned char *datagram);
+    
+private:
+    PacketStatus readFailed(const char *what);
+    void waitWritable();
+    void setBufferSize(int option, int size, const char *what);
+    
+    bool configured;
+    
+    std::string address;
+    int port;
+    int receive_buffer_size;
+    int send_buffer_size;
+    
+    int fd;
+    
+    // Set up once so that receiving doesn't touch them again
+    unsigned char datagrams[batch_size][max_datagram_size];
+    // Room for the SO_TIMESTAMPNS control message, aligned for cmsghdr
+    unsigned long long controls[batch_size][8];
+    struct iovec iovecs[batch_size];
+    struct mmsghdr messages[batch_size];
+};
+
+/*!
+ * Provides the UDP interface of the rmpx440, which answers every command with
+ * a feedback message.
+ * 
+ * Commands are protected by a CRC-16, and feedback messages which pass their
+ * CRC are returned as packets with the id X440_FEEDBACK_ID and the message
+ * as their payload, to be decoded by X440Protocol.
+ */
+class X440RMPIO : public UdpRMPIO {
+protected:
+    bool decodeDatagram(const unsigned char *datagram, size_t length,
+                        Packet &packet);
+    size_t encodePacket(const Packet &packet, unsigned char *datagram);
+};
+
+}
+
+#endif
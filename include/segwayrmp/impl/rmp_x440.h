@@ -0,0 +1,168 @@
+/*!
+ * \file rmp_x440.h
+ * \author  William Woodall <wjwwood@gmail.com>
+ * \version 0.1
+ *
+ * \section LICENSE
+ *
+ * The BSD License
+ *
+ * Copyright (c) 2013 William Woodall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * \section DESCRIPTION
+ *
+ * This provides the message encoding and decoding of the RMP x440 protocol.
+ * 
+ * Commands are sent as a big endian 16 bit id, 8 data bytes and a CRC-16.
+ * The base answers every command with a feedback message made of the 32 bit
+ * big endian words selected by four user feedback bitmaps, in bit order
+ * starting with bitmap 1, followed by a CRC-16.  Both CRCs are big endian.
+ */
+
+#ifndef RMP_X440_H
+#define RMP_X440_H
+
+#include <cstddef>
+
+#include <boost/cstdint.hpp>
+
+namespace segwayrmp {
+
+class SegwayStatus;
+struct Packet;
+
+/*!
+ * Bits of the user feedback bitmaps which the x440 protocol decodes, as
+ * (bitmap number - 1) * 32 + bit.
+ */
+typedef enum {
+  x440_frame_count           = 8,       /*!< u32, 100 Hz frames */
+  x440_pse_pitch_deg         = 18,      /*!< float */
+  x440_pse_pitch_rate_dps    = 19,      /*!< float */
+  x440_pse_roll_deg          = 20,      /*!< float */
+  x440_pse_roll_rate_dps     = 21,      /*!< float */
+  x440_pse_yaw_rate_dps      = 22,      /*!< float */
+  x440_aux_batt_voltage_v    = 30,      /*!< float */
+  x440_right_front_vel_mps   = 64 + 2,  /*!< float */
+  x440_left_front_vel_mps    = 64 + 3,  /*!< float */
+  x440_right_front_pos_m     = 64 + 6,  /*!< float */
+  x440_left_front_pos_m      = 64 + 7,  /*!< float */
+  x440_linear_pos_m          = 64 + 10, /*!< float */
+  x440_vel_target_mps        = 96 + 8,  /*!< float */
+  x440_yaw_rate_target_rps   = 96 + 9   /*!< float */
+} X440FeedbackItem;
+
+/*!
+ * Message ids and general purpose commands of the x440 protocol.
+ */
+typedef enum {
+  x440_motion_command_id            = 0x0500,
+  x440_configuration_command_id     = 0x0501,
+  x440_set_user_feedback_1_bitmap   = 17,
+  x440_set_user_feedback_2_bitmap   = 18,
+  x440_set_user_feedback_3_bitmap   = 19,
+  x440_set_user_feedback_4_bitmap   = 20
+} X440Command;
+
+/*!
+ * Pseudo packet id given to feedback messages, which have no id of their own.
+ */
+static const unsigned short X440_FEEDBACK_ID = 0xFFFF;
+
+/*!
+ * Computes the CRC-16 (polynomial 0xA001, initial value 0) of the x440
+ * protocol.
+ *
+ * \param data The message to check.
+ * \param length The length of the message, not including the CRC.
+ * \return boost::uint16_t The CRC.
+ */
+boost::uint16_t computeX440Crc(const unsigned char *data, size_t length);
+
+/*!
+ * Decodes x440 feedback messages straight out of the received buffer into a
+ * SegwayStatus and encodes commands.
+ *
+ * The position of every decoded item in a feedback message is worked out
+ * once when the bitmaps are set, so decoding only reads the words it needs.
+ */
+class X440Protocol {
+public:
+  /*!
+   * Constructs the protocol with the default bitmaps, selecting every item
+   * which is decoded.
+   */
+  X440Protocol();
+
+  /*!
+   * Selects the items the base sends in its feedback messages.  The base
+   * must be told with the commands from encodeFeedbackBitmapCommands.
+   */
+  void setFeedbackBitmaps(boost::uint32_t bitmap1, boost::uint32_t bitmap2,
+                          boost::uint32_t bitmap3, boost::uint32_t bitmap4);
+
+  /*! Returns the feedback bitmap number index + 1. */
+  boost::uint32_t getFeedbackBitmap(size_t index) const {
+    return this->bitmaps[index];
+  }
+
+  /*! Returns the length of a feedback message including its CRC. */
+  size_t getFeedbackLength() const {return this->word_count * 4 + 2;}
+
+  /*!
+   * Decodes a feedback message, without its CRC, into status.  Items which
+   * aren't selected by the bitmaps are left untouched.
+   *
+   * \param words The feedback message.
+   * \param length The length of the message without the CRC.
+   * \param status The status to decode into.
+   * \return bool false if the length doesn't match the bitmaps.
+   */
+  bool decodeFeedback(const unsigned char *words, size_t length,
+                      SegwayStatus &status) const;
+
+  /*!
+   * Encodes a packet as a command message with its CRC.
+   *
+   * \param packet The packet to encode.
+   * \param message At least 12 bytes to encode the message into.
+   * \return size_t The length of the message, 12.
+   */
+  static size_t encodeCommand(const Packet &packet, unsigned char *message);
+
+  /*!
+   * Builds the configuration packets which set the base's feedback bitmaps
+   * to these.
+   *
+   * \param packets An array of 4 packets.
+   */
+  void encodeFeedbackBitmapCommands(Packet *packets) const;
+
+private:
+  boost::uint32_t bitmaps[4];
+  size_t word_count;
+  // Word offset of each decoded item in the order of the decode table, or -1
+  int offsets[16];
+};
+
+} // namespace segwayrmp
+
+#endif
@@ -0,0 +1,118 @@
+/*!
+ * \file seqlock.h
+ * \author  William Woodall <wjwwood@gmail.com>
+ * \version 0.1
+ *
+ * \section LICENSE
+ *
+ * The BSD License
+ *
+ * Copyright (c) 2013 William Woodall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * \section DESCRIPTION
+ *
+ * This provides a sequence lock which publishes the latest value of a type
+ * which can be copied byte by byte from one writer to any number of readers.
+ */
+
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <cstring>
+
+#include <boost/atomic.hpp>
+#include <boost/static_assert.hpp>
+#include <boost/type_traits/has_trivial_copy.hpp>
+#include <boost/type_traits/has_trivial_destructor.hpp>
+
+namespace segwayrmp {
+
+/*!
+ * Publishes snapshots of a T from a single writer.
+ * 
+ * T is copied with memcpy, so it needs a trivial copy constructor and
+ * destructor, it may have constructors of its own like SegwayStatus does.
+ * 
+ * Neither side takes a lock or makes a system call.  The writer is
+ * wait-free, it never waits for the readers.  Reads are only lock-free: a
+ * reader copies the value and retries when a store overlapped its copy, so
+ * a reader racing a writer which stores back to back could retry without
+ * bound.  The RMP sends at 100 Hz and a store is one copy of T, so in
+ * practice a read retries rarely and at most once or twice.
+ */
+template<typename T>
+class SeqLock {
+    BOOST_STATIC_ASSERT(boost::has_trivial_copy<T>::value
+                        && boost::has_trivial_destructor<T>::value);
+public:
+    SeqLock() : sequence_(0), published_(false), value_() {}
+
+    /*!
+     * Publishes value, single writer only.
+     */
+    void store(const T &value) {
+        unsigned int sequence =
+          this->sequence_.load(boost::memory_order_relaxed);
+        // Odd while the value is being written
+        this->sequence_.store(sequence + 1, boost::memory_order_relaxed);
+        boost::atomic_thread_fence(boost::memory_order_release);
+        memcpy(&this->value_, &value, sizeof(T));
+        this->sequence_.store(sequence + 2, boost::memory_order_release);
+        this->published_.store(true, boost::memory_order_release);
+    }
+
+    /*!
+     * Copies the latest published value into value, retrying while a store
+     * overlaps the copy.
+     * 
+     * \return bool false if nothing has been published yet.
+     */
+    bool load(T &value) const {
+        if (!this->published_.load(boost::memory_order_acquire)) {
+            return false;
+        }
+        while (true) {
+            unsigned int before =
+              this->sequence_.load(boost::memory_order_acquire);
+            if (before & 1) {
+                continue;
+            }
+            memcpy(&value, &this->value_, sizeof(T));
+            boost::atomic_thread_fence(boost::memory_order_acquire);
+            if (this->sequence_.load(boost::memory_order_relaxed) == before) {
+                return true;
+            }
+        }
+    }
+
+private:
+    // Disable Copy Constructor
+    SeqLock(const SeqLock &);
+    void operator=(const SeqLock &);
+
+    boost::atomic<unsigned int> sequence_;
+    boost::atomic<bool> published_;
+    T value_;
+};
+
+} // namespace segwayrmp
+
+#endif
@@ -0,0 +1,324 @@
+/*!
+ * \file spsc_ring.h
+ * \author  William Woodall <wjwwood@gmail.com>
+ * \version 0.1
+ *
+ * \section LICENSE
+ *
+ * The BSD License
+ *
+ * Copyright (c) 2013 William Woodall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * \section DESCRIPTION
+ *
+ * This provides a bounded single producer, single consumer ring used to
+ * hand SegwayStatus's from the read thread to the callback thread.
+ */
+
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <algorithm>
+#include <cstddef>
+
+#include <boost/atomic.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "segwayrmp/impl/wakeup_event.h"
+
+namespace segwayrmp {
+
+/*!
+ * A bounded, wait-free ring for exactly one producer thread and one consumer
+ * thread.
+ * 
+ * The slots are allocated once on construction, so neither side allocates or
+ * takes a lock.  Either side can block, the consumer in dequeue() and the
+ * producer in enqueue(), and each only touches the other's wakeup event when
+ * the other is actually asleep.
+ * 
+ * A ring constructed as overwritable also lets the producer drop the oldest
+ * element to make room, see enqueueOverwriting().  Then the producer and the
+ * consumer share the head through a spin lock, held just long enough to move
+ * one element.
+ */
+template<typename T>
+class SPSCRing {
+public:
+    /*!
+     * Constructs the ring.
+     * 
+     * \param capacity The number of elements it holds, at least one.
+     * \param overwritable If true, enqueueOverwriting() may be used.
+     */
+    explicit SPSCRing(size_t capacity = 1024, bool overwritable = false)
+    : capacity_(std::max(capacity, (size_t)1)), overwritable_(overwritable),
+      head_(0), cached_tail_(0), head_locked_(false), tail_(0),
+      cached_head_(0), consumer_waiting_(false), producer_waiting_(false),
+      canceled_(false)
+    {
+        // The slots are a power of two so the index can be masked
+        size_t size = 1;
+        while (size < this->capacity_) {
+            size <<= 1;
+        }
+        this->mask_ = size - 1;
+        this->slots_ = new T[size];
+    }
+
+    ~SPSCRing() {
+        delete [] this->slots_;
+    }
+
+    size_t capacity() const {
+        return this->capacity_;
+    }
+
+    /*!
+     * Returns the number of queued elements, exact only when called from the
+     * producer or the consumer while the other is idle.
+     */
+    size_t size() const {
+        return this->tail_.load(boost::memory_order_acquire)
+             - this->head_.load(boost::memory_order_acquire);
+    }
+
+    bool empty() const {
+        return this->size() == 0;
+    }
+
+    /*!
+     * Adds an element, producer only.
+     * 
+     * \return bool false if the ring was full and the element was not added.
+     */
+    bool tryEnqueue(const T &element) {
+        size_t tail = this->tail_.load(boost::memory_order_relaxed);
+        if (tail - this->cached_head_ >= this->capacity_) {
+            // Only look at the consumer's index when the ring looks full
+            this->cached_head_ = this->head_.load(boost::memory_order_acquire);
+            if (tail - this->cached_head_ >= this->capacity_) {
+                return false;
+            }
+        }
+        this->slots_[tail & this->mask_] = element;
+        this->tail_.store(tail + 1, boost::memory_order_release);
+        // Pairs with the fence in dequeue(), either the consumer sees the new
+        // tail or we see that it is waiting.  Only the first enqueue after it
+        // fell asleep wakes it, the rest don't need the system call
+        boost::atomic_thread_fence(boost::memory_order_seq_cst);
+        if (this->consumer_waiting_.load(boost::memory_order_relaxed)
+            && this->consumer_waiting_.exchange(false)) {
+            this->ready_.set();
+        }
+        return true;
+    }
+
+    /*!
+     * Adds an element, blocking while the ring is full, producer only.
+     * 
+     * \return bool false if the ring was canceled while full.
+     */
+    bool enqueue(const T &element) {
+        while (true) {
+            if (this->tryEnqueue(element)) {
+                return true;
+            }
+            if (this->canceled_) {
+                return false;
+            }
+            this->producer_waiting_.store(true, boost::memory_order_relaxed);
+            boost::atomic_thread_fence(boost::memory_order_seq_cst);
+            // Check again, the consumer may have missed that we are waiting
+            if (this->tryEnqueue(element)) {
+                this->producer_waiting_ = false;
+                return true;
+            }
+            if (!this->canceled_) {
+                this->space_.wait(-1);
+            }
+            this->producer_waiting_ = false;
+            if (!this->canceled_) {
+                this->space_.reset();
+            }
+        }
+    }
+
+    /*!
+     * Adds an element, dropping the oldest one if the ring is full, producer
+     * only and only on an overwritable ring.
+     * 
+     * \return bool true if the oldest element was dropped.
+     */
+    bool enqueueOverwriting(const T &element) {
+        if (this->tryEnqueue(element)) {
+            return false;
+        }
+        T dropped = T();
+        bool was_dropped = false;
+        this->lockHead();
+        size_t head = this->head_.load(boost::memory_order_relaxed);
+        // The consumer may have made room since
+        if (this->tail_.load(boost::memory_order_relaxed) - head
+            >= this->capacity_) {
+            std::swap(dropped, this->slots_[head & this->mask_]);
+            this->head_.store(head + 1, boost::memory_order_release);
+            was_dropped = true;
+        }
+        this->unlockHead();
+        this->tryEnqueue(element);
+        // dropped is released here, outside of the lock
+        return was_dropped;
+    }
+
+    /*!
+     * Takes the oldest element without blocking, consumer only.
+     * 
+     * \return bool false if the ring was empty.
+     */
+    bool tryDequeue(T &element) {
+        if (this->overwritable_) {
+            this->lockHead();
+        }
+        size_t head = this->head_.load(boost::memory_order_relaxed);
+        // The producer may have dropped past our copy of the tail
+        if (head >= this->cached_tail_) {
+            this->cached_tail_ = this->tail_.load(boost::memory_order_acquire);
+            if (head >= this->cached_tail_) {
+                if (this->overwritable_) {
+                    this->unlockHead();
+                }
+                return false;
+            }
+        }
+        T &slot = this->slots_[head & this->mask_];
+        std::swap(element, slot);
+        // Don't keep the element alive in the ring
+        slot = T();
+        this->head_.store(head + 1, boost::memory_order_release);
+        if (this->overwritable_) {
+            this->unlockHead();
+        }
+        // Pairs with the fence in enqueue(), like for the consumer
+        boost::atomic_thread_fence(boost::memory_order_seq_cst);
+        if (this->producer_waiting_.load(boost::memory_order_relaxed)
+            && this->producer_waiting_.exchange(false)) {
+            this->space_.set();
+        }
+        return true;
+    }
+
+    /*!
+     * Takes the oldest element, blocking while the ring is empty, consumer
+     * only.
+     * 
+     * \param timeout_ms Milliseconds to wait, or -1 to wait forever.
+     * \return bool false if the ring was canceled while empty or the timeout
+     *  expired.
+     */
+    bool dequeue(T &element, int timeout_ms = -1) {
+        while (true) {
+            if (this->tryDequeue(element)) {
+                return true;
+            }
+            if (this->canceled_) {
+                return false;
+            }
+            this->consumer_waiting_.store(true, boost::memory_order_relaxed);
+            boost::atomic_thread_fence(boost::memory_order_seq_cst);
+            // Check again, the producer may have missed that we are waiting
+            if (this->tryDequeue(element)) {
+                this->consumer_waiting_ = false;
+                return true;
+            }
+            bool woken = true;
+            if (!this->canceled_) {
+                woken = this->ready_.wait(timeout_ms);
+            }
+            this->consumer_waiting_ = false;
+            if (!this->canceled_) {
+                this->ready_.reset();
+            }
+            if (!woken) {
+                // An element may have come just as we gave up
+                return this->tryDequeue(element);
+            }
+        }
+    }
+
+    /*!
+     * Wakes both sides, after which dequeue() returns false once empty and
+     * enqueue() returns false once full.
+     */
+    void cancel() {
+        this->canceled_ = true;
+        this->ready_.set();
+        this->space_.set();
+    }
+
+    /*!
+     * Undoes a cancel().
+     */
+    void reset() {
+        this->canceled_ = false;
+        this->ready_.reset();
+        this->space_.reset();
+    }
+
+private:
+    // Disable Copy Constructor
+    SPSCRing(const SPSCRing &);
+    void operator=(const SPSCRing &);
+
+    void lockHead() {
+        while (this->head_locked_.exchange(true, boost::memory_order_acquire)) {
+            boost::this_thread::yield();
+        }
+    }
+
+    void unlockHead() {
+        this->head_locked_.store(false, boost::memory_order_release);
+    }
+
+    T *slots_;
+    size_t mask_;
+    size_t capacity_;
+    bool overwritable_;
+    // The indexes only ever increase, the slot is the index & mask_.  What
+    // each side writes sits on its own cache line
+    char padding0_[64];
+    boost::atomic<size_t> head_;
+    size_t cached_tail_; // The consumer's copy of tail_
+    boost::atomic<bool> head_locked_; // Only used when overwritable_
+    char padding1_[64];
+    boost::atomic<size_t> tail_;
+    size_t cached_head_; // The producer's copy of head_
+    char padding2_[64];
+    boost::atomic<bool> consumer_waiting_;
+    boost::atomic<bool> producer_waiting_;
+    boost::atomic<bool> canceled_;
+    WakeupEvent ready_;
+    WakeupEvent space_;
+};
+
+} // namespace segwayrmp
+
+#endif
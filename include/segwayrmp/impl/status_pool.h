@@ -0,0 +1,187 @@
+/*!
+ * \file status_pool.h
+ * \author  William Woodall <wjwwood@gmail.com>
+ * \version 0.1
+ *
+ * \section LICENSE
+ *
+ * The BSD License
+ *
+ * Copyright (c) 2013 William Woodall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * \section DESCRIPTION
+ *
+ * This provides a pool which recycles SegwayStatus's so that the read thread
+ * does not allocate once it is running.
+ */
+
+#ifndef STATUS_POOL_H
+#define STATUS_POOL_H
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/lockfree/stack.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/type_traits/aligned_storage.hpp>
+
+#include "segwayrmp/segwayrmp.h"
+
+namespace segwayrmp {
+
+/*!
+ * A fixed size pool of SegwayStatus's.
+ * 
+ * acquire() hands out a status whose shared_ptr puts it back into the pool
+ * when the last copy is released, on whichever thread that happens.  The
+ * shared_ptr control blocks come from the pool as well, so handing out and
+ * returning a status never touches the heap.  When every status is out,
+ * acquire() falls back to new and counts a miss.
+ * 
+ * The pool must be owned by a shared_ptr, outstanding statuses keep it alive.
+ */
+class StatusPool : public boost::enable_shared_from_this<StatusPool> {
+public:
+    /*!
+     * Constructs the pool, allocating all of its statuses up front.
+     * 
+     * \param size The number of statuses in the pool.
+     */
+    explicit StatusPool(size_t size);
+    ~StatusPool();
+
+    /*!
+     * Returns a default constructed status, from the pool when it is not
+     * empty.
+     */
+    SegwayStatus::Ptr acquire();
+
+    /*!
+     * Returns the number of times acquire() had to allocate.
+     */
+    unsigned long long getMissCount() const {
+        return this->miss_count_;
+    }
+
+    /*!
+     * Returns the number of statuses which are in the pool.
+     */
+    size_t getAvailable() const {
+        return this->available_;
+    }
+
+    size_t getSize() const {
+        return this->statuses_.size();
+    }
+
+private:
+    // Disable Copy Constructor
+    StatusPool(const StatusPool &);
+    void operator=(const StatusPool &);
+
+    // Puts a status back, called when its last shared_ptr goes away
+    struct Recycler {
+        StatusPool *pool;
+        explicit Recycler(StatusPool *pool) : pool(pool) {}
+        void operator()(SegwayStatus *status) const;
+    };
+
+    // Storage for one shared_ptr control block
+    static const size_t BLOCK_SIZE = 128;
+    typedef boost::aligned_storage<BLOCK_SIZE>::type Block;
+
+    /*
+     * Gives shared_ptr its control blocks from the pool.  It holds the pool
+     * so that the pool outlives every block handed out.
+     */
+    template<typename T>
+    class BlockAllocator {
+    public:
+        typedef T value_type;
+        typedef T *pointer;
+        typedef const T *const_pointer;
+        typedef T &reference;
+        typedef const T &const_reference;
+        typedef size_t size_type;
+        typedef std::ptrdiff_t difference_type;
+        template<typename U> struct rebind {
+            typedef BlockAllocator<U> other;
+        };
+
+        explicit BlockAllocator(const boost::shared_ptr<StatusPool> &pool)
+        : pool(pool) {}
+        template<typename U>
+        BlockAllocator(const BlockAllocator<U> &other) : pool(other.pool) {}
+
+        T *allocate(size_t n, const void * = 0) {
+            if (n * sizeof(T) <= BLOCK_SIZE) {
+                void *block = this->pool->takeBlock();
+                if (block != NULL) {
+                    return static_cast<T *>(block);
+                }
+            }
+            return static_cast<T *>(::operator new(n * sizeof(T)));
+        }
+        void deallocate(T *p, size_t) {
+            if (!this->pool->giveBlock(p)) {
+                ::operator delete(p);
+            }
+        }
+        void construct(T *p, const T &value) {
+            new (p) T(value);
+        }
+        void destroy(T *p) {
+            p->~T();
+        }
+        size_t max_size() const {
+            return BLOCK_SIZE / sizeof(T);
+        }
+        template<typename U>
+        bool operator==(const BlockAllocator<U> &other) const {
+            return this->pool == other.pool;
+        }
+        template<typename U>
+        bool operator!=(const BlockAllocator<U> &other) const {
+            return this->pool != other.pool;
+        }
+
+        boost::shared_ptr<StatusPool> pool;
+    };
+
+    void *takeBlock();
+    bool giveBlock(void *block);
+
+    std::vector<SegwayStatus> statuses_;
+    std::vector<Block> blocks_;
+    boost::lockfree::stack<SegwayStatus *,
+                           boost::lockfree::fixed_sized<true> > free_statuses_;
+    boost::lockfree::stack<Block *,
+                           boost::lockfree::fixed_sized<true> > free_blocks_;
+    boost::atomic<size_t> available_;
+    boost::atomic<unsigned long long> miss_count_;
+};
+
+} // namespace segwayrmp
+
+#endif
@@ -0,0 +1,112 @@
+/*!
+ * \file wakeup_event.h
+ * \author  William Woodall <wjwwood@gmail.com>
+ * \version 0.1
+ *
+ * \section LICENSE
+ *
+ * The BSD License
+ *
+ * Copyright (c) 2013 William Woodall
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * \section DESCRIPTION
+ *
+ * This provides an event which wakes threads blocked in poll().
+ */
+
+#ifndef WAKEUP_EVENT_H
+#define WAKEUP_EVENT_H
+
+#if defined(_WIN32)
+# include <boost/thread.hpp>
+#endif
+
+namespace segwayrmp {
+
+/*!
+ * An event which stays set until it is reset, and which can be polled
+ * alongside other file descriptors.
+ *
+ * It is backed by an eventfd on Linux and by a pipe on other POSIX systems.
+ * On Windows there is no descriptor and only wait() can block on it.
+ */
+class WakeupEvent {
+public:
+  /*!
+   * Constructs the event unset. Can throw ConfigurationException.
+   */
+  WakeupEvent();
+  ~WakeupEvent();
+
+  /*!
+   * Returns a descriptor which polls readable while the event is set, or -1
+   * if the platform has none.
+   */
+  int fd() const {return this->read_fd_;}
+
+  /*!
+   * Sets the event, waking anything waiting on it.
+   */
+  void set();
+
+  /*!
+   * Unsets the event.
+   */
+  void reset();
+
+  /*!
+   * Blocks until the event is set or the timeout expires.
+   *
+   * \param timeout_ms Milliseconds to wait, or -1 to wait forever.
+   * \return bool true if the event is set.
+   */
+  bool wait(int timeout_ms);
+
+private:
+  // Disable Copy Constructor
+  WakeupEvent(const WakeupEvent &);
+  void operator=(const WakeupEvent &);
+
+  int read_fd_;
+  int write_fd_;
+#if defined(_WIN32)
+  bool set_;
+  boost::mutex mutex_;
+  boost::condition_variable condition_variable_;
+#endif
+};
+
+#if !defined(_WIN32)
+/*!
+ * Blocks until fd is readable, the timeout expires, or event is set.
+ *
+ * \param fd The file descriptor to wait on.
+ * \param event An event which interrupts the wait when set.
+ * \param timeout_ms Milliseconds to wait, or -1 to wait forever.
+ * \return int 1 if fd is readable, 0 on timeout, -1 if the event was set or
+ *  poll failed.
+ */
+int waitReadable(int fd, const WakeupEvent &event, int timeout_ms);
+#endif
+
+} // namespace segwayrmp
+
+#endif
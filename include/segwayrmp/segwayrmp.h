@@ -41,9 +41,11 @@
 
 #include <exception>
 #include <sstream>
-#include <queue>
 #include <typeinfo>
+#include <vector>
 
+#include <boost/atomic.hpp>
+#include <boost/chrono.hpp>
 #include <boost/function.hpp>
 #include <boost/thread.hpp>
 
@@ -63,7 +65,7 @@
   class ClassName : public std::exception { \
     void operator=(const ClassName &); \
     const ClassName & operator=( ClassName ); \
-    const char * what_; \
+    std::string what_; \
     const int id_; \
   public: \
     ClassName(const char * file, const int ln, \
@@ -71,9 +73,10 @@
       std::stringstream ss; \
       ss << #ClassName " occurred at line " << ln \
          << " of `" << file << "`: " << Prefix << msg; \
-      what_ = ss.str().c_str(); \
+      what_ = ss.str(); \
     } \
-    virtual const char* what () const throw () { return what_; } \
+    virtual ~ClassName() throw () {} \
+    virtual const char* what () const throw () { return what_.c_str(); } \
     const int error_number() { return this->id_; } \
   };
 
@@ -87,7 +90,8 @@
   throw ExceptionClass(__FILE__, __LINE__, (Message), (Id) )
 
 /*!
- * Defines the number of buffered SegwayStatus structures to be held.
+ * Defines the default number of buffered SegwayStatus structures to be held,
+ * see SegwayRMP::setStatusQueue.
  */
 #define MAX_SEGWAYSTATUS_QUEUE_SIZE 100
 
@@ -98,7 +102,8 @@ namespace segwayrmp {
  */
 typedef enum {
   /*!
-   * This method is unsupported currently.
+   * This method communicates to the Segway over a CAN bus using Linux
+   * SocketCAN.
    */
   can     = 0,
   /*!
@@ -106,7 +111,8 @@ typedef enum {
    */
   usb     = 1,
   /*!
-   * This method communicates to the Segway via a virtual serial port.
+   * This method communicates to the Segway via a virtual serial port, using
+   * the tty directly on POSIX systems and the Serial library elsewhere.
    */
   serial  = 2,
   /*!
@@ -186,6 +192,87 @@ typedef enum {
   heavy = 2
 } ControllerGainSchedule;
 
+/*!
+ * Defines how new SegwayStatus's are delivered to the user.
+ */
+typedef enum {
+  /*!
+   * Each status is queued and handed to the status callback on a separate
+   * thread. The latest status can also be polled with getLatestStatus.
+   */
+  status_callbacks = 0,
+  /*!
+   * The latest status is only published for getLatestStatus, there is no
+   * queue and no callback thread.
+   */
+  status_polling   = 1,
+  /*!
+   * The status callback is called on the read thread as soon as a status
+   * is complete, there is no queue and no callback thread. The callback
+   * must return quickly, the next packets are not read until it does.
+   */
+  status_inline    = 2
+} StatusDeliveryMode;
+
+/*!
+ * Defines what happens to a new SegwayStatus when the status queue is full,
+ * which only happens when the status callbacks fall behind.
+ */
+typedef enum {
+  /*!
+   * The oldest queued status is dropped to make room.
+   */
+  queue_drop_oldest = 0,
+  /*!
+   * The new status is dropped.
+   */
+  queue_drop_newest = 1,
+  /*!
+   * The read thread waits for the callbacks to make room. Nothing is lost,
+   * but no packets are read while waiting.
+   */
+  queue_block       = 2,
+  /*!
+   * Only the latest status is kept, a new status replaces an undelivered
+   * one. The queue depth is ignored.
+   */
+  queue_coalesce    = 3
+} QueueOverflowPolicy;
+
+/*!
+ * Counts what happened to the statuses passing through the status queue.
+ */
+struct StatusQueueStatistics {
+  unsigned long long dropped_oldest; /*!< Queued statuses dropped or
+                                          replaced by newer ones. */
+  unsigned long long dropped_newest; /*!< New statuses dropped. */
+  unsigned long long blocked; /*!< Times the read thread waited for room. */
+  size_t high_water_mark; /*!< The most statuses ever queued at once. */
+
+  StatusQueueStatistics()
+  : dropped_oldest(0), dropped_newest(0), blocked(0), high_water_mark(0) {}
+};
+
+/*!
+ * Counts the commands sent by the transmit thread and how far the motion
+ * commands strayed from their schedule, see SegwayRMP::setCommandRate.
+ */
+struct CommandStatistics {
+  unsigned long long sent; /*!< Motion commands sent. */
+  /*! Ticks which passed without a send, the thread was woken too late. */
+  unsigned long long missed_ticks;
+  double mean_jitter_us; /*!< Mean lateness of a send in microseconds. */
+  double max_jitter_us; /*!< Worst lateness of a send in microseconds. */
+  unsigned long long safety_sent; /*!< Shutdown and power down commands. */
+  unsigned long long config_sent; /*!< Mode and configuration commands. */
+  /*! Worst time from queueing a safety command to having sent it. */
+  double max_safety_latency_us;
+
+  CommandStatistics()
+  : sent(0), missed_ticks(0), mean_jitter_us(0.0), max_jitter_us(0.0),
+    safety_sent(0), config_sent(0), max_safety_latency_us(0.0) {}
+};
+
 /*!
  * Represents the time of a timestamp using seconds and nanoseconds.
  */
@@ -201,74 +288,14 @@ public:
   uint32_t nsec; /*!< Nanoseconds since the last second */
 };
 
-template<typename T>
-class FiniteConcurrentSharedQueue {
-  std::queue<boost::shared_ptr<T> > queue_;
-  boost::mutex mutex_;
-  boost::condition_variable condition_variable_;
-  size_t size_;
-  bool canceled_;
-public:
-  FiniteConcurrentSharedQueue(size_t size = 1024)
-    : size_(size), canceled_(false) {}
-  ~FiniteConcurrentSharedQueue() {}
-  
-  size_t size() {
-    boost::mutex::scoped_lock(mutex_);
-    return queue_.size();
-  }
-  
-  bool empty() {
-    return this->size() == 0;
-  }
-  
-  bool enqueue(boost::shared_ptr<T> element) {
-    bool dropped_element = false;
-    {
-      boost::lock_guard<boost::mutex> lock(mutex_);
-      if (queue_.size() == size_) {
-        queue_.pop();
-        dropped_element = true;
-      }
-      queue_.push(element);
-    }
-    condition_variable_.notify_one();
-    return dropped_element;
-  }
-  
-  boost::shared_ptr<T> dequeue() {
-    boost::unique_lock<boost::mutex> lock(mutex_);
-    while (queue_.empty()) {
-      condition_variable_.wait(lock);
-      if (this->canceled_) {
-        return boost::shared_ptr<T>();
-      }
-    }
-    boost::shared_ptr<T> element = queue_.front();
-    queue_.pop();
-    return element;
-  }
-  
-  void cancel() {
-    {
-      boost::lock_guard<boost::mutex> lock(mutex_);
-      this->canceled_ = true;
-    }
-    condition_variable_.notify_all();
-  }
-  
-  void reset() {
-    {
-      boost::lock_guard<boost::mutex> lock(mutex_);
-      this->canceled_ = false;
-    }
-    condition_variable_.notify_all();
-  }
-};
-
 // Forward declarations
+template<typename T> class SPSCRing;
+template<typename T> class SeqLock;
+class StatusPool;
+class CommandScheduler;
 class RMPIO;
-class Packet;
+struct Packet;
+class X440Protocol;
 
 /*!
  * Contains Status Information returned by the Segway RMP.
@@ -326,10 +353,89 @@ public:
 };
 
 typedef boost::function<void(SegwayStatus::Ptr)> SegwayStatusCallback;
+/*!
+ * Receives a batch of SegwayStatus's, oldest first, as a pointer to the
+ * first of count contiguous statuses. The batch is only valid during the
+ * call, copy the pointers to keep statuses longer.
+ */
+typedef boost::function<void(const SegwayStatus::Ptr *, size_t)>
+  SegwayStatusBatchCallback;
 typedef boost::function<SegwayTime(void)> GetTimeCallback;
 typedef boost::function<void(const std::exception&)> ExceptionCallback;
 typedef boost::function<void(const std::string&)> LogMsgCallback;
 
+/*!
+ * Runs status callbacks on threads owned by the application.
+ * 
+ * Implement this on top of a thread pool or an event loop and give it to
+ * SegwayRMP::setCallbackExecutor, then any number of SegwayRMP's share the
+ * application's threads instead of each starting a callback thread.
+ */
+class CallbackExecutor {
+public:
+  virtual ~CallbackExecutor() {}
+
+  /*!
+   * Runs task, later, on one of the executor's threads. Must not block and
+   * must keep running posted tasks until every SegwayRMP using it has
+   * stopped reading.
+   * 
+   * \param task The task to run.
+   */
+  virtual void post(const boost::function<void()> &task) = 0;
+};
+
+/*!
+ * Defines which statuses a subscriber receives and where, see
+ * SegwayRMP::addStatusSubscriber. With both limits set a status must pass
+ * both.
+ */
+struct SubscriberOptions {
+  /*! Only every rate_divisor'th status is delivered, 1 for every one. */
+  unsigned int rate_divisor;
+  /*! Delivered statuses are at least this many milliseconds apart. */
+  int min_period_ms;
+  /*!
+   * Runs the callback, or empty to call it on the read thread as soon as
+   * the status is complete, like status_inline.
+   */
+  boost::shared_ptr<CallbackExecutor> executor;
+
+  SubscriberOptions() : rate_divisor(1), min_period_ms(0) {}
+};
+
+/*!
+ * A set of configuration changes, applied together by
+ * SegwayRMP::applyConfiguration. Only the values which are set are
+ * changed, the scale factors are clamped to [0.0, 1.0] like the setters of
+ * SegwayRMP do.
+ */
+class Configuration {
+public:
+  Configuration();
+
+  void setOperationalMode(OperationalMode operational_mode);
+  void setControllerGainSchedule(
+    ControllerGainSchedule controller_gain_schedule);
+  void setMaxVelocityScaleFactor(double scalar);
+  void setMaxAccelerationScaleFactor(double scalar);
+  void setMaxTurnScaleFactor(double scalar);
+  void setCurrentLimitScaleFactor(double scalar);
+
+private:
+  friend class SegwayRMP;
+
+  bool has_operational_mode_;
+  OperationalMode operational_mode_;
+  bool has_controller_gain_schedule_;
+  ControllerGainSchedule controller_gain_schedule_;
+  // Negative when not set
+  double max_velocity_scale_factor_;
+  double max_acceleration_scale_factor_;
+  double max_turn_scale_factor_;
+  double current_limit_scale_factor_;
+};
+
 /*!
  * Provides an interface for the Segway RMP.
  */
@@ -338,12 +444,16 @@ public:
   /*!
    * Constructs the SegwayRMP object given the interface type.
    * 
-   * \param interface_type This must be can, usb, or serial. Default is usb.
+   * \param interface_type This must be can, usb, serial, or ethernet.
+   *  Default is serial.
    * \param segway_rmp_type This can be rmp50, rmp100, rmp200, or rmp400.
    *  Default is rmp200.
+   * \param status_delivery_mode How new statuses are delivered, see
+   *  StatusDeliveryMode. Default is status_callbacks.
    */
   SegwayRMP(InterfaceType interface_type = serial,
-            SegwayRMPType segway_rmp_type = rmp200);
+            SegwayRMPType segway_rmp_type = rmp200,
+            StatusDeliveryMode status_delivery_mode = status_callbacks);
   ~SegwayRMP();
 
   /*!
@@ -357,6 +467,46 @@ public:
   void
   configureSerial(std::string port, int baudrate = 460800);
 
+  /*!
+   * Configures the CAN interface, if the library is built with CAN
+   * support, otherwise throws ConfigurationException.
+   * 
+   * \param interface_name Defines the SocketCAN network interface which the
+   *  Segway is on. Defaults to "can0".
+   */
+  void
+  configureCAN(std::string interface_name = "can0");
+
+  /*!
+   * Configures the ethernet interface, if the library is built with
+   * ethernet support, otherwise throws ConfigurationException.
+   * 
+   * \param address Defines the IPv4 address of the Segway.
+   * \param port Defines the UDP port of the Segway. Defaults to 8080.
+   * \param receive_buffer_size Defines the socket receive buffer size in
+   *  bytes, 0 keeps the system default.
+   * \param send_buffer_size Defines the socket send buffer size in bytes, 0
+   *  keeps the system default.
+   */
+  void
+  configureEthernet(std::string address, int port = 8080,
+                    int receive_buffer_size = 0, int send_buffer_size = 0);
+
+  /*!
+   * Selects the items an rmpx440 reports in its feedback, see
+   * X440FeedbackItem for the ones which are decoded. The default selects
+   * all of those. Must be called before connecting, the bitmaps are sent to
+   * the Segway by connect. Throws ConfigurationException otherwise.
+   * 
+   * \param bitmap1 User feedback bitmap 1.
+   * \param bitmap2 User feedback bitmap 2.
+   * \param bitmap3 User feedback bitmap 3.
+   * \param bitmap4 User feedback bitmap 4.
+   */
+  void
+  setX440FeedbackBitmaps(uint32_t bitmap1, uint32_t bitmap2,
+                         uint32_t bitmap3, uint32_t bitmap4);
+
   /*!
    * Configures the FTD2XX usb interface, if the library is built with usb
    * support, otherwise throws ConfigurationException.
@@ -399,9 +549,36 @@ public:
    * Connects to the Segway. Ensure it has been configured first.
    *
    * \param reset_integrators If this is true, the integrators are reset.
+   * \param start_threads If this is false, no threads are started and
+   *  nothing is read until spinOnce is called. Wait for nativeHandle to be
+   *  readable in your own poll set and call spinOnce from your own loop.
    */
   void
-  connect(bool reset_integrators = true);
+  connect(bool reset_integrators = true, bool start_threads = true);
+
+  /*!
+   * Returns the file descriptor of the interface, to wait on for new data
+   * when connected with start_threads false.
+   *
+   * \return int The file descriptor, or -1 if the interface has none (usb,
+   *  the serial library) or is not connected.
+   */
+  int
+  nativeHandle();
+
+  /*!
+   * Frames, parses and delivers whatever has already been received, without
+   * waiting for more. Only valid when connected with start_threads false.
+   *
+   * Statuses are delivered on the calling thread according to the
+   * StatusDeliveryMode, status_callbacks without a CallbackExecutor calls
+   * the status callback for each queued status before returning. Read
+   * errors are reported through the exception callback as usual.
+   *
+   * \return bool true if any packets were received.
+   */
+  bool
+  spinOnce();
 
   /*!
    * Sends a shutdown command to the RMP that immediately shuts it down.
@@ -513,6 +690,28 @@ public:
   void
   setCurrentLimitScaleFactor(double scalar = 1.0);
   
+  /*!
+   * Applies a Configuration as one transaction.
+   * 
+   * Values already in effect are not sent again: the operational mode and
+   * controller gain schedule as last reported by the Segway, the scale
+   * factors as last sent since connecting, which the Segway does not
+   * report. The rest are sent in one write, then this waits until the
+   * Segway reports the new operational mode and controller gain schedule.
+   * A power down is sent like shutdown and is not waited for.
+   * 
+   * Throws ConfigurationException if not connected, on an rmpx440, which
+   * does not take these commands, or if the deadline expires first.
+   * 
+   * \param configuration The changes to apply.
+   * \param timeout_ms Milliseconds to wait for the Segway to report the
+   *  changes, or 0 to return once they are sent.
+   * \return size_t The number of commands sent.
+   */
+  size_t
+  applyConfiguration(const Configuration &configuration,
+                     int timeout_ms = 1000);
+  
   /*!
    * Sets the Callback Function to be called on new Segway Status Updates.
    * 
@@ -560,6 +759,134 @@ public:
    */
   void
   setStatusCallback(SegwayStatusCallback callback);
+
+  /*!
+   * Adds a subscriber which receives statuses alongside the status
+   * callback, at its own rate. Can be called at any time, from any thread.
+   * 
+   * Statuses a subscriber skips cost it nothing, the rate limits are
+   * checked on the read thread before anything is handed over. Subscribers
+   * receive statuses in every StatusDeliveryMode. Set the status callback
+   * to an empty function if only subscribers are wanted.
+   * 
+   * \param callback A function pointer to the callback function.
+   * \param options The rate limits and executor of the subscriber.
+   * \return int An id to remove the subscriber with.
+   */
+  int
+  addStatusSubscriber(SegwayStatusCallback callback,
+                      const SubscriberOptions &options = SubscriberOptions());
+
+  /*!
+   * Removes a subscriber. A status which is already being delivered may
+   * still reach it.
+   * 
+   * \param id The id returned by addStatusSubscriber.
+   */
+  void
+  removeStatusSubscriber(int id);
+
+  /*!
+   * Sets how new SegwayStatus's are delivered, must be called before
+   * connecting. Defaults to status_callbacks.
+   * 
+   * \param mode The StatusDeliveryMode to use.
+   */
+  void
+  setStatusDeliveryMode(StatusDeliveryMode mode);
+
+  /*!
+   * Sets a callback which receives the statuses in batches instead of one
+   * at a time, replacing the status callback, in the status_callbacks mode.
+   * Must be called before connecting.
+   * 
+   * A batch is delivered once it holds max_count statuses or its oldest
+   * status has waited max_age_ms, whichever comes first. With a
+   * CallbackExecutor the age is only checked as statuses arrive, spinOnce
+   * checks it on every call. A partial batch is delivered when the
+   * SegwayRMP stops.
+   * 
+   * This suits consumers like loggers, which can then write a whole batch
+   * at once.
+   * 
+   * \param callback A function pointer to the callback function, or an
+   *  empty function to use the status callback again.
+   * \param max_count The most statuses in a batch, at least one.
+   * \param max_age_ms Milliseconds a status can wait in a batch.
+   */
+  void
+  setStatusBatchCallback(SegwayStatusBatchCallback callback,
+                         size_t max_count = 100, int max_age_ms = 1000);
+
+  /*!
+   * Sets an executor to run the status callbacks on in the status_callbacks
+   * mode, instead of a callback thread of our own. Callbacks of one
+   * SegwayRMP are called in order and never concurrently, even on a pool of
+   * threads. Must be called before connecting.
+   * 
+   * \param executor The CallbackExecutor to use, or an empty pointer to use
+   *  a callback thread again.
+   */
+  void
+  setCallbackExecutor(boost::shared_ptr<CallbackExecutor> executor);
+
+  /*!
+   * Sets the depth of the status queue used by the status_callbacks mode
+   * and what happens when it is full. Must be called before connecting.
+   * Defaults to MAX_SEGWAYSTATUS_QUEUE_SIZE and queue_drop_oldest, so that a
+   * lagging callback catches up on the newest statuses.
+   * 
+   * \param depth The most statuses held for the callbacks, at least one.
+   * \param policy The QueueOverflowPolicy to apply when the queue is full.
+   */
+  void
+  setStatusQueue(size_t depth, QueueOverflowPolicy policy);
+
+  /*!
+   * Returns the drop counts and high-water mark of the status queue. Safe
+   * to call from any thread.
+   */
+  StatusQueueStatistics
+  getStatusQueueStatistics();
+
+  /*!
+   * Sends motion commands at a fixed rate from a thread of its own instead
+   * of on the calling thread. move and moveCounts then only store the
+   * latest command, which is sent on the next tick and repeated every tick
+   * until it is replaced, keeping the Segway from timing out. Must be
+   * called before connecting.
+   * 
+   * The other commands are queued for the same thread and return without
+   * waiting for the write, errors are reported through the exception
+   * callback. Shutdown and power down are sent before any queued
+   * configuration command, which are sent before the motion command, and
+   * they stop the motion command being repeated until the next move.
+   * 
+   * \param rate_hz Commands sent per second, e.g. 50 or 100, or 0 to send
+   *  each command as it is given (the default).
+   */
+  void
+  setCommandRate(double rate_hz);
+
+  /*!
+   * Returns the send count and jitter of the fixed rate commands. Safe to
+   * call from any thread.
+   */
+  CommandStatistics
+  getCommandStatistics();
+
+  /*!
+   * Copies the latest complete SegwayStatus into status.
+   * 
+   * This never blocks the read thread and takes no lock, so it is safe to
+   * call from a control loop at any rate. It works in every
+   * StatusDeliveryMode.
+   * 
+   * \param status The SegwayStatus to copy into.
+   * \return bool false if no complete status has been received yet.
+   */
+  bool
+  getLatestStatus(SegwayStatus &status);
   
   /*!
    * Sets the Callback Function to be called when a log message occurs.
@@ -621,6 +948,9 @@ public:
    * an empty time struct and manually store your time stamp and use your 
    * timestamp when processing the segway status callback.
    * 
+   * Until this is called, interfaces which timestamp packets in the kernel,
+   * like ethernet, use that time instead, which is also CLOCK_REALTIME.
+   * 
    * The provided function must follow this prototype:
    * <pre>
    *    SegwayTime yourTimestampCallback()
@@ -728,12 +1058,48 @@ public:
   void
   setExceptionCallback(ExceptionCallback callback);
 private:
+  friend class SegwayRMPFleet;
+
   // Disable Copy Constructor
   void operator=(const SegwayRMP &);
   const SegwayRMP & operator=(SegwayRMP);
 
   // Interface implementation (pimpl idiom)
   RMPIO * rmp_io_;
+  // Serializes the writes of the calling threads and the command scheduler
+  boost::mutex write_mutex_;
+  void SendPacket_(Packet &packet);
+  void SendPackets_(Packet *packets, size_t count);
+  // Sends a motion command now, or leaves it for the command scheduler
+  void SendMotion_(Packet &packet);
+  // Send now, or queue for the command scheduler ahead of the motion command
+  void SendSafety_(Packet &packet);
+  void SendConfig_(Packet &packet);
+  void SendConfigs_(Packet *packets, size_t count);
+  // Fixed rate motion commands, only started when the rate is set
+  CommandScheduler * command_scheduler_;
+  double command_rate_hz_;
+  void ReportException_(const std::exception &error);
+
+  // What is known to be in effect on the Segway, for applyConfiguration
+  boost::mutex configuration_mutex_;
+  boost::condition_variable configuration_condition_;
+  // As last reported in 0x0406, -1 until the first one
+  boost::atomic<int> reported_operational_mode_;
+  boost::atomic<int> reported_controller_gain_schedule_;
+  // Threads waiting in applyConfiguration, only then is the read thread
+  // signaling them
+  boost::atomic<int> configuration_waiters_;
+  // The value byte last sent for each scale factor, -1 if none since
+  // connecting, indexed by the configuration command less 0x0A
+  int sent_scale_factors_[5];
+  // Records a sent configuration command so that it can be skipped later
+  void RememberConfiguration_(const Packet &packet);
+  // Called by ParsePacket_ with the contents of each 0x0406
+  void ReportConfiguration_(int operational_mode,
+                            int controller_gain_schedule);
+  // Message decoding of the rmpx440, NULL for the other types
+  X440Protocol * x440_protocol_;
 
   // Configuration Variables
   InterfaceType interface_type_;
@@ -754,24 +1120,169 @@ private:
   // Callbacks
   SegwayStatusCallback status_callback_;
   GetTimeCallback get_time_;
+  bool use_packet_timestamps_;
   LogMsgCallback debug_, info_, error_;
   ExceptionCallback handle_exception_;
-  FiniteConcurrentSharedQueue<SegwayStatus> ss_queue_;
+  // Hands statuses from the read thread to the callback thread
+  SPSCRing<SegwayStatus::Ptr> * ss_queue_;
+  // Recycles the statuses once the callbacks are done with them
+  boost::shared_ptr<StatusPool> status_pool_;
+  // The latest complete status for getLatestStatus
+  SeqLock<SegwayStatus> * latest_status_;
+  StatusDeliveryMode status_delivery_mode_;
+  QueueOverflowPolicy queue_policy_;
+  // Only the read thread updates these, others may read them
+  boost::atomic<unsigned long long> dropped_oldest_count_;
+  boost::atomic<unsigned long long> dropped_newest_count_;
+  boost::atomic<unsigned long long> blocked_count_;
+  boost::atomic<size_t> queue_high_water_mark_;
+  // Queues a complete status according to the QueueOverflowPolicy
+  void EnqueueStatus_();
+  // Calls the status callback for every queued status, on this thread
+  void DeliverQueued_();
+
+  // Batched delivery, only touched by whichever thread delivers statuses
+  SegwayStatusBatchCallback status_batch_callback_;
+  std::vector<SegwayStatus::Ptr> status_batch_;
+  size_t batch_max_count_;
+  boost::chrono::milliseconds batch_max_age_;
+  boost::chrono::steady_clock::time_point batch_started_;
+  // Hands a dequeued status to the status or the batch callback
+  void DeliverStatus_(SegwayStatus::Ptr &ss);
+  // Milliseconds until the batch is due, -1 if it is empty
+  int MillisecondsUntilBatchDue_();
+  void FlushBatch_();
+
+  // Callback execution on a user supplied executor, a posted drain delivers
+  // every queued status, only one is scheduled at a time
+  boost::shared_ptr<CallbackExecutor> callback_executor_;
+  boost::function<void()> drain_task_;
+  boost::atomic<bool> drain_scheduled_;
+  // Drains and subscriber tasks posted but not finished
+  boost::atomic<int> pending_drains_;
+  boost::mutex drain_mutex_;
+  boost::condition_variable drain_condition_;
+  void ScheduleDrain_();
+  void DrainCallbacks_();
+  void WaitForDrains_();
+
+  // Status subscribers, the list is copied on write so the read thread only
+  // takes the lock to pick up a new list
+  struct StatusSubscriber;
+  typedef std::vector<boost::shared_ptr<StatusSubscriber> >
+    StatusSubscriberList;
+  boost::mutex subscribers_mutex_;
+  boost::shared_ptr<const StatusSubscriberList> subscribers_;
+  boost::atomic<unsigned int> subscribers_version_;
+  int next_subscriber_id_;
+  // The read thread's copy of the list
+  boost::shared_ptr<const StatusSubscriberList> read_subscribers_;
+  unsigned int read_subscribers_version_;
+  // Hands the current status to the subscribers which are due, returns
+  // true if any of them got it
+  bool PublishToSubscribers_();
+  void CallSubscriber_(StatusSubscriber &subscriber, SegwayStatus::Ptr &ss);
+  void RunSubscriberTask_(boost::shared_ptr<StatusSubscriber> subscriber,
+                          SegwayStatus::Ptr ss);
 
   // Continuous Read Functions and Variables
+  void ConnectInterface_(bool reset_integrators);
+  // Returns the PacketStatus of the read
+  int ReadPackets_(bool report_no_data);
+  // Reads until nothing is buffered, returns the PacketStatus of the last
+  // read and sets got_packets if anything was read
+  int ReadBuffered_(bool &got_packets);
   void ReadContinuously_();
   void ExecuteCallbacks_();
+  void CallStatusCallback_(SegwayStatus::Ptr &ss);
+  void StartDelivering_();
+  void StopDelivering_();
   void StartReadingContinuously_();
   void StopReadingContinuously_();
   bool continuously_reading_;
+  // Connected with start_threads false, the user calls spinOnce
+  bool spinning_manually_;
   boost::thread read_thread_;
   boost::thread callback_execution_thread_;
 
+  // Sends a normalized motion command to an rmpx440
+  void moveX440_(float linear_velocity, float angular_velocity);
+
   // Parsing Functions and Variables
   void ProcessPacket_(Packet &packet);
   bool ParsePacket_(Packet &packet, SegwayStatus::Ptr &ss_ptr);
 };
 
+/*!
+ * Drives many SegwayRMP's from one event loop instead of a read thread each.
+ * 
+ * The interfaces of every added SegwayRMP are watched with epoll by one, or
+ * a few, threads which frame and parse whatever arrives and deliver the
+ * statuses of each SegwayRMP according to its StatusDeliveryMode. Use
+ * status_inline, status_polling or a CallbackExecutor to keep the thread
+ * count independent of the number of robots, status_callbacks without an
+ * executor still starts a callback thread per SegwayRMP.
+ * 
+ * Only interfaces with a file descriptor can be added (serial on POSIX, can
+ * and ethernet), and only on Linux. SegwayRMP's must stay alive while the
+ * fleet is running.
+ */
+class SegwayRMPFleet {
+public:
+  /*!
+   * Constructs an empty fleet. Throws ConfigurationException where epoll
+   * is not available.
+   * 
+   * \param thread_count The number of event loop threads, SegwayRMP's are
+   *  spread over them evenly.
+   * \param pin_threads If true, each thread is pinned to its own CPU.
+   */
+  SegwayRMPFleet(size_t thread_count = 1, bool pin_threads = false);
+  ~SegwayRMPFleet();
+
+  /*!
+   * Connects a configured SegwayRMP and adds it to the fleet, must be called
+   * while the fleet is stopped. Use this instead of SegwayRMP::connect.
+   * Throws ConfigurationException if the interface has no file descriptor.
+   * 
+   * \param segway_rmp The SegwayRMP to add.
+   * \param reset_integrators If this is true, the integrators are reset.
+   */
+  void
+  add(SegwayRMP &segway_rmp, bool reset_integrators = true);
+
+  /*!
+   * Starts the event loop threads.
+   */
+  void
+  start();
+
+  /*!
+   * Stops the event loop threads, statuses are no longer delivered.
+   */
+  void
+  stop();
+
+  /*!
+   * Returns the number of SegwayRMP's in the fleet.
+   */
+  size_t
+  size() const {return this->segway_rmps_.size();}
+
+private:
+  // Disable Copy Constructor
+  SegwayRMPFleet(const SegwayRMPFleet &);
+  void operator=(const SegwayRMPFleet &);
+
+  struct EventLoop;
+  void Run_(EventLoop *loop);
+
+  std::vector<SegwayRMP *> segway_rmps_;
+  std::vector<EventLoop *> loops_;
+  bool pin_threads_;
+  bool running_;
+};
+
 DEFINE_EXCEPTION(NoHighPerformanceTimersException, "", "This system does not "
   "appear to have a High Precision Event Timer (HPET) device.");
 
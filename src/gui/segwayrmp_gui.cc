@@ -17,7 +17,8 @@ MainWindow::MainWindow(QWidget *parent) :
     interface_type_(segwayrmp::usb),
     rmp_type_(segwayrmp::rmp200),
     joystick_(0),
-    running_(true)
+    running_(true),
+    pending_gain_schedule_(-1)
 {
     // Init UI
     ui->setupUi(this);
@@ -44,6 +45,7 @@ MainWindow::MainWindow(QWidget *parent) :
 
     // Segway Status connection
     connect(this, SIGNAL(segwayStatus(QString)), this, SLOT(handleSegwayStatus(QString)));
+    connect(this, SIGNAL(configApplied()), this, SLOT(handleConfigApplied()));
 
     // Command button connections
     connect(ui->reset_integrators_button, SIGNAL(clicked()), this, SLOT(onResetIntegrators()));
@@ -199,21 +201,45 @@ void MainWindow::onBalanceUnlock() {
 
 void MainWindow::onSendConfig() {
     if (this->connected_ and this->rmp_) {
-        rmp_->setMaxVelocityScaleFactor(ui->max_vel_sb->value());
-        rmp_->setMaxAccelerationScaleFactor(ui->max_accel_sb->value());
-        rmp_->setMaxTurnScaleFactor(ui->max_turn_rate_sb->value());
-        rmp_->setCurrentLimitScaleFactor(ui->current_limit_sb->value());
+        int gain_schedule_sent = -1;
+        segwayrmp::Configuration configuration;
+        configuration.setMaxVelocityScaleFactor(ui->max_vel_sb->value());
+        configuration.setMaxAccelerationScaleFactor(ui->max_accel_sb->value());
+        configuration.setMaxTurnScaleFactor(ui->max_turn_rate_sb->value());
+        configuration.setCurrentLimitScaleFactor(ui->current_limit_sb->value());
         QString gain_schedule = ui->gain_schedule_cb->currentText();
         if (gain_schedule == "Light") {
-            rmp_->setControllerGainSchedule(segwayrmp::light);
+            configuration.setControllerGainSchedule(segwayrmp::light);
+            gain_schedule_sent = segwayrmp::light;
         }
         if (gain_schedule == "Tall") {
-            rmp_->setControllerGainSchedule(segwayrmp::tall);
+            configuration.setControllerGainSchedule(segwayrmp::tall);
+            gain_schedule_sent = segwayrmp::tall;
         }
         if (gain_schedule == "Heavy") {
-            rmp_->setControllerGainSchedule(segwayrmp::heavy);
+            configuration.setControllerGainSchedule(segwayrmp::heavy);
+            gain_schedule_sent = segwayrmp::heavy;
+        }
+        try {
+            // Only what changed is sent, all in one write, without blocking
+            // the UI, onSegwayStatus reports when the Segway has applied it
+            rmp_->applyConfiguration(configuration, 0);
+            this->pending_gain_schedule_.fetchAndStoreOrdered(gain_schedule_sent);
+            ui->statusbar->showMessage("Configurations sent to the Segway RMP", 3000);
+            QTimer::singleShot(1000, this, SLOT(onConfigTimeout()));
+        } catch (const std::exception &e) {
+            ui->statusbar->showMessage(QString("Error applying configurations: %1").arg(e.what()), 5000);
         }
-        ui->statusbar->showMessage("Configurations sent to the Segway RMP", 3000);
+    }
+}
+
+void MainWindow::handleConfigApplied() {
+    ui->statusbar->showMessage("Configurations applied by the Segway RMP", 3000);
+}
+
+void MainWindow::onConfigTimeout() {
+    if (this->pending_gain_schedule_.fetchAndStoreOrdered(-1) >= 0) {
+        ui->statusbar->showMessage("The Segway RMP did not report the new configurations", 5000);
     }
 }
 
@@ -227,6 +253,11 @@ void MainWindow::handleSegwayLog(QString log) {
 }
 
 void MainWindow::onSegwayStatus(segwayrmp::SegwayStatus::Ptr ss) {
+    int pending = this->pending_gain_schedule_;
+    if (pending >= 0 && int(ss->controller_gain_schedule) == pending
+        && this->pending_gain_schedule_.testAndSetOrdered(pending, -1)) {
+        emit configApplied();
+    }
     QString qss = QString::fromStdString(ss->str());
     emit segwayStatus(QString("Time Stamp:\n%1").arg(qss));
 }
@@ -0,0 +1,272 @@
+#include "segwayrmp/impl/command_scheduler.h"
+#include "segwayrmp/impl/counters.h"
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+#if defined(__linux__)
+# include <sys/timerfd.h>
+# include <unistd.h>
+#else
+# include <boost/chrono/ceil.hpp>
+#endif
+
+using namespace segwayrmp;
+
+namespace {
+
+// Single writer like the counters, see increment
+inline void
+updateMaximum(boost::atomic<unsigned long long> &maximum,
+              unsigned long long value)
+{
+  if (value > maximum.load(boost::memory_order_relaxed)) {
+    maximum.store(value, boost::memory_order_relaxed);
+  }
+}
+
+inline unsigned long long
+nanoseconds(boost::chrono::steady_clock::duration duration)
+{
+  return (unsigned long long)boost::chrono::duration_cast<
+    boost::chrono::nanoseconds>(duration).count();
+}
+
+inline std::string
+getErrorMessageByErrno(std::string what)
+{
+  std::stringstream msg;
+  msg << "Error while " << what << ": " << strerror(errno);
+  return msg.str();
+}
+
+} // namespace
+
+/////////////////////////////////////////////////////////////////////////////
+// CommandScheduler
+
+CommandScheduler::CommandScheduler(SendCallback send,
+                                   ExceptionCallback handle_exception)
+: send_(send), handle_exception_(handle_exception), setpoint_id_(0),
+  period_(0), tick_count_(0), timer_fd_(-1), stopping_(false),
+  running_(false), setpoint_(0), has_setpoint_(false), sent_count_(0),
+  missed_tick_count_(0), wakeup_count_(0), jitter_sum_ns_(0),
+  max_jitter_ns_(0), safety_sent_count_(0), config_sent_count_(0),
+  max_safety_latency_ns_(0)
+{}
+
+CommandScheduler::~CommandScheduler() {
+  this->stop();
+}
+
+void CommandScheduler::start(double rate_hz, unsigned short setpoint_id) {
+  if (this->running_) {
+    return;
+  }
+  if (rate_hz <= 0.0) {
+    RMP_THROW_MSG(ConfigurationException, "The command rate must be "
+      "positive.");
+  }
+  this->setpoint_id_ = setpoint_id;
+  this->period_ = boost::chrono::duration_cast<Clock::duration>(
+    boost::chrono::duration<double>(1.0 / rate_hz));
+  this->tick_count_ = 0;
+  this->started_ = Clock::now();
+#if defined(__linux__)
+  this->timer_fd_ = timerfd_create(CLOCK_MONOTONIC,
+                                   TFD_NONBLOCK | TFD_CLOEXEC);
+  if (this->timer_fd_ < 0) {
+    RMP_THROW_MSG(ConfigurationException,
+      getErrorMessageByErrno("creating a timerfd").c_str());
+  }
+  // The steady clock is CLOCK_MONOTONIC, so the ticks land exactly on
+  // started_ + n * period_ and the jitter is measured against those
+  boost::int64_t first = boost::chrono::duration_cast<
+    boost::chrono::nanoseconds>(
+      (this->started_ + this->period_).time_since_epoch()).count();
+  boost::int64_t period = boost::chrono::duration_cast<
+    boost::chrono::nanoseconds>(this->period_).count();
+  struct itimerspec spec;
+  spec.it_value.tv_sec = (time_t)(first / 1000000000);
+  spec.it_value.tv_nsec = (long)(first % 1000000000);
+  spec.it_interval.tv_sec = (time_t)(period / 1000000000);
+  spec.it_interval.tv_nsec = (long)(period % 1000000000);
+  if (timerfd_settime(this->timer_fd_, TFD_TIMER_ABSTIME, &spec, NULL) != 0) {
+    close(this->timer_fd_);
+    this->timer_fd_ = -1;
+    RMP_THROW_MSG(ConfigurationException,
+      getErrorMessageByErrno("arming the timerfd").c_str());
+  }
+#endif
+  this->wake_event_.reset();
+  this->stopping_ = false;
+  this->running_ = true;
+  this->thread_ = boost::thread(&CommandScheduler::Run_, this);
+}
+
+void CommandScheduler::stop() {
+  if (!this->running_) {
+    return;
+  }
+  this->stopping_ = true;
+  this->wake_event_.set();
+  this->thread_.join();
+#if defined(__linux__)
+  close(this->timer_fd_);
+  this->timer_fd_ = -1;
+#endif
+  this->running_ = false;
+}
+
+void CommandScheduler::setSetpoint(const unsigned char *data) {
+  boost::uint64_t setpoint;
+  memcpy(&setpoint, data, sizeof(setpoint));
+  this->setpoint_.store(setpoint, boost::memory_order_relaxed);
+  this->has_setpoint_.store(true, boost::memory_order_release);
+}
+
+void
+CommandScheduler::post(const Packet &packet, TransmitPriority priority)
+{
+  QueuedPacket queued;
+  queued.packet = packet;
+  queued.posted = Clock::now();
+  {
+    boost::lock_guard<boost::mutex> lock(this->queue_mutex_);
+    this->queues_[priority].push_back(queued);
+  }
+  if (priority == transmit_safety) {
+    this->has_setpoint_.store(false, boost::memory_order_release);
+  }
+  this->wake_event_.set();
+}
+
+CommandStatistics CommandScheduler::getStatistics() const {
+  CommandStatistics statistics;
+  statistics.sent = this->sent_count_;
+  statistics.missed_ticks = this->missed_tick_count_;
+  unsigned long long wakeups = this->wakeup_count_;
+  if (wakeups > 0) {
+    statistics.mean_jitter_us =
+      (double)this->jitter_sum_ns_ / (double)wakeups / 1000.0;
+  }
+  statistics.max_jitter_us = (double)this->max_jitter_ns_ / 1000.0;
+  statistics.safety_sent = this->safety_sent_count_;
+  statistics.config_sent = this->config_sent_count_;
+  statistics.max_safety_latency_us =
+    (double)this->max_safety_latency_ns_ / 1000.0;
+  return statistics;
+}
+
+void CommandScheduler::Run_() {
+  while (true) {
+    boost::uint64_t ticks = this->WaitForTick_();
+    this->SendQueued_();
+    if (this->stopping_) {
+      return;
+    }
+    if (ticks > 0) {
+      this->Tick_(ticks);
+    }
+  }
+}
+
+void CommandScheduler::SendQueued_() {
+  while (true) {
+    QueuedPacket queued;
+    int priority = transmit_safety;
+    {
+      boost::lock_guard<boost::mutex> lock(this->queue_mutex_);
+      // Checked again before every send, so safety packets overtake any
+      // configuration packets still queued
+      while (priority <= transmit_config && this->queues_[priority].empty()) {
+        ++priority;
+      }
+      if (priority > transmit_config) {
+        return;
+      }
+      queued = this->queues_[priority].front();
+      this->queues_[priority].pop_front();
+    }
+    try {
+      this->send_(queued.packet);
+      if (priority == transmit_safety) {
+        increment(this->safety_sent_count_);
+        updateMaximum(this->max_safety_latency_ns_,
+              nanoseconds(Clock::now() - queued.posted));
+      } else {
+        increment(this->config_sent_count_);
+      }
+    } catch (std::exception &e) {
+      this->handle_exception_(e);
+    }
+  }
+}
+
+#if defined(__linux__)
+
+boost::uint64_t CommandScheduler::WaitForTick_() {
+  if (waitReadable(this->timer_fd_, this->wake_event_, -1) <= 0) {
+    // Reset before the queues are looked at, a later post sets it again
+    this->wake_event_.reset();
+    return 0;
+  }
+  boost::uint64_t expirations = 0;
+  if (::read(this->timer_fd_, &expirations, sizeof(expirations))
+      != (ssize_t)sizeof(expirations)) {
+    return 0;
+  }
+  return expirations;
+}
+
+#else
+
+boost::uint64_t CommandScheduler::WaitForTick_() {
+  Clock::time_point next = this->started_
+                         + this->period_ * (this->tick_count_ + 1);
+  while (true) {
+    Clock::duration remaining = next - Clock::now();
+    if (remaining <= Clock::duration::zero()) {
+      break;
+    }
+    boost::chrono::milliseconds wait =
+      boost::chrono::ceil<boost::chrono::milliseconds>(remaining);
+    if (this->wake_event_.wait((int)wait.count())) {
+      this->wake_event_.reset();
+      return 0;
+    }
+  }
+  // Ticks which passed while we were late are skipped, as a timerfd would
+  return (Clock::now() - this->started_) / this->period_ - this->tick_count_;
+}
+
+#endif
+
+void CommandScheduler::Tick_(boost::uint64_t ticks) {
+  Clock::time_point now = Clock::now();
+  this->tick_count_ += ticks;
+  Clock::time_point expected = this->started_
+                             + this->period_ * this->tick_count_;
+  unsigned long long jitter = 0;
+  if (now > expected) {
+    jitter = nanoseconds(now - expected);
+  }
+  increment(this->wakeup_count_);
+  increment(this->missed_tick_count_, ticks - 1);
+  increment(this->jitter_sum_ns_, jitter);
+  updateMaximum(this->max_jitter_ns_, jitter);
+  if (!this->has_setpoint_.load(boost::memory_order_acquire)) {
+    return;
+  }
+  Packet packet;
+  packet.id = this->setpoint_id_;
+  boost::uint64_t setpoint = this->setpoint_.load(boost::memory_order_relaxed);
+  memcpy(packet.data, &setpoint, sizeof(setpoint));
+  try {
+    this->send_(packet);
+    increment(this->sent_count_);
+  } catch (std::exception &e) {
+    this->handle_exception_(e);
+  }
+}
@@ -0,0 +1,231 @@
+#include "segwayrmp/segwayrmp.h"
+#include "segwayrmp/impl/rmp_can.h"
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+#include <net/if.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <linux/can/raw.h>
+
+using namespace segwayrmp;
+
+// Milliseconds sendPacket waits for room in the transmit queue
+static const int WRITE_TIMEOUT_MS = 1000;
+// Frames handed to the kernel in one call by sendPackets
+static const size_t SEND_BATCH_SIZE = 16;
+
+inline std::string
+getErrorMessageByErrno(std::string what)
+{
+  std::stringstream msg;
+  msg << "Error while " << what << ": " << strerror(errno);
+  return msg.str();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// CanRMPIO
+
+CanRMPIO::CanRMPIO() : configured(false), interface_name(""), fd(-1) {
+  this->connected = false;
+  memset(this->messages, 0, sizeof(this->messages));
+  for (size_t i = 0; i < batch_size; ++i) {
+    this->iovecs[i].iov_base = &this->frames[i];
+    this->iovecs[i].iov_len = sizeof(struct can_frame);
+    this->messages[i].msg_hdr.msg_iov = &this->iovecs[i];
+    this->messages[i].msg_hdr.msg_iovlen = 1;
+  }
+}
+
+CanRMPIO::~CanRMPIO() {
+  this->disconnect();
+}
+
+void CanRMPIO::configure(std::string interface_name) {
+  this->interface_name = interface_name;
+  this->configured = true;
+}
+
+void CanRMPIO::connect() {
+  if(!this->configured) {
+    RMP_THROW_MSG(ConnectionFailedException, "The CAN interface must be "
+      "configured before connecting.");
+  }
+  unsigned int index = if_nametoindex(this->interface_name.c_str());
+  if (index == 0) {
+    RMP_THROW_MSG(ConnectionFailedException,
+      getErrorMessageByErrno("finding " + this->interface_name).c_str());
+  }
+  this->fd = socket(PF_CAN, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, CAN_RAW);
+  if (this->fd < 0) {
+    RMP_THROW_MSG(ConnectionFailedException,
+      getErrorMessageByErrno("opening a CAN socket").c_str());
+  }
+  // Only wake up for the status messages which are parsed, 0x0400 - 0x0407
+  // and 0x0680, the kernel drops everything else
+  struct can_filter filters[2];
+  filters[0].can_id = 0x0400;
+  filters[0].can_mask = CAN_EFF_FLAG | CAN_RTR_FLAG | 0x07F8;
+  filters[1].can_id = 0x0680;
+  filters[1].can_mask = CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_SFF_MASK;
+  if (setsockopt(this->fd, SOL_CAN_RAW, CAN_RAW_FILTER,
+                 filters, sizeof(filters)) != 0) {
+    close(this->fd);
+    this->fd = -1;
+    RMP_THROW_MSG(ConnectionFailedException,
+      getErrorMessageByErrno("setting the CAN filter").c_str());
+  }
+  struct sockaddr_can address;
+  memset(&address, 0, sizeof(address));
+  address.can_family = AF_CAN;
+  address.can_ifindex = index;
+  if (bind(this->fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+    close(this->fd);
+    this->fd = -1;
+    RMP_THROW_MSG(ConnectionFailedException,
+      getErrorMessageByErrno("binding to " + this->interface_name).c_str());
+  }
+  this->connected = true;
+}
+
+void CanRMPIO::disconnect() {
+  if(this->connected) {
+    if (this->fd >= 0) {
+      close(this->fd);
+      this->fd = -1;
+    }
+    this->connected = false;
+  }
+}
+
+int CanRMPIO::read(unsigned char*, int) {
+  RMP_THROW_MSG(ReadFailedException, "CAN carries packets, not a byte "
+    "stream.");
+}
+
+int CanRMPIO::write(unsigned char*, int) {
+  RMP_THROW_MSG(WriteFailedException, "CAN carries packets, not a byte "
+    "stream.");
+}
+
+PacketStatus
+CanRMPIO::tryGetPackets(Packet *packets, size_t max, size_t &count)
+SEGWAYRMP_NOEXCEPT
+{
+  count = 0;
+  if(!this->connected) {
+    return packet_not_connected;
+  }
+  unsigned int batch = (unsigned int)std::min(max, batch_size);
+  while(!this->canceled) {
+    // Take every frame already queued, up to the batch size, in one call
+    int received = recvmmsg(this->fd, this->messages, batch, MSG_DONTWAIT,
+                            NULL);
+    if (received > 0) {
+      for (int i = 0; i < received; ++i) {
+        const struct can_frame &frame = this->frames[i];
+        Packet &packet = packets[count];
+        packet.id = frame.can_id & CAN_SFF_MASK;
+        // Status messages come from the RMP on what is channel A over usb
+        packet.channel = 0xAA;
+        memset(packet.data, 0, 8);
+        memcpy(packet.data, frame.data, std::min((int)frame.can_dlc, 8));
+        count += 1;
+      }
+      increment(this->packet_count, count);
+      return packet_ok;
+    }
+    if (received < 0 && errno != EAGAIN && errno != EINTR) {
+      return this->readFailed("receiving");
+    }
+    int result = waitReadable(this->fd, this->cancel_event,
+                              this->read_timeout_ms);
+    if (result == 0) {
+      if (this->read_timeout_ms != 0) {
+        increment(this->timeout_count);
+      }
+      return packet_no_data;
+    }
+    if (result < 0 && !this->canceled) {
+      return this->readFailed("waiting for frames");
+    }
+  }
+  return packet_canceled;
+}
+
+PacketStatus CanRMPIO::readFailed(const char *what) {
+  std::string message = getErrorMessageByErrno(what);
+  strncpy(this->read_error, message.c_str(), sizeof(this->read_error) - 1);
+  this->read_error[sizeof(this->read_error) - 1] = '\0';
+  increment(this->read_failure_count);
+  return packet_read_failed;
+}
+
+void CanRMPIO::sendPacket(Packet &packet) {
+  struct can_frame frame;
+  memset(&frame, 0, sizeof(frame));
+  frame.can_id = packet.id & CAN_SFF_MASK;
+  frame.can_dlc = 8;
+  memcpy(frame.data, packet.data, 8);
+  while (::write(this->fd, &frame, sizeof(frame)) != sizeof(frame)) {
+    if (errno == EINTR) {
+      continue;
+    }
+    // The transmit queue is full, wait for room
+    if (errno != EAGAIN && errno != ENOBUFS) {
+      RMP_THROW_MSG(WriteFailedException,
+        getErrorMessageByErrno("sending a frame").c_str());
+    }
+    this->waitWritable();
+  }
+}
+
+void CanRMPIO::sendPackets(Packet *packets, size_t count) {
+  struct can_frame frames[SEND_BATCH_SIZE];
+  struct iovec iovecs[SEND_BATCH_SIZE];
+  struct mmsghdr messages[SEND_BATCH_SIZE];
+  memset(frames, 0, sizeof(frames));
+  memset(messages, 0, sizeof(messages));
+  for (size_t i = 0; i < SEND_BATCH_SIZE; ++i) {
+    iovecs[i].iov_base = &frames[i];
+    iovecs[i].iov_len = sizeof(struct can_frame);
+    messages[i].msg_hdr.msg_iov = &iovecs[i];
+    messages[i].msg_hdr.msg_iovlen = 1;
+  }
+  size_t sent = 0;
+  while (sent < count) {
+    size_t batch = std::min(count - sent, SEND_BATCH_SIZE);
+    for (size_t i = 0; i < batch; ++i) {
+      frames[i].can_id = packets[sent + i].id & CAN_SFF_MASK;
+      frames[i].can_dlc = 8;
+      memcpy(frames[i].data, packets[sent + i].data, 8);
+    }
+    int result = sendmmsg(this->fd, messages, (unsigned int)batch, 0);
+    if (result > 0) {
+      // What didn't fit in the transmit queue goes in the next call
+      sent += (size_t)result;
+      continue;
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    if (errno != EAGAIN && errno != ENOBUFS) {
+      RMP_THROW_MSG(WriteFailedException,
+        getErrorMessageByErrno("sending frames").c_str());
+    }
+    this->waitWritable();
+  }
+}
+
+void CanRMPIO::waitWritable() {
+  struct pollfd pfd;
+  pfd.fd = this->fd;
+  pfd.events = POLLOUT;
+  pfd.revents = 0;
+  if (poll(&pfd, 1, WRITE_TIMEOUT_MS) <= 0) {
+    RMP_THROW_MSG(WriteFailedException, "Timed out sending a frame.");
+  }
+}
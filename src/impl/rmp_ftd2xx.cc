@@ -4,10 +4,18 @@
 #include <iostream>
 #include <sstream>
 
+#if !defined(_WIN32)
+# include <cerrno>
+# include <sys/time.h>
+#endif
+
 using namespace segwayrmp;
 
 static const bool ftd2xx_devices_debug = false;
 
+// Milliseconds a read waits for data before giving up
+static const long READ_TIMEOUT_MS = 1000;
+
 inline std::string
 getErrorMessageByFT_STATUS(FT_STATUS result, std::string what)
 {
@@ -150,10 +158,23 @@ FTD2XXRMPIO::FTD2XXRMPIO()
   this->port_index = 0;
   this->connected = false;
   this->usb_port_handle = NULL;
+#if defined(_WIN32)
+  this->rx_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+#else
+  pthread_mutex_init(&this->rx_event.eMutex, NULL);
+  pthread_cond_init(&this->rx_event.eCondVar, NULL);
+  this->rx_event.iVar = 0;
+#endif
 }
 
 FTD2XXRMPIO::~FTD2XXRMPIO() {
   this->disconnect();
+#if defined(_WIN32)
+  CloseHandle(this->rx_event);
+#else
+  pthread_cond_destroy(&this->rx_event.eCondVar);
+  pthread_mutex_destroy(&this->rx_event.eMutex);
+#endif
 }
 
 void FTD2XXRMPIO::connect() {
@@ -199,8 +220,8 @@ void FTD2XXRMPIO::connect() {
   
   // Set default timeouts
   try {
-    // 1 sec read and 1 sec write
-    result = FT_SetTimeouts(this->usb_port_handle, 1000, 1000);
+    // 1 sec read and 1 sec write, reads only take what is already queued
+    result = FT_SetTimeouts(this->usb_port_handle, READ_TIMEOUT_MS, 1000);
   } catch(std::exception &e) {
     RMP_THROW_MSG(ConnectionFailedException, e.what());
   }
@@ -209,6 +230,18 @@ void FTD2XXRMPIO::connect() {
       getErrorMessageByFT_STATUS(result, "setting timeouts").c_str());
   }
   
+  // Have the driver signal rx_event when bytes arrive
+  try {
+    result = FT_SetEventNotification(this->usb_port_handle, FT_EVENT_RXCHAR,
+                                     (PVOID)&this->rx_event);
+  } catch(std::exception &e) {
+    RMP_THROW_MSG(ConnectionFailedException, e.what());
+  }
+  if (result != FT_OK) {
+    RMP_THROW_MSG(ConnectionFailedException,
+      getErrorMessageByFT_STATUS(result, "setting event notification").c_str());
+  }
+  
   // Set Latency Timer
   try {
     result = FT_SetLatencyTimer(this->usb_port_handle, 1);
@@ -258,8 +291,15 @@ int FTD2XXRMPIO::read(unsigned char* buffer, int size) {
   FT_STATUS result;
   DWORD bytes_read;
   
+  // Wait for data instead of blocking in FT_Read, so cancel() can wake us
+  DWORD bytes_available = this->waitForData_();
+  if (bytes_available == 0) {
+    return 0;
+  }
+  
   try {
-    result = FT_Read(this->usb_port_handle, buffer, size, &bytes_read);
+    result = FT_Read(this->usb_port_handle, buffer,
+                     std::min((DWORD)size, bytes_available), &bytes_read);
   } catch(std::exception &e) {
     RMP_THROW_MSG(ReadFailedException, e.what());
   }
@@ -288,6 +328,65 @@ int FTD2XXRMPIO::write(unsigned char* buffer, int size) {
   return bytes_written;
 }
 
+void FTD2XXRMPIO::cancel() {
+  RMPIO::cancel();
+#if defined(_WIN32)
+  SetEvent(this->rx_event);
+#else
+  pthread_mutex_lock(&this->rx_event.eMutex);
+  pthread_cond_broadcast(&this->rx_event.eCondVar);
+  pthread_mutex_unlock(&this->rx_event.eMutex);
+#endif
+}
+
+DWORD FTD2XXRMPIO::waitForData_() {
+  FT_STATUS result = FT_OK;
+  DWORD bytes_available = 0;
+#if defined(_WIN32)
+  DWORD start = GetTickCount();
+  while (!this->canceled) {
+    result = FT_GetQueueStatus(this->usb_port_handle, &bytes_available);
+    if (result != FT_OK || bytes_available > 0) {
+      break;
+    }
+    DWORD waited = GetTickCount() - start;
+    if (waited >= (DWORD)READ_TIMEOUT_MS) {
+      break;
+    }
+    WaitForSingleObject(this->rx_event, READ_TIMEOUT_MS - waited);
+  }
+#else
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  struct timespec deadline;
+  deadline.tv_sec = now.tv_sec + READ_TIMEOUT_MS / 1000;
+  deadline.tv_nsec = now.tv_usec * 1000 + (READ_TIMEOUT_MS % 1000) * 1000000;
+  if (deadline.tv_nsec >= 1000000000) {
+    deadline.tv_sec += 1;
+    deadline.tv_nsec -= 1000000000;
+  }
+  // The queue is checked under the lock so no notification is missed
+  pthread_mutex_lock(&this->rx_event.eMutex);
+  while (!this->canceled) {
+    result = FT_GetQueueStatus(this->usb_port_handle, &bytes_available);
+    if (result != FT_OK || bytes_available > 0) {
+      break;
+    }
+    if (pthread_cond_timedwait(&this->rx_event.eCondVar,
+                               &this->rx_event.eMutex,
+                               &deadline) == ETIMEDOUT) {
+      break;
+    }
+  }
+  pthread_mutex_unlock(&this->rx_event.eMutex);
+#endif
+  if (result != FT_OK) {
+    RMP_THROW_MSG(ReadFailedException,
+      getErrorMessageByFT_STATUS(result, "getting the queue status").c_str());
+  }
+  return bytes_available;
+}
+
 std::vector<FT_DEVICE_LIST_INFO_NODE> FTD2XXRMPIO::enumerateUSBDevices_() {
   return enumerateUSBDevices();
 }
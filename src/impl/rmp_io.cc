@@ -1,6 +1,13 @@
 #include "segwayrmp/segwayrmp.h"
 #include "segwayrmp/impl/rmp_io.h"
 
+#if defined(__AVX2__)
+# include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+# define SEGWAYRMP_USE_SSE2
+# include <emmintrin.h>
+#endif
+
 inline void printHex(char * data, int length) {
   for(int i = 0; i < length; ++i) {
     printf("0x%.2X ", (unsigned)(unsigned char)data[i]);
@@ -10,145 +17,339 @@ inline void printHex(char * data, int length) {
 
 using namespace segwayrmp;
 
-static unsigned int BUFFER_SIZE = 256;
+// Packets encoded into each write by sendPackets
+static const size_t SEND_BATCH_SIZE = 16;
+
+// The bytes of a usb packet before the data, the channel and id are filled
+// in per packet
+static const unsigned char USB_HEADER[9] = {0xF0, 0x55, 0x00, 0x00, 0x00,
+                                            0x00, 0x00, 0x00, 0x00};
+// The checksum of the bytes which never change, summed at compile time
+static const unsigned int USB_HEADER_SUM = 0xF0 + 0x55;
+
+// A move command is a 0x0413 on channel 0 with only the linear and angular
+// counts in data[0..3], it is most of what is sent, so its whole frame is
+// kept with everything but the counts already in place
+static const unsigned char USB_MOVE_TEMPLATE[18] = {0xF0, 0x55, 0x00, 0x00,
+                                                    0x00, 0x00, 0x04, 0x13,
+                                                    0x00, 0x00, 0x00, 0x00,
+                                                    0x00, 0x00, 0x00, 0x00,
+                                                    0x00, 0x00};
+static const unsigned int USB_MOVE_TEMPLATE_SUM = USB_HEADER_SUM + 0x04
+                                                + 0x13;
+
+// Folds a sum of packet bytes into the usb packet checksum
+static inline unsigned char foldChecksum(unsigned int checksum) {
+  checksum = (checksum & 0xff) + (checksum >> 8);
+  checksum = (checksum & 0xff) + (checksum >> 8);
+  return (unsigned char)((~checksum + 1) & 0xff);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Packet header search
+
+static inline bool isChannel(unsigned char byte) {
+  return byte == 0xAA || byte == 0xBB;
+}
+
+#if defined(__AVX2__) || defined(SEGWAYRMP_USE_SSE2)
+static inline size_t lowestSetBit(unsigned int mask) {
+# if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return index;
+# else
+  return __builtin_ctz(mask);
+# endif
+}
+#endif
+
+// Checks every offset from start one at a time, including the partial
+// headers at the very end of data.
+static size_t
+findPacketHeaderScalar(const unsigned char *data, size_t length, size_t start)
+{
+  const unsigned char *end = data + length;
+  const unsigned char *p = data + start;
+  while(p < end) {
+    // Jump to the next possible start of a packet
+    p = (const unsigned char *)memchr(p, 0xF0, end - p);
+    if(p == NULL)
+      return length;
+    if(p + 1 == end || (p[1] == 0x55 && (p + 2 == end || isChannel(p[2]))))
+      return p - data;
+    p += 1;
+  }
+  return length;
+}
+
+size_t segwayrmp::findPacketHeader(const unsigned char *data, size_t length) {
+  size_t i = 0;
+#if defined(__AVX2__)
+  const __m256i f0 = _mm256_set1_epi8((char)0xF0);
+  const __m256i x55 = _mm256_set1_epi8((char)0x55);
+  const __m256i aa = _mm256_set1_epi8((char)0xAA);
+  const __m256i bb = _mm256_set1_epi8((char)0xBB);
+  // Compare 32 candidate offsets at a time, each against all three bytes
+  for(; i + 34 <= length; i += 32) {
+    __m256i first = _mm256_loadu_si256((const __m256i *)(data + i));
+    __m256i second = _mm256_loadu_si256((const __m256i *)(data + i + 1));
+    __m256i third = _mm256_loadu_si256((const __m256i *)(data + i + 2));
+    __m256i match = _mm256_and_si256(
+      _mm256_and_si256(_mm256_cmpeq_epi8(first, f0),
+                       _mm256_cmpeq_epi8(second, x55)),
+      _mm256_or_si256(_mm256_cmpeq_epi8(third, aa),
+                      _mm256_cmpeq_epi8(third, bb)));
+    unsigned int mask = (unsigned int)_mm256_movemask_epi8(match);
+    if(mask != 0)
+      return i + lowestSetBit(mask);
+  }
+#elif defined(SEGWAYRMP_USE_SSE2)
+  const __m128i f0 = _mm_set1_epi8((char)0xF0);
+  const __m128i x55 = _mm_set1_epi8((char)0x55);
+  const __m128i aa = _mm_set1_epi8((char)0xAA);
+  const __m128i bb = _mm_set1_epi8((char)0xBB);
+  // Compare 16 candidate offsets at a time, each against all three bytes
+  for(; i + 18 <= length; i += 16) {
+    __m128i first = _mm_loadu_si128((const __m128i *)(data + i));
+    __m128i second = _mm_loadu_si128((const __m128i *)(data + i + 1));
+    __m128i third = _mm_loadu_si128((const __m128i *)(data + i + 2));
+    __m128i match = _mm_and_si128(
+      _mm_and_si128(_mm_cmpeq_epi8(first, f0), _mm_cmpeq_epi8(second, x55)),
+      _mm_or_si128(_mm_cmpeq_epi8(third, aa), _mm_cmpeq_epi8(third, bb)));
+    unsigned int mask = (unsigned int)_mm_movemask_epi8(match);
+    if(mask != 0)
+      return i + lowestSetBit(mask);
+  }
+#endif
+  // Finish off the tail, or everything without SIMD
+  return findPacketHeaderScalar(data, length, i);
+}
 
 /////////////////////////////////////////////////////////////////////////////
 // RMPIO
 
 void RMPIO::getPacket(Packet &packet) {
+  this->getPackets(&packet, 1);
+}
+
+size_t RMPIO::getPackets(Packet *packets, size_t max) {
+  size_t count = 0;
+  switch(this->tryGetPackets(packets, max, count)) {
+    case packet_ok:
+      break;
+    case packet_not_connected:
+      RMP_THROW_MSG_AND_ID(PacketRetrievalException, "Not connected.", 1);
+    case packet_checksum_mismatch:
+      RMP_THROW_MSG_AND_ID(PacketRetrievalException, "Checksum mismatch.", 2);
+    case packet_no_data:
+      RMP_THROW_MSG_AND_ID(PacketRetrievalException, "No data received "
+        "from Segway.", 3);
+    case packet_canceled:
+      RMP_THROW_MSG_AND_ID(PacketRetrievalException, "Canceled.", 4);
+    case packet_read_failed:
+    default:
+      RMP_THROW_MSG(ReadFailedException, this->read_error);
+  }
+  return count;
+}
+
+PacketStatus
+RMPIO::tryGetPackets(Packet *packets, size_t max, size_t &count)
+SEGWAYRMP_NOEXCEPT
+{
+  count = 0;
   if(!this->connected)
-    RMP_THROW_MSG_AND_ID(PacketRetrievalException, "Not connected.", 1);
+    return packet_not_connected;
   
   unsigned char usb_packet[18];
-  bool packet_complete = false;
-  int packet_index = 0;
   
-  while(!packet_complete && !this->canceled) {
-    // Top the buffer off
-    size_t prev_size = this->data_buffer.size();
-    if(prev_size < 18) {
-      this->fillBuffer();
-      // Ensure that data was read into the buffer
-      if(prev_size == this->data_buffer.size()) {
-        RMP_THROW_MSG_AND_ID(PacketRetrievalException, "No data received "
-          "from Segway.", 3);
+  while(!this->canceled) {
+    // Take every whole packet out of the buffer
+    while(count < max) {
+      // Discard anything in front of the next 0xF0 0x55 and channel A or B
+      size_t skipped = this->skipToPacketHeader();
+      increment(this->skipped_byte_count, skipped);
+      // Track whether this header is inside a packet which failed its checksum
+      bool rescanning = skipped < this->rescan_remaining;
+      this->rescan_remaining =
+        rescanning ? this->rescan_remaining - skipped : 0;
+      
+      // If a whole packet is still buffered it starts with a header
+      // (we assume that if these three bytes were recieved then this is a
+      //  valid packet, if it isn't the checksum will fail)
+      if(this->data_buffer.size() < 18)
+        break;
+      this->data_buffer.copy(usb_packet, 18);
+      
+      // Check the Checksum
+      if(usb_packet[17] != this->computeChecksum(usb_packet)) {
+        // Return the good packets first, the next call reports the mismatch
+        if(count > 0)
+          break;
+        // Only drop the 0xF0, a real packet may start within the other bytes
+        this->data_buffer.consume(1);
+        this->rescan_remaining = 17;
+        increment(this->checksum_mismatch_count);
+        return packet_checksum_mismatch;
+      }
+      this->data_buffer.consume(18);
+      this->rescan_remaining = 0;
+      if(rescanning)
+        increment(this->recovered_packet_count);
+      
+      // Convert to the packet type
+      Packet &packet = packets[count++];
+      packet.channel = usb_packet[2];
+      packet.id = ((usb_packet[4] << 3) | ((usb_packet[5] >> 5) & 7)) & 0x0fff;
+      for (int i = 0; i < 8; i++)  {
+        packet.data[i] = usb_packet[i + 9];
       }
     }
     
-    // If looking for start of packet and start of packet
-    if(packet_index == 0 && this->data_buffer[0] == 0xF0) {
-      // Put the 0xF0 in the packet
-      usb_packet[packet_index] = this->data_buffer[0];
-      // Remove the 0xF0 from the buffer
-      this->data_buffer.erase(this->data_buffer.begin());
-      // Look for next packet byte
-      packet_index += 1;
-    } else if(packet_index == 0) { // If we were looking for the first byte, but didn't find it
-      // Remove the invalid byte from the buffer
-      this->data_buffer.erase(this->data_buffer.begin());
-    }
-    
-    // If looking for second byte of packet and second byte of packet
-    if(packet_index == 1 && this->data_buffer[0] == 0x55) {
-      // Put the 0x55 in the packet
-      usb_packet[packet_index] = this->data_buffer[0];
-      // Remove the 0x55 from the buffer
-      this->data_buffer.erase(this->data_buffer.begin());
-      // Look for next packet byte
-      packet_index += 1;
-    } else if(packet_index == 1) { // Else were looking for second byte but didn't find it
-      // Reset the packet index to start search for packet over
-      packet_index = 0;
-    }
-    
-    // If looking for channel byte and channel A or B
-    if(packet_index == 2 && (this->data_buffer[0] == 0xAA || this->data_buffer[0] == 0xBB)) {
-      // Put the channel in the packet
-      usb_packet[packet_index] = this->data_buffer[0];
-      // Remove the channel from the buffer
-      this->data_buffer.erase(this->data_buffer.begin());
-      // Look for next packet byte
-      packet_index += 1;
-    } else if(packet_index == 2) { // Else were looking for channel byte but didn't find it
-      // Reset the packet index to start search for packet over
-      packet_index = 0;
-    }
-    
-    // If packet_index >= 3 then we just need to collect the rest of the bytes
-    // (we assume that if the previous three bytes were recieved then this is a valid packet, 
-    //  if it isn't the checksum will fail)
-    if(packet_index >= 3) {
-      // Put the next btye in the packet
-      usb_packet[packet_index] = this->data_buffer[0];
-      // Remove the byte from the buffer
-      this->data_buffer.erase(this->data_buffer.begin());
-      // Look for next packet byte
-      packet_index += 1;
+    if(count > 0) {
+      increment(this->packet_count, count);
+      return packet_ok;
     }
     
-    // If packet_index is 18 then we have a full packet
-    if(packet_index == 18)
-      packet_complete = true;
+    // Nothing buffered, top the buffer off
+    PacketStatus status = this->fillBuffer();
+    if(status != packet_ok)
+      return status;
   }
   
-  // Check the Checksum
-  if(usb_packet[17] != this->computeChecksum(usb_packet)) {
-    RMP_THROW_MSG_AND_ID(PacketRetrievalException, "Checksum mismatch.", 2);
-  }
+  return packet_canceled;
+}
+
+PacketStatistics RMPIO::getStatistics() {
+  PacketStatistics statistics;
+  statistics.packets = this->packet_count.load(boost::memory_order_relaxed);
+  statistics.checksum_mismatches =
+    this->checksum_mismatch_count.load(boost::memory_order_relaxed);
+  statistics.timeouts = this->timeout_count.load(boost::memory_order_relaxed);
+  statistics.read_failures =
+    this->read_failure_count.load(boost::memory_order_relaxed);
+  statistics.skipped_bytes =
+    this->skipped_byte_count.load(boost::memory_order_relaxed);
+  statistics.recovered_packets =
+    this->recovered_packet_count.load(boost::memory_order_relaxed);
+  return statistics;
+}
+
+void RMPIO::sendPacket(Packet &packet) {
+  unsigned char usb_packet[18];
+  this->encodePacket(packet, usb_packet);
   
-  // Convert to the packet type
-  packet.channel = usb_packet[2];
-  packet.id = ((usb_packet[4] << 3) | ((usb_packet[5] >> 5) & 7)) & 0x0fff;
-  for (int i = 0; i < 8; i++)  {
-    packet.data[i] = usb_packet[i + 9];
+  // Write the data
+  this->write(usb_packet, 18);
+}
+
+void RMPIO::sendPackets(Packet *packets, size_t count) {
+  unsigned char usb_packets[SEND_BATCH_SIZE * 18];
+  for (size_t sent = 0; sent < count; ) {
+    size_t batch = std::min(count - sent, SEND_BATCH_SIZE);
+    for (size_t i = 0; i < batch; ++i) {
+      this->encodePacket(packets[sent + i], usb_packets + i * 18);
+    }
+    this->write(usb_packets, (int)(batch * 18));
+    sent += batch;
   }
-  
-  return;
 }
 
-void RMPIO::sendPacket(Packet &packet) {
-  unsigned char usb_packet[18] = {0xF0, 0x55, 0x00, 0x00, 0x00, 0x00, 0x04,
-                                  0x13, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-                                  0x00, 0x00, 0x00, 0x00};
+void RMPIO::encodePacket(const Packet &packet, unsigned char *usb_packet) {
+  uint32_t configuration;
+  memcpy(&configuration, packet.data + 4, sizeof(configuration));
+  if (packet.id == 0x0413 && packet.channel == 0x00 && configuration == 0) {
+    // A move, only the four count bytes are stored and summed
+    memcpy(usb_packet, USB_MOVE_TEMPLATE, sizeof(USB_MOVE_TEMPLATE));
+    memcpy(usb_packet + 9, packet.data, 4);
+    usb_packet[17] = foldChecksum(USB_MOVE_TEMPLATE_SUM + packet.data[0]
+                                  + packet.data[1] + packet.data[2]
+                                  + packet.data[3]);
+    return;
+  }
+  memcpy(usb_packet, USB_HEADER, sizeof(USB_HEADER));
   // Set the id
-  usb_packet[6] = (packet.id & 0xFF00) >> 8;
-  usb_packet[7] = packet.id & 0x00FF;
+  unsigned char id_high = (unsigned char)((packet.id & 0xFF00) >> 8);
+  unsigned char id_low = (unsigned char)(packet.id & 0x00FF);
+  usb_packet[6] = id_high;
+  usb_packet[7] = id_low;
   // Set the desitnation channel, 0x01 for 0xAA and 0x02 for 0xBB
   usb_packet[2] = packet.channel;
   // Copy movement and configuration commands
+  memcpy(usb_packet + 9, packet.data, 8);
+  // Only the bytes which vary are summed, the header's sum is a constant
+  unsigned int checksum = USB_HEADER_SUM + packet.channel + id_high + id_low;
   for(int i = 0; i < 8; ++i) {
-    usb_packet[9+i] = packet.data[i];
+    checksum += packet.data[i];
   }
-  // Compute and set the checksum
-  usb_packet[17] = this->computeChecksum(usb_packet);
-  
-  // Write the data
-  this->write(usb_packet, 18);
+  usb_packet[17] = foldChecksum(checksum);
+}
+
+PacketStatus RMPIO::fillBuffer() SEGWAYRMP_NOEXCEPT {
+  // Read directly into the free space at the end of the buffer
+  unsigned char *region;
+  size_t free_space = this->data_buffer.writeRegion(region);
+  int bytes_read = 0;
+  try {
+    bytes_read = this->read(region, free_space);
+  } catch(std::exception &e) {
+    strncpy(this->read_error, e.what(), sizeof(this->read_error) - 1);
+    this->read_error[sizeof(this->read_error) - 1] = '\0';
+    increment(this->read_failure_count);
+    return packet_read_failed;
+  } catch(...) {
+    strcpy(this->read_error, "Unknown error.");
+    increment(this->read_failure_count);
+    return packet_read_failed;
+  }
+  // Ensure that data was read into the buffer
+  if(bytes_read <= 0) {
+    // The read was interrupted by cancel()
+    if(this->canceled)
+      return packet_canceled;
+    // Nothing waiting is not a timeout when the read was not to wait
+    if(this->read_timeout_ms != 0)
+      increment(this->timeout_count);
+    return packet_no_data;
+  }
+  this->data_buffer.commit(bytes_read);
+  return packet_ok;
 }
 
-void RMPIO::fillBuffer() {
-  unsigned char buffer[BUFFER_SIZE];
-  // Read up to BUFFER_SIZE what ever is needed to fill the vector
-  // to BUFFER_SIZE
-  int bytes_read = this->read(buffer, BUFFER_SIZE-this->data_buffer.size());
-  // Append the buffered data to the vector
-  this->data_buffer.insert(this->data_buffer.end(), buffer, buffer+bytes_read);
+size_t RMPIO::skipToPacketHeader() {
+  size_t skipped = 0;
+  while(this->data_buffer.size() >= 3) {
+    // Search the contiguous bytes at the head of the buffer
+    const unsigned char *region;
+    size_t length = this->data_buffer.readRegion(region);
+    size_t offset = findPacketHeader(region, length);
+    this->data_buffer.consume(offset);
+    skipped += offset;
+    // A whole header was found
+    if(offset + 3 <= length)
+      break;
+    // Nothing in the region, keep going in case the buffer wraps around
+    if(offset == length)
+      continue;
+    // Else a header may straddle the end of the region or of the data
+    if(this->data_buffer.size() < 3)
+      break;
+    if(this->data_buffer[0] == 0xF0 && this->data_buffer[1] == 0x55 &&
+       isChannel(this->data_buffer[2]))
+      break;
+    this->data_buffer.consume(1);
+    skipped += 1;
+  }
+  return skipped;
 }
 
 unsigned char RMPIO::computeChecksum(unsigned char* usb_packet) {
-  unsigned short checksum = 0;
-  unsigned short checksum_hi = 0;
+  unsigned int checksum = 0;
   
   for(int i = 0; i < 17; i++) {
-    checksum += (short)usb_packet[i];
+    checksum += usb_packet[i];
   }
   
-  checksum_hi = (unsigned short)(checksum >> 8);
-  checksum &= 0xff;
-  checksum += checksum_hi;
-  checksum_hi = (unsigned short)(checksum >> 8);
-  checksum &= 0xff;
-  checksum += checksum_hi;
-  checksum = (~checksum + 1) & 0xff;
-  return (unsigned char)checksum;
+  return foldChecksum(checksum);
 }
@@ -3,6 +3,11 @@
 
 using namespace segwayrmp;
 
+// Milliseconds a read waits for data before giving up
+static const int READ_TIMEOUT_MS = 1000;
+// Milliseconds a read blocks at a time between checks for cancel()
+static const int READ_SLICE_MS = 20;
+
 /////////////////////////////////////////////////////////////////////////////
 // SerialRMPIO
 
@@ -29,7 +34,7 @@ void SerialRMPIO::connect() {
       // Configure and open the serial port
       this->serial_port.setPort(this->port);
       this->serial_port.setBaudrate(this->baudrate);
-      serial::Timeout timeout = serial::Timeout::simpleTimeout(1000);
+      serial::Timeout timeout = serial::Timeout::simpleTimeout(READ_SLICE_MS);
       this->serial_port.setTimeout(timeout);
       this->serial_port.open();
   } catch(std::exception &e) {
@@ -47,7 +52,22 @@ void SerialRMPIO::disconnect() {
 }
 
 int SerialRMPIO::read(unsigned char* buffer, int size) {
-  return this->serial_port.read(buffer, size);
+  // The serial library doesn't expose its descriptor to poll on, so wait in
+  // short slices and check for cancel() in between
+  for (int waited = 0; waited < READ_TIMEOUT_MS && !this->canceled;
+       waited += READ_SLICE_MS) {
+    // Block for the first byte, then take whatever else has arrived
+    int bytes_read = this->serial_port.read(buffer, 1);
+    if (bytes_read > 0) {
+      size_t available = std::min((size_t)(size - 1),
+                                  this->serial_port.available());
+      if (available > 0) {
+        bytes_read += this->serial_port.read(buffer + 1, available);
+      }
+      return bytes_read;
+    }
+  }
+  return 0;
 }
 
 int SerialRMPIO::write(unsigned char* buffer, int size) {
@@ -0,0 +1,223 @@
+#include "segwayrmp/segwayrmp.h"
+#include "segwayrmp/impl/rmp_termios.h"
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+#if defined(__linux__)
+# include <linux/serial.h>
+#endif
+
+using namespace segwayrmp;
+
+// Milliseconds a write waits on the port before giving up
+static const int WRITE_TIMEOUT_MS = 1000;
+// Reads wake once this many bytes, one usb packet, have arrived
+static const int FRAME_SIZE = 18;
+
+inline std::string
+getErrorMessageByErrno(std::string what)
+{
+  std::stringstream msg;
+  msg << "Error while " << what << ": " << strerror(errno);
+  return msg.str();
+}
+
+static speed_t
+baudrateToSpeed(int baudrate)
+{
+  switch (baudrate) {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+#if defined(B460800)
+    case 460800: return B460800;
+#endif
+#if defined(B500000)
+    case 500000: return B500000;
+#endif
+#if defined(B576000)
+    case 576000: return B576000;
+#endif
+#if defined(B921600)
+    case 921600: return B921600;
+#endif
+#if defined(B1000000)
+    case 1000000: return B1000000;
+#endif
+    default: return B0;
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// TermiosRMPIO
+
+TermiosRMPIO::TermiosRMPIO()
+: configured(false), port(""), baudrate(460800), low_latency(true),
+  low_latency_enabled(false), fd(-1)
+{
+  this->connected = false;
+}
+
+TermiosRMPIO::~TermiosRMPIO() {
+  this->disconnect();
+}
+
+void
+TermiosRMPIO::configure(std::string port, int baudrate, bool low_latency)
+{
+  this->port = port;
+  this->baudrate = baudrate;
+  this->low_latency = low_latency;
+  this->configured = true;
+}
+
+void TermiosRMPIO::connect() {
+  if(!this->configured) {
+    RMP_THROW_MSG(ConnectionFailedException, "The serial port must be "
+      "configured before connecting.");
+  }
+  if (baudrateToSpeed(this->baudrate) == B0) {
+    std::stringstream msg;
+    msg << "Unsupported baudrate: " << this->baudrate;
+    RMP_THROW_MSG(ConnectionFailedException, msg.str().c_str());
+  }
+  this->fd = open(this->port.c_str(),
+                  O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if (this->fd < 0) {
+    RMP_THROW_MSG(ConnectionFailedException,
+      getErrorMessageByErrno("opening " + this->port).c_str());
+  }
+  try {
+    this->configurePort();
+  } catch(std::exception &e) {
+    close(this->fd);
+    this->fd = -1;
+    throw;
+  }
+  this->connected = true;
+}
+
+void TermiosRMPIO::configurePort() {
+  // Keep other processes from opening the port while we have it
+  if (ioctl(this->fd, TIOCEXCL) != 0) {
+    RMP_THROW_MSG(ConnectionFailedException,
+      getErrorMessageByErrno("locking the port").c_str());
+  }
+  struct termios options;
+  if (tcgetattr(this->fd, &options) != 0) {
+    RMP_THROW_MSG(ConnectionFailedException,
+      getErrorMessageByErrno("getting the port attributes").c_str());
+  }
+  cfmakeraw(&options);
+  // 8N1, no flow control, ignore the modem control lines
+  options.c_cflag |= (CLOCAL | CREAD);
+  options.c_cflag &= ~(CSTOPB | PARENB);
+#if defined(CRTSCTS)
+  options.c_cflag &= ~CRTSCTS;
+#endif
+  options.c_iflag &= ~(IXON | IXOFF | IXANY);
+  // Wake poll() only once a whole packet is waiting, VTIME must be 0 for
+  // VMIN to be honored by poll()
+  options.c_cc[VMIN] = FRAME_SIZE;
+  options.c_cc[VTIME] = 0;
+  speed_t speed = baudrateToSpeed(this->baudrate);
+  cfsetispeed(&options, speed);
+  cfsetospeed(&options, speed);
+  if (tcsetattr(this->fd, TCSANOW, &options) != 0) {
+    RMP_THROW_MSG(ConnectionFailedException,
+      getErrorMessageByErrno("setting the port attributes").c_str());
+  }
+  this->low_latency_enabled = false;
+#if defined(__linux__)
+  if (this->low_latency) {
+    // Not every driver supports this (ptys and many usb adapters don't)
+    struct serial_struct serial_info;
+    if (ioctl(this->fd, TIOCGSERIAL, &serial_info) == 0) {
+      serial_info.flags |= ASYNC_LOW_LATENCY;
+      this->low_latency_enabled =
+        (ioctl(this->fd, TIOCSSERIAL, &serial_info) == 0);
+    }
+  }
+#endif
+  // Drop anything received before we were configured
+  tcflush(this->fd, TCIOFLUSH);
+}
+
+void TermiosRMPIO::disconnect() {
+  // A hangup leaves the port open but no longer connected
+  if (this->fd >= 0) {
+    ioctl(this->fd, TIOCNXCL);
+    close(this->fd);
+    this->fd = -1;
+  }
+  this->connected = false;
+}
+
+int TermiosRMPIO::read(unsigned char* buffer, int size) {
+  // Take what is already queued first, poll() won't report less than a
+  // whole packet, which is left behind when the buffer is nearly full
+  ssize_t bytes_read = ::read(this->fd, buffer, size);
+  if (bytes_read < 0 && (errno == EAGAIN || errno == EINTR)) {
+    int result = waitReadable(this->fd, this->cancel_event,
+                              this->read_timeout_ms);
+    if (result <= 0) {
+      if (result < 0 && !this->canceled) {
+        RMP_THROW_MSG(ReadFailedException,
+          getErrorMessageByErrno("waiting for data").c_str());
+      }
+      return 0;
+    }
+    bytes_read = ::read(this->fd, buffer, size);
+    if (bytes_read < 0 && (errno == EAGAIN || errno == EINTR)) {
+      return 0;
+    }
+  }
+  if (bytes_read < 0) {
+    RMP_THROW_MSG(ReadFailedException,
+      getErrorMessageByErrno("reading").c_str());
+  }
+  if (bytes_read == 0) {
+    // Readable but empty means the other end hung up, that is reported once
+    // and every later read finds the port not connected
+    this->connected = false;
+    RMP_THROW_MSG(ReadFailedException, "The serial port was closed.");
+  }
+  return (int)bytes_read;
+}
+
+int TermiosRMPIO::write(unsigned char* buffer, int size) {
+  int written = 0;
+  while (written < size) {
+    ssize_t result = ::write(this->fd, buffer + written, size - written);
+    if (result >= 0) {
+      written += (int)result;
+      continue;
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    if (errno != EAGAIN) {
+      RMP_THROW_MSG(WriteFailedException,
+        getErrorMessageByErrno("writing").c_str());
+    }
+    // The output queue is full, wait for it to drain
+    struct pollfd pfd;
+    pfd.fd = this->fd;
+    pfd.events = POLLOUT;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, WRITE_TIMEOUT_MS) <= 0) {
+      break;
+    }
+  }
+  return written;
+}
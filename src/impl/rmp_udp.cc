@@ -0,0 +1,324 @@
+#include "segwayrmp/segwayrmp.h"
+#include "segwayrmp/impl/rmp_udp.h"
+#include "segwayrmp/impl/rmp_x440.h"
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <unistd.h>
+
+using namespace segwayrmp;
+
+// Milliseconds a send waits for room in the socket buffer
+static const int WRITE_TIMEOUT_MS = 1000;
+// Bytes of a packet in a datagram, the id and the data
+static const size_t PACKET_SIZE = 10;
+// Datagrams handed to the kernel in one call by sendPackets
+static const size_t SEND_BATCH_SIZE = 8;
+
+inline std::string
+getErrorMessageByErrno(std::string what)
+{
+  std::stringstream msg;
+  msg << "Error while " << what << ": " << strerror(errno);
+  return msg.str();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// UdpRMPIO
+
+UdpRMPIO::UdpRMPIO()
+: configured(false), address(""), port(0), receive_buffer_size(0),
+  send_buffer_size(0), fd(-1)
+{
+  this->connected = false;
+  memset(this->messages, 0, sizeof(this->messages));
+  for (size_t i = 0; i < batch_size; ++i) {
+    this->iovecs[i].iov_base = this->datagrams[i];
+    this->iovecs[i].iov_len = max_datagram_size;
+    this->messages[i].msg_hdr.msg_iov = &this->iovecs[i];
+    this->messages[i].msg_hdr.msg_iovlen = 1;
+    this->messages[i].msg_hdr.msg_control = this->controls[i];
+  }
+}
+
+UdpRMPIO::~UdpRMPIO() {
+  this->disconnect();
+}
+
+void
+UdpRMPIO::configure(std::string address, int port,
+                    int receive_buffer_size, int send_buffer_size)
+{
+  this->address = address;
+  this->port = port;
+  this->receive_buffer_size = receive_buffer_size;
+  this->send_buffer_size = send_buffer_size;
+  this->configured = true;
+}
+
+void UdpRMPIO::connect() {
+  if(!this->configured) {
+    RMP_THROW_MSG(ConnectionFailedException, "The ethernet interface must be "
+      "configured before connecting.");
+  }
+  struct sockaddr_in base;
+  memset(&base, 0, sizeof(base));
+  base.sin_family = AF_INET;
+  base.sin_port = htons(this->port);
+  if (inet_pton(AF_INET, this->address.c_str(), &base.sin_addr) != 1) {
+    RMP_THROW_MSG(ConnectionFailedException,
+      ("Invalid address: " + this->address).c_str());
+  }
+  this->fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (this->fd < 0) {
+    RMP_THROW_MSG(ConnectionFailedException,
+      getErrorMessageByErrno("opening a UDP socket").c_str());
+  }
+  try {
+    this->setBufferSize(SO_RCVBUF, this->receive_buffer_size,
+                        "setting the receive buffer size");
+    this->setBufferSize(SO_SNDBUF, this->send_buffer_size,
+                        "setting the send buffer size");
+    int enable = 1;
+    if (setsockopt(this->fd, SOL_SOCKET, SO_TIMESTAMPNS,
+                   &enable, sizeof(enable)) != 0) {
+      RMP_THROW_MSG(ConnectionFailedException,
+        getErrorMessageByErrno("enabling timestamps").c_str());
+    }
+    // Only datagrams from the base are received once connected
+    if (::connect(this->fd, (struct sockaddr *)&base, sizeof(base)) != 0) {
+      RMP_THROW_MSG(ConnectionFailedException,
+        getErrorMessageByErrno("connecting to " + this->address).c_str());
+    }
+  } catch(std::exception &e) {
+    close(this->fd);
+    this->fd = -1;
+    throw;
+  }
+  this->connected = true;
+}
+
+void UdpRMPIO::setBufferSize(int option, int size, const char *what) {
+  if (size <= 0) {
+    return;
+  }
+  if (setsockopt(this->fd, SOL_SOCKET, option, &size, sizeof(size)) != 0) {
+    RMP_THROW_MSG(ConnectionFailedException,
+      getErrorMessageByErrno(what).c_str());
+  }
+}
+
+void UdpRMPIO::disconnect() {
+  if(this->connected) {
+    if (this->fd >= 0) {
+      close(this->fd);
+      this->fd = -1;
+    }
+    this->connected = false;
+  }
+}
+
+int UdpRMPIO::read(unsigned char*, int) {
+  RMP_THROW_MSG(ReadFailedException, "UDP carries packets, not a byte "
+    "stream.");
+}
+
+int UdpRMPIO::write(unsigned char* buffer, int size) {
+  while (true) {
+    ssize_t sent = ::send(this->fd, buffer, size, 0);
+    if (sent >= 0) {
+      return (int)sent;
+    }
+    if (errno == EINTR || errno == ECONNREFUSED) {
+      // A refused earlier datagram is reported here, this one can still go
+      continue;
+    }
+    if (errno != EAGAIN && errno != ENOBUFS) {
+      RMP_THROW_MSG(WriteFailedException,
+        getErrorMessageByErrno("sending a datagram").c_str());
+    }
+    // The send buffer is full, wait for room
+    this->waitWritable();
+  }
+}
+
+void UdpRMPIO::waitWritable() {
+  struct pollfd pfd;
+  pfd.fd = this->fd;
+  pfd.events = POLLOUT;
+  pfd.revents = 0;
+  if (poll(&pfd, 1, WRITE_TIMEOUT_MS) <= 0) {
+    RMP_THROW_MSG(WriteFailedException, "Timed out sending a datagram.");
+  }
+}
+
+PacketStatus
+UdpRMPIO::tryGetPackets(Packet *packets, size_t max, size_t &count)
+SEGWAYRMP_NOEXCEPT
+{
+  count = 0;
+  if(!this->connected) {
+    return packet_not_connected;
+  }
+  unsigned int batch = (unsigned int)std::min(max, batch_size);
+  while(!this->canceled) {
+    // The kernel shrinks these to what it used, so reset them every time
+    for (unsigned int i = 0; i < batch; ++i) {
+      this->messages[i].msg_hdr.msg_controllen = sizeof(this->controls[i]);
+    }
+    // Take every datagram already queued, up to the batch size, in one call
+    int received = recvmmsg(this->fd, this->messages, batch, MSG_DONTWAIT,
+                            NULL);
+    if (received > 0) {
+      for (int i = 0; i < received; ++i) {
+        Packet &packet = packets[count];
+        if (!this->decodeDatagram(this->datagrams[i],
+                                  this->messages[i].msg_len, packet)) {
+          continue;
+        }
+        packet.timestamp = SegwayTime();
+        struct msghdr &header = this->messages[i].msg_hdr;
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&header); cmsg != NULL;
+             cmsg = CMSG_NXTHDR(&header, cmsg)) {
+          if (cmsg->cmsg_level == SOL_SOCKET &&
+              cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec stamp;
+            memcpy(&stamp, CMSG_DATA(cmsg), sizeof(stamp));
+            packet.timestamp = SegwayTime(stamp.tv_sec, stamp.tv_nsec);
+          }
+        }
+        count += 1;
+      }
+      if (count > 0) {
+        increment(this->packet_count, count);
+        return packet_ok;
+      }
+      continue;
+    }
+    // A refused datagram to the base is reported here, keep listening
+    if (received < 0 && errno != EAGAIN && errno != EINTR &&
+        errno != ECONNREFUSED) {
+      return this->readFailed("receiving");
+    }
+    int result = waitReadable(this->fd, this->cancel_event,
+                              this->read_timeout_ms);
+    if (result == 0) {
+      if (this->read_timeout_ms != 0) {
+        increment(this->timeout_count);
+      }
+      return packet_no_data;
+    }
+    if (result < 0 && !this->canceled) {
+      return this->readFailed("waiting for datagrams");
+    }
+  }
+  return packet_canceled;
+}
+
+PacketStatus UdpRMPIO::readFailed(const char *what) {
+  std::string message = getErrorMessageByErrno(what);
+  strncpy(this->read_error, message.c_str(), sizeof(this->read_error) - 1);
+  this->read_error[sizeof(this->read_error) - 1] = '\0';
+  increment(this->read_failure_count);
+  return packet_read_failed;
+}
+
+void UdpRMPIO::sendPacket(Packet &packet) {
+  unsigned char datagram[max_datagram_size];
+  this->write(datagram, (int)this->encodePacket(packet, datagram));
+}
+
+void UdpRMPIO::sendPackets(Packet *packets, size_t count) {
+  unsigned char datagrams[SEND_BATCH_SIZE][max_datagram_size];
+  struct iovec iovecs[SEND_BATCH_SIZE];
+  struct mmsghdr messages[SEND_BATCH_SIZE];
+  memset(messages, 0, sizeof(messages));
+  for (size_t i = 0; i < SEND_BATCH_SIZE; ++i) {
+    iovecs[i].iov_base = datagrams[i];
+    messages[i].msg_hdr.msg_iov = &iovecs[i];
+    messages[i].msg_hdr.msg_iovlen = 1;
+  }
+  size_t sent = 0;
+  while (sent < count) {
+    size_t batch = std::min(count - sent, SEND_BATCH_SIZE);
+    for (size_t i = 0; i < batch; ++i) {
+      iovecs[i].iov_len = this->encodePacket(packets[sent + i], datagrams[i]);
+    }
+    int result = sendmmsg(this->fd, messages, (unsigned int)batch, 0);
+    if (result > 0) {
+      // What didn't fit in the send buffer goes in the next call
+      sent += (size_t)result;
+      continue;
+    }
+    if (errno == EINTR || errno == ECONNREFUSED) {
+      continue;
+    }
+    if (errno != EAGAIN && errno != ENOBUFS) {
+      RMP_THROW_MSG(WriteFailedException,
+        getErrorMessageByErrno("sending datagrams").c_str());
+    }
+    this->waitWritable();
+  }
+}
+
+bool
+UdpRMPIO::decodeDatagram(const unsigned char *datagram, size_t length,
+                         Packet &packet)
+{
+  if (length < PACKET_SIZE) {
+    increment(this->skipped_byte_count, length);
+    return false;
+  }
+  packet.id = (unsigned short)((datagram[0] << 8) | datagram[1]);
+  // Status messages come from the RMP on what is channel A over usb
+  packet.channel = 0xAA;
+  memcpy(packet.data, datagram + 2, 8);
+  packet.payload = NULL;
+  packet.payload_length = 0;
+  return true;
+}
+
+size_t
+UdpRMPIO::encodePacket(const Packet &packet, unsigned char *datagram)
+{
+  datagram[0] = (unsigned char)(packet.id >> 8);
+  datagram[1] = (unsigned char)(packet.id & 0xFF);
+  memcpy(datagram + 2, packet.data, 8);
+  return PACKET_SIZE;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// X440RMPIO
+
+bool
+X440RMPIO::decodeDatagram(const unsigned char *datagram, size_t length,
+                          Packet &packet)
+{
+  if (length < 2) {
+    increment(this->skipped_byte_count, length);
+    return false;
+  }
+  boost::uint16_t crc = (boost::uint16_t)((datagram[length - 2] << 8)
+                                        | datagram[length - 1]);
+  if (computeX440Crc(datagram, length - 2) != crc) {
+    increment(this->checksum_mismatch_count);
+    return false;
+  }
+  packet.id = X440_FEEDBACK_ID;
+  packet.channel = 0xAA;
+  // Decoded in place by X440Protocol
+  packet.payload = datagram;
+  packet.payload_length = length - 2;
+  return true;
+}
+
+size_t
+X440RMPIO::encodePacket(const Packet &packet, unsigned char *datagram)
+{
+  return X440Protocol::encodeCommand(packet, datagram);
+}
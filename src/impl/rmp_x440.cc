@@ -0,0 +1,187 @@
+#include "segwayrmp/segwayrmp.h"
+#include "segwayrmp/impl/rmp_io.h"
+#include "segwayrmp/impl/rmp_x440.h"
+
+#include <cstring>
+
+using namespace segwayrmp;
+
+namespace {
+
+// CRC-16 lookup table for polynomial 0xA001
+struct CrcTable {
+  boost::uint16_t entries[256];
+  CrcTable() {
+    for (int i = 0; i < 256; ++i) {
+      boost::uint16_t crc = (boost::uint16_t)i;
+      for (int bit = 0; bit < 8; ++bit) {
+        crc = (crc & 1) ? (boost::uint16_t)((crc >> 1) ^ 0xA001)
+                        : (boost::uint16_t)(crc >> 1);
+      }
+      this->entries[i] = crc;
+    }
+  }
+};
+
+const CrcTable crc_table;
+
+// Where a feedback item goes in the SegwayStatus
+struct FeedbackField {
+  X440FeedbackItem item;
+  float SegwayStatus::*member;
+  bool is_float; // Otherwise an unsigned 32 bit integer
+  float scale;
+};
+
+const float RADIANS_TO_DEGREES = 57.2957795f;
+
+const FeedbackField FEEDBACK_FIELDS[] = {
+  {x440_frame_count, &SegwayStatus::servo_frames, false, 0.01f},
+  {x440_pse_pitch_deg, &SegwayStatus::pitch, true, 1.0f},
+  {x440_pse_pitch_rate_dps, &SegwayStatus::pitch_rate, true, 1.0f},
+  {x440_pse_roll_deg, &SegwayStatus::roll, true, 1.0f},
+  {x440_pse_roll_rate_dps, &SegwayStatus::roll_rate, true, 1.0f},
+  {x440_pse_yaw_rate_dps, &SegwayStatus::yaw_rate, true, 1.0f},
+  {x440_aux_batt_voltage_v, &SegwayStatus::ui_battery_voltage, true, 1.0f},
+  {x440_right_front_vel_mps, &SegwayStatus::right_wheel_speed, true, 1.0f},
+  {x440_left_front_vel_mps, &SegwayStatus::left_wheel_speed, true, 1.0f},
+  {x440_right_front_pos_m, &SegwayStatus::integrated_right_wheel_position,
+   true, 1.0f},
+  {x440_left_front_pos_m, &SegwayStatus::integrated_left_wheel_position,
+   true, 1.0f},
+  {x440_linear_pos_m, &SegwayStatus::integrated_forward_position, true, 1.0f},
+  {x440_vel_target_mps, &SegwayStatus::commanded_velocity, true, 1.0f},
+  {x440_yaw_rate_target_rps, &SegwayStatus::commanded_yaw_rate, true,
+   RADIANS_TO_DEGREES}
+};
+
+const size_t FEEDBACK_FIELD_COUNT =
+  sizeof(FEEDBACK_FIELDS) / sizeof(FEEDBACK_FIELDS[0]);
+
+inline boost::uint32_t
+getWord(const unsigned char *data)
+{
+  return ((boost::uint32_t)data[0] << 24) | ((boost::uint32_t)data[1] << 16)
+       | ((boost::uint32_t)data[2] << 8) | (boost::uint32_t)data[3];
+}
+
+inline void
+putWord(unsigned char *data, boost::uint32_t word)
+{
+  data[0] = (unsigned char)(word >> 24);
+  data[1] = (unsigned char)(word >> 16);
+  data[2] = (unsigned char)(word >> 8);
+  data[3] = (unsigned char)word;
+}
+
+inline size_t
+countBits(boost::uint32_t word)
+{
+  size_t count = 0;
+  for (; word != 0; word &= word - 1) {
+    ++count;
+  }
+  return count;
+}
+
+} // namespace
+
+boost::uint16_t
+segwayrmp::computeX440Crc(const unsigned char *data, size_t length)
+{
+  boost::uint16_t crc = 0;
+  for (size_t i = 0; i < length; ++i) {
+    crc = (boost::uint16_t)((crc >> 8)
+                            ^ crc_table.entries[(crc ^ data[i]) & 0xFF]);
+  }
+  return crc;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// X440Protocol
+
+X440Protocol::X440Protocol() {
+  boost::uint32_t bitmaps[4] = {0, 0, 0, 0};
+  for (size_t i = 0; i < FEEDBACK_FIELD_COUNT; ++i) {
+    int item = FEEDBACK_FIELDS[i].item;
+    bitmaps[item / 32] |= (boost::uint32_t)1 << (item % 32);
+  }
+  this->setFeedbackBitmaps(bitmaps[0], bitmaps[1], bitmaps[2], bitmaps[3]);
+}
+
+void
+X440Protocol::setFeedbackBitmaps(boost::uint32_t bitmap1,
+                                 boost::uint32_t bitmap2,
+                                 boost::uint32_t bitmap3,
+                                 boost::uint32_t bitmap4)
+{
+  this->bitmaps[0] = bitmap1;
+  this->bitmaps[1] = bitmap2;
+  this->bitmaps[2] = bitmap3;
+  this->bitmaps[3] = bitmap4;
+  this->word_count = 0;
+  for (int i = 0; i < 4; ++i) {
+    this->word_count += countBits(this->bitmaps[i]);
+  }
+  // An item's word follows one word for every selected item before it
+  for (size_t i = 0; i < FEEDBACK_FIELD_COUNT; ++i) {
+    int item = FEEDBACK_FIELDS[i].item;
+    boost::uint32_t bit = (boost::uint32_t)1 << (item % 32);
+    if ((this->bitmaps[item / 32] & bit) == 0) {
+      this->offsets[i] = -1;
+      continue;
+    }
+    size_t offset = countBits(this->bitmaps[item / 32] & (bit - 1));
+    for (int j = 0; j < item / 32; ++j) {
+      offset += countBits(this->bitmaps[j]);
+    }
+    this->offsets[i] = (int)offset;
+  }
+}
+
+bool
+X440Protocol::decodeFeedback(const unsigned char *words, size_t length,
+                             SegwayStatus &status) const
+{
+  if (length != this->word_count * 4) {
+    return false;
+  }
+  for (size_t i = 0; i < FEEDBACK_FIELD_COUNT; ++i) {
+    if (this->offsets[i] < 0) {
+      continue;
+    }
+    const FeedbackField &field = FEEDBACK_FIELDS[i];
+    boost::uint32_t word = getWord(words + this->offsets[i] * 4);
+    float value;
+    if (field.is_float) {
+      memcpy(&value, &word, sizeof(value));
+    } else {
+      value = (float)word;
+    }
+    status.*field.member = value * field.scale;
+  }
+  status.touched = true;
+  return true;
+}
+
+size_t
+X440Protocol::encodeCommand(const Packet &packet, unsigned char *message)
+{
+  message[0] = (unsigned char)(packet.id >> 8);
+  message[1] = (unsigned char)(packet.id & 0xFF);
+  memcpy(message + 2, packet.data, 8);
+  boost::uint16_t crc = computeX440Crc(message, 10);
+  message[10] = (unsigned char)(crc >> 8);
+  message[11] = (unsigned char)(crc & 0xFF);
+  return 12;
+}
+
+void
+X440Protocol::encodeFeedbackBitmapCommands(Packet *packets) const
+{
+  for (int i = 0; i < 4; ++i) {
+    packets[i].id = x440_configuration_command_id;
+    putWord(packets[i].data, x440_set_user_feedback_1_bitmap + i);
+    putWord(packets[i].data + 4, this->bitmaps[i]);
+  }
+}
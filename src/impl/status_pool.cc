@@ -0,0 +1,54 @@
+#include "segwayrmp/impl/status_pool.h"
+
+using namespace segwayrmp;
+
+StatusPool::StatusPool(size_t size)
+: statuses_(size), blocks_(size), free_statuses_(size), free_blocks_(size),
+  available_(size), miss_count_(0)
+{
+  for (size_t i = 0; i < size; ++i) {
+    this->free_statuses_.bounded_push(&this->statuses_[i]);
+    this->free_blocks_.bounded_push(&this->blocks_[i]);
+  }
+}
+
+StatusPool::~StatusPool() {}
+
+SegwayStatus::Ptr StatusPool::acquire() {
+  SegwayStatus *status;
+  if (!this->free_statuses_.pop(status)) {
+    this->miss_count_++;
+    return SegwayStatus::Ptr(new SegwayStatus());
+  }
+  this->available_--;
+  *status = SegwayStatus();
+  return SegwayStatus::Ptr(status, Recycler(this),
+    BlockAllocator<char>(this->shared_from_this()));
+}
+
+void StatusPool::Recycler::operator()(SegwayStatus *status) const {
+  this->pool->free_statuses_.bounded_push(status);
+  this->pool->available_++;
+}
+
+void *StatusPool::takeBlock() {
+  Block *block;
+  if (!this->free_blocks_.pop(block)) {
+    return NULL;
+  }
+  return block;
+}
+
+bool StatusPool::giveBlock(void *block) {
+  if (this->blocks_.empty()) {
+    return false;
+  }
+  // Blocks which came from the heap when the pool ran out go back there
+  Block *first = &this->blocks_[0];
+  Block *candidate = static_cast<Block *>(block);
+  if (candidate < first || candidate >= first + this->blocks_.size()) {
+    return false;
+  }
+  this->free_blocks_.bounded_push(candidate);
+  return true;
+}
@@ -0,0 +1,134 @@
+#include "segwayrmp/segwayrmp.h"
+#include "segwayrmp/impl/wakeup_event.h"
+
+#if !defined(_WIN32)
+# include <cerrno>
+# include <fcntl.h>
+# include <poll.h>
+# include <unistd.h>
+#endif
+#if defined(__linux__)
+# include <sys/eventfd.h>
+#endif
+
+using namespace segwayrmp;
+
+/////////////////////////////////////////////////////////////////////////////
+// WakeupEvent
+
+#if !defined(_WIN32)
+
+WakeupEvent::WakeupEvent() : read_fd_(-1), write_fd_(-1) {
+#if defined(__linux__)
+  this->read_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  this->write_fd_ = this->read_fd_;
+  if (this->read_fd_ < 0) {
+    RMP_THROW_MSG(ConfigurationException, "Could not create an eventfd.");
+  }
+#else
+  int fds[2];
+  if (pipe(fds) != 0) {
+    RMP_THROW_MSG(ConfigurationException, "Could not create a pipe.");
+  }
+  for (int i = 0; i < 2; ++i) {
+    fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+    fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+  }
+  this->read_fd_ = fds[0];
+  this->write_fd_ = fds[1];
+#endif
+}
+
+WakeupEvent::~WakeupEvent() {
+  if (this->write_fd_ != this->read_fd_) {
+    close(this->write_fd_);
+  }
+  close(this->read_fd_);
+}
+
+void WakeupEvent::set() {
+#if defined(__linux__)
+  uint64_t one = 1;
+  ssize_t result = ::write(this->write_fd_, &one, sizeof(one));
+#else
+  char one = 1;
+  ssize_t result = ::write(this->write_fd_, &one, sizeof(one));
+#endif
+  // A full counter or pipe means the event is already set
+  (void)result;
+}
+
+void WakeupEvent::reset() {
+  char buffer[64];
+  while (::read(this->read_fd_, buffer, sizeof(buffer)) > 0) {}
+}
+
+bool WakeupEvent::wait(int timeout_ms) {
+  struct pollfd pfd;
+  pfd.fd = this->read_fd_;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  int result;
+  do {
+    result = poll(&pfd, 1, timeout_ms);
+  } while (result < 0 && errno == EINTR);
+  return result > 0;
+}
+
+int segwayrmp::waitReadable(int fd, const WakeupEvent &event, int timeout_ms) {
+  struct pollfd pfds[2];
+  pfds[0].fd = fd;
+  pfds[0].events = POLLIN;
+  pfds[0].revents = 0;
+  pfds[1].fd = event.fd();
+  pfds[1].events = POLLIN;
+  pfds[1].revents = 0;
+  int result;
+  do {
+    result = poll(pfds, 2, timeout_ms);
+  } while (result < 0 && errno == EINTR);
+  if (result < 0 || pfds[1].revents != 0)
+    return -1;
+  if (result == 0)
+    return 0;
+  // Readable, or an error/hangup which the following read will report
+  return 1;
+}
+
+#else // _WIN32
+
+WakeupEvent::WakeupEvent() : read_fd_(-1), write_fd_(-1), set_(false) {}
+
+WakeupEvent::~WakeupEvent() {}
+
+void WakeupEvent::set() {
+  {
+    boost::lock_guard<boost::mutex> lock(this->mutex_);
+    this->set_ = true;
+  }
+  this->condition_variable_.notify_all();
+}
+
+void WakeupEvent::reset() {
+  boost::lock_guard<boost::mutex> lock(this->mutex_);
+  this->set_ = false;
+}
+
+bool WakeupEvent::wait(int timeout_ms) {
+  boost::unique_lock<boost::mutex> lock(this->mutex_);
+  if (timeout_ms < 0) {
+    while (!this->set_) {
+      this->condition_variable_.wait(lock);
+    }
+    return true;
+  }
+  boost::system_time deadline = boost::get_system_time()
+                              + boost::posix_time::milliseconds(timeout_ms);
+  while (!this->set_) {
+    if (!this->condition_variable_.timed_wait(lock, deadline))
+      break;
+  }
+  return this->set_;
+}
+
+#endif // _WIN32
@@ -1,10 +1,27 @@
 #include <algorithm>
 #include <iostream>
 
+#include <boost/bind.hpp>
+#include <boost/chrono/ceil.hpp>
+
 #include <segwayrmp/segwayrmp.h>
+#include <segwayrmp/impl/command_scheduler.h>
+#include <segwayrmp/impl/counters.h>
 #include <segwayrmp/impl/rmp_io.h>
 #include <segwayrmp/impl/rmp_ftd2xx.h>
-#if defined(SEGWAYRMP_USE_SERIAL)
+#include <segwayrmp/impl/rmp_x440.h>
+#include <segwayrmp/impl/seqlock.h>
+#include <segwayrmp/impl/spsc_ring.h>
+#include <segwayrmp/impl/status_pool.h>
+#if defined(SEGWAYRMP_USE_CAN)
+# include <segwayrmp/impl/rmp_can.h>
+#endif
+#if defined(SEGWAYRMP_USE_ETHERNET)
+# include <segwayrmp/impl/rmp_udp.h>
+#endif
+#if defined(SEGWAYRMP_USE_TERMIOS)
+# include <segwayrmp/impl/rmp_termios.h>
+#elif defined(SEGWAYRMP_USE_SERIAL)
 # include <segwayrmp/impl/rmp_serial.h>
 #endif
 
@@ -12,8 +29,17 @@
 # include <sys/time.h>
 #endif
 
+// Statuses in the pool beyond a full queue, for the one being parsed, the
+// one in the callback and a few held on to by the user
+static const size_t STATUS_POOL_SPARES = 8;
+
+// Read failures in a row after which the read thread gives up, and how
+// long it waits after each one for the failure to clear
+static const int MAX_CONSECUTIVE_READ_FAILURES = 10;
+static const int READ_FAILURE_BACKOFF_MS = 10;
+
 inline void
-defaultSegwayStatusCallback(segwayrmp::SegwayStatus::Ptr &segway_status)
+defaultSegwayStatusCallback(segwayrmp::SegwayStatus::Ptr segway_status)
 {
   std::cout << "Segway Status:" << std::endl << std::endl
             << segway_status->str() << std::endl << std::endl;
@@ -37,9 +63,6 @@ inline void defaultErrorMsgCallback(const std::string &msg)
 // This is from ROS's walltime function
 // http://www.ros.org/doc/api/rostime/html/time_8cpp_source.html
 inline segwayrmp::SegwayTime defaultTimestampCallback()
-#ifndef WIN32
-throw(segwayrmp::NoHighPerformanceTimersException)
-#endif
 {
   segwayrmp::SegwayTime st;
 #ifndef WIN32
@@ -139,6 +162,9 @@ inline void printHexFromString(std::string str)
 
 using namespace segwayrmp;
 
+// The most packets handled per read, more than fit in the read buffer
+static const size_t PACKET_BATCH_SIZE = 16;
+
 SegwayStatus::SegwayStatus()
   : timestamp(SegwayTime(0, 0)), pitch(0.0f), pitch_rate(0.0f), roll(0.0f),
     roll_rate(0.0f), left_wheel_speed(0.0f), right_wheel_speed(0.0f),
@@ -216,73 +242,212 @@ std::string SegwayStatus::str()
   return ss.str();
 }
 
+// The 0x0413 configuration commands applied by a Configuration
+static const unsigned char SET_MAX_VELOCITY_SCALE_FACTOR = 0x0A;
+static const unsigned char SET_MAX_ACCELERATION_SCALE_FACTOR = 0x0B;
+static const unsigned char SET_MAX_TURN_SCALE_FACTOR = 0x0C;
+static const unsigned char SET_CONTROLLER_GAIN_SCHEDULE = 0x0D;
+static const unsigned char SET_CURRENT_LIMIT_SCALE_FACTOR = 0x0E;
+static const unsigned char SET_OPERATIONAL_MODE = 0x10;
+
+inline Packet
+makeConfigurationPacket(unsigned char command, unsigned char value)
+{
+  Packet packet;
+  packet.id = 0x0413;
+  memset(packet.data, 0, 8);
+  packet.data[5] = command;
+  packet.data[7] = value;
+  return packet;
+}
+
+// Clamps to [0.0, 1.0] and scales to the steps the Segway takes
+inline unsigned char
+quantizeScaleFactor(double scalar, double steps)
+{
+  if (scalar < 0.0)
+    scalar = 0.0;
+  if (scalar > 1.0)
+    scalar = 1.0;
+  return (unsigned char)((short int)floor(scalar * steps) & 0x00FF);
+}
+
+Configuration::Configuration()
+: has_operational_mode_(false), operational_mode_(disabled),
+  has_controller_gain_schedule_(false), controller_gain_schedule_(light),
+  max_velocity_scale_factor_(-1.0), max_acceleration_scale_factor_(-1.0),
+  max_turn_scale_factor_(-1.0), current_limit_scale_factor_(-1.0)
+{}
+
+void Configuration::setOperationalMode(OperationalMode operational_mode) {
+  this->operational_mode_ = operational_mode;
+  this->has_operational_mode_ = true;
+}
+
+void Configuration::setControllerGainSchedule(
+  ControllerGainSchedule controller_gain_schedule)
+{
+  this->controller_gain_schedule_ = controller_gain_schedule;
+  this->has_controller_gain_schedule_ = true;
+}
+
+void Configuration::setMaxVelocityScaleFactor(double scalar) {
+  this->max_velocity_scale_factor_ = std::max(scalar, 0.0);
+}
+
+void Configuration::setMaxAccelerationScaleFactor(double scalar) {
+  this->max_acceleration_scale_factor_ = std::max(scalar, 0.0);
+}
+
+void Configuration::setMaxTurnScaleFactor(double scalar) {
+  this->max_turn_scale_factor_ = std::max(scalar, 0.0);
+}
+
+void Configuration::setCurrentLimitScaleFactor(double scalar) {
+  this->current_limit_scale_factor_ = std::max(scalar, 0.0);
+}
+
+// Throws if the interface can't be used, called from the initializer list
+// so that nothing is allocated yet, returns the interface type
+static InterfaceType
+checkInterfaceType(InterfaceType interface_type,
+                   SegwayRMPType segway_rmp_type)
+{
+  if (segway_rmp_type == rmpx440 && interface_type != ethernet
+      && interface_type != no_interface) {
+    RMP_THROW_MSG(ConfigurationException, "The rmpx440 is only supported "
+      "over ethernet");
+  }
+  switch (interface_type) {
+    case can:
+#if !defined(SEGWAYRMP_USE_CAN)
+      RMP_THROW_MSG(ConfigurationException, "Library is not built with CAN "
+        "support");
+#endif
+      break;
+    case serial:
+#if !defined(SEGWAYRMP_USE_TERMIOS) && !defined(SEGWAYRMP_USE_SERIAL)
+      RMP_THROW_MSG(ConfigurationException, "Library is not built with Serial "
+        "support");
+#endif
+      break;
+    case ethernet:
+#if !defined(SEGWAYRMP_USE_ETHERNET)
+      RMP_THROW_MSG(ConfigurationException, "Library is not built with "
+        "Ethernet support");
+#endif
+      break;
+    case usb:
+    case no_interface:
+      break;
+    default:
+      RMP_THROW_MSG(ConfigurationException, "Invalid InterfaceType specified");
+      break;
+  }
+  return interface_type;
+}
+
 SegwayRMP::SegwayRMP(InterfaceType interface_type,
-                     SegwayRMPType segway_rmp_type)
-: interface_type_(no_interface), segway_rmp_type_(segway_rmp_type),
+                     SegwayRMPType segway_rmp_type,
+                     StatusDeliveryMode status_delivery_mode)
+: command_scheduler_(NULL), command_rate_hz_(0.0),
+  reported_operational_mode_(-1), reported_controller_gain_schedule_(-1),
+  configuration_waiters_(0), x440_protocol_(NULL),
+  interface_type_(checkInterfaceType(interface_type, segway_rmp_type)),
+  segway_rmp_type_(segway_rmp_type),
   connected_(false),
-  continuously_reading_(false),
   status_callback_(defaultSegwayStatusCallback),
   get_time_(defaultTimestampCallback),
+  use_packet_timestamps_(true),
   debug_(defaultDebugMsgCallback),
   info_(defaultInfoMsgCallback),
   error_(defaultErrorMsgCallback),
-  handle_exception_(defaultExceptionCallback)
+  handle_exception_(defaultExceptionCallback),
+  ss_queue_(new SPSCRing<SegwayStatus::Ptr>(MAX_SEGWAYSTATUS_QUEUE_SIZE,
+                                            true)),
+  status_pool_(new StatusPool(MAX_SEGWAYSTATUS_QUEUE_SIZE
+                              + STATUS_POOL_SPARES)),
+  latest_status_(new SeqLock<SegwayStatus>()),
+  status_delivery_mode_(status_delivery_mode),
+  queue_policy_(queue_drop_oldest), dropped_oldest_count_(0),
+  dropped_newest_count_(0), blocked_count_(0), queue_high_water_mark_(0),
+  batch_max_count_(0), batch_max_age_(0),
+  drain_task_(boost::bind(&SegwayRMP::DrainCallbacks_, this)),
+  drain_scheduled_(false), pending_drains_(0),
+  subscribers_(new StatusSubscriberList()), subscribers_version_(0),
+  next_subscriber_id_(1), read_subscribers_(subscribers_),
+  read_subscribers_version_(0), continuously_reading_(false),
+  spinning_manually_(false)
 {
-  this->segway_status_ = SegwayStatus::Ptr(new SegwayStatus());
-  this->interface_type_ = interface_type;
+  std::fill(this->sent_scale_factors_, this->sent_scale_factors_ + 5, -1);
+  this->segway_status_ = this->status_pool_->acquire();
+  // The interface type was already checked by checkInterfaceType
   switch (interface_type) {
     case can:
-      RMP_THROW_MSG(ConfigurationException, "CAN is not supported currently");
+#if defined(SEGWAYRMP_USE_CAN)
+      this->rmp_io_ = new CanRMPIO();
+#endif
       break;
     case usb:
       this->rmp_io_ = new FTD2XXRMPIO();
       break;
     case serial:
-#if defined(SEGWAYRMP_USE_SERIAL)
+#if defined(SEGWAYRMP_USE_TERMIOS)
+      this->rmp_io_ = new TermiosRMPIO();
+#elif defined(SEGWAYRMP_USE_SERIAL)
       this->rmp_io_ = new SerialRMPIO();
-#else
-      RMP_THROW_MSG(ConfigurationException, "Library is not built with Serial "
-        "support");
 #endif
       break;
     case ethernet:
-      RMP_THROW_MSG(ConfigurationException, "Ethernet is not currently "
-        "supported");
-      break;
-    case no_interface:
-      // do nothing
+#if defined(SEGWAYRMP_USE_ETHERNET)
+      if (segway_rmp_type == rmpx440) {
+        this->rmp_io_ = new X440RMPIO();
+      } else {
+        this->rmp_io_ = new UdpRMPIO();
+      }
+#endif
       break;
     default:
-      RMP_THROW_MSG(ConfigurationException, "Invalid InterfaceType specified");
+      // do nothing
       break;
   }
 
   // Set the constants based on the segway type
   this->SetConstantsBySegwayType_(this->segway_rmp_type_);
+  if (this->segway_rmp_type_ == rmpx440) {
+    this->x440_protocol_ = new X440Protocol();
+  }
+  this->command_scheduler_ = new CommandScheduler(
+    boost::bind(&SegwayRMP::SendPacket_, this, _1),
+    boost::bind(&SegwayRMP::ReportException_, this, _1));
 }
 
 SegwayRMP::~SegwayRMP()
 {
+  // Nothing may be sent once the interface is gone
+  this->command_scheduler_->stop();
   if (this->continuously_reading_) {
     this->StopReadingContinuously_();
   }
-  if (this->interface_type_ == serial) {
-#if defined(SEGWAYRMP_USE_SERIAL)
-    SerialRMPIO * ptr = (SerialRMPIO *)(this->rmp_io_);
-    delete ptr;
-#endif
-  }
-  if (this->interface_type_ == usb) {
-    FTD2XXRMPIO * ptr = (FTD2XXRMPIO *)(this->rmp_io_);
-    delete ptr;
+  this->WaitForDrains_();
+  if (this->interface_type_ != no_interface) {
+    delete this->rmp_io_;
   }
+  delete this->command_scheduler_;
+  delete this->x440_protocol_;
+  delete this->ss_queue_;
+  delete this->latest_status_;
 }
 
 void SegwayRMP::configureSerial(std::string port, int baudrate)
 {
-#if SEGWAYRMP_USE_SERIAL
+#if defined(SEGWAYRMP_USE_TERMIOS) || defined(SEGWAYRMP_USE_SERIAL)
   if (this->interface_type_ == serial) {
+#if defined(SEGWAYRMP_USE_TERMIOS)
+    TermiosRMPIO *serial_rmp = (TermiosRMPIO *)(this->rmp_io_);
+#else
     SerialRMPIO *serial_rmp = (SerialRMPIO *)(this->rmp_io_);
+#endif
     serial_rmp->configure(port, baudrate);
   } else {
     RMP_THROW_MSG(ConfigurationException, "configureSerial: Cannot configure "
@@ -294,6 +459,40 @@ void SegwayRMP::configureSerial(std::string port, int baudrate)
 #endif
 }
 
+void SegwayRMP::configureCAN(std::string interface_name)
+{
+#if defined(SEGWAYRMP_USE_CAN)
+  if (this->interface_type_ == can) {
+    CanRMPIO *can_rmp = (CanRMPIO *)(this->rmp_io_);
+    can_rmp->configure(interface_name);
+  } else {
+    RMP_THROW_MSG(ConfigurationException, "configureCAN: Cannot configure "
+      "CAN when the InterfaceType is not can.");
+  }
+#else
+  RMP_THROW_MSG(ConfigurationException, "configureCAN: The segwayrmp "
+    "library is not build with CAN support, not implemented.");
+#endif
+}
+
+void SegwayRMP::configureEthernet(std::string address, int port,
+                                  int receive_buffer_size,
+                                  int send_buffer_size)
+{
+#if defined(SEGWAYRMP_USE_ETHERNET)
+  if (this->interface_type_ == ethernet) {
+    UdpRMPIO *udp_rmp = (UdpRMPIO *)(this->rmp_io_);
+    udp_rmp->configure(address, port, receive_buffer_size, send_buffer_size);
+  } else {
+    RMP_THROW_MSG(ConfigurationException, "configureEthernet: Cannot "
+      "configure ethernet when the InterfaceType is not ethernet.");
+  }
+#else
+  RMP_THROW_MSG(ConfigurationException, "configureEthernet: The segwayrmp "
+    "library is not build with ethernet support, not implemented.");
+#endif
+}
+
 void SegwayRMP::configureUSBBySerial(std::string serial_number, int baudrate)
 {
   if (this->interface_type_ == usb) {
@@ -328,21 +527,94 @@ void SegwayRMP::configureUSBByIndex(int device_index, int baudrate)
   }
 }
 
-void SegwayRMP::connect(bool reset_integrators)
+void SegwayRMP::connect(bool reset_integrators, bool start_threads)
+{
+  this->ConnectInterface_(reset_integrators);
+
+  if (!start_threads) {
+    // spinOnce only reads what is already waiting
+    this->spinning_manually_ = true;
+    this->rmp_io_->setReadTimeout(0);
+    this->StartDelivering_();
+    return;
+  }
+
+  // Kick off the read thread
+  this->StartReadingContinuously_();
+}
+
+int SegwayRMP::nativeHandle() {
+  if (this->interface_type_ == no_interface) {
+    return -1;
+  }
+  return this->rmp_io_->getFileDescriptor();
+}
+
+bool SegwayRMP::spinOnce() {
+  if (!this->spinning_manually_) {
+    RMP_THROW_MSG(ConfigurationException, "spinOnce: Must be connected with "
+      "start_threads false.");
+  }
+  bool got_packets = false;
+  this->ReadBuffered_(got_packets);
+  if (this->status_delivery_mode_ == status_callbacks
+      && !this->callback_executor_) {
+    // There is no callback thread, deliver on the caller's thread
+    this->DeliverQueued_();
+    if (this->MillisecondsUntilBatchDue_() == 0) {
+      this->FlushBatch_();
+    }
+  }
+  return got_packets;
+}
+
+void SegwayRMP::ConnectInterface_(bool reset_integrators)
 {
   // Connect to the interface
   this->rmp_io_->connect();
 
   this->connected_ = true;
 
-  if (reset_integrators) {
+  // Nothing is known about what is in effect on this connection yet
+  this->reported_operational_mode_ = -1;
+  this->reported_controller_gain_schedule_ = -1;
+  {
+    boost::lock_guard<boost::mutex> lock(this->configuration_mutex_);
+    std::fill(this->sent_scale_factors_, this->sent_scale_factors_ + 5, -1);
+  }
+
+  if (this->segway_rmp_type_ == rmpx440) {
+    // Tell the x440 which items to report, it has no 0x0413 integrator reset
+    Packet packets[4];
+    this->x440_protocol_->encodeFeedbackBitmapCommands(packets);
+    this->SendPackets_(packets, 4);
+  } else if (reset_integrators) {
     // Reset all the integrators
     this->resetAllIntegrators();
   }
 
-  // Kick off the read thread
-  this->StartReadingContinuously_();
+  if (this->command_rate_hz_ > 0.0) {
+    unsigned short setpoint_id = 0x0413;
+    if (this->segway_rmp_type_ == rmpx440) {
+      setpoint_id = x440_motion_command_id;
+    }
+    this->command_scheduler_->start(this->command_rate_hz_, setpoint_id);
+  }
+}
 
+void SegwayRMP::setX440FeedbackBitmaps(uint32_t bitmap1, uint32_t bitmap2,
+                                       uint32_t bitmap3, uint32_t bitmap4)
+{
+  if (this->segway_rmp_type_ != rmpx440) {
+    RMP_THROW_MSG(ConfigurationException, "setX440FeedbackBitmaps: The "
+      "SegwayRMPType is not rmpx440.");
+  }
+  if (this->connected_) {
+    RMP_THROW_MSG(ConfigurationException, "setX440FeedbackBitmaps: Must be "
+      "called before connecting.");
+  }
+  this->x440_protocol_->setFeedbackBitmaps(bitmap1, bitmap2,
+                                           bitmap3, bitmap4);
 }
 
 void SegwayRMP::shutdown()
@@ -356,7 +628,7 @@ void SegwayRMP::shutdown()
 
     packet.id = 0x0412;
 
-    this->rmp_io_->sendPacket(packet);
+    this->SendSafety_(packet);
   } catch (std::exception &e) {
       std::stringstream ss;
       ss << "Cannot send shutdown: " << e.what();
@@ -385,7 +657,7 @@ void SegwayRMP::moveCounts(short int linear_counts, short int angular_counts)
     packet.data[6] = 0x00;
     packet.data[7] = 0x00;
 
-    this->rmp_io_->sendPacket(packet);
+    this->SendMotion_(packet);
   } catch (std::exception &e) {
     RMP_THROW_MSG(MoveFailedException, e.what());
   }
@@ -397,6 +669,10 @@ void SegwayRMP::move(float linear_velocity, float angular_velocity)
   if (!this->connected_)
     RMP_THROW_MSG(MoveFailedException, "Not Connected.");
   try {
+    if (this->segway_rmp_type_ == rmpx440) {
+      this->moveX440_(linear_velocity, angular_velocity);
+      return;
+    }
     short int lv = (short int)(linear_velocity * this->mps_to_counts_);
     short int av = (short int)(angular_velocity * this->dps_to_counts_);
 
@@ -413,12 +689,113 @@ void SegwayRMP::move(float linear_velocity, float angular_velocity)
     packet.data[6] = 0x00;
     packet.data[7] = 0x00;
 
-    this->rmp_io_->sendPacket(packet);
+    this->SendMotion_(packet);
   } catch (std::exception &e) {
     RMP_THROW_MSG(MoveFailedException, e.what());
   }
 }
 
+void SegwayRMP::moveX440_(float linear_velocity, float angular_velocity)
+{
+  // The x440 takes normalized commands, [-1, 1] of its maximums
+  float values[2] = {
+    (float)(linear_velocity * this->mps_to_counts_),
+    (float)(angular_velocity * this->dps_to_counts_)
+  };
+  Packet packet;
+  packet.id = x440_motion_command_id;
+  for (int i = 0; i < 2; ++i) {
+    values[i] = std::max(-1.0f, std::min(1.0f, values[i]));
+    uint32_t word;
+    memcpy(&word, &values[i], sizeof(word));
+    packet.data[i * 4 + 0] = (unsigned char)(word >> 24);
+    packet.data[i * 4 + 1] = (unsigned char)(word >> 16);
+    packet.data[i * 4 + 2] = (unsigned char)(word >> 8);
+    packet.data[i * 4 + 3] = (unsigned char)word;
+  }
+  this->SendMotion_(packet);
+}
+
+void SegwayRMP::SendPacket_(Packet &packet)
+{
+  boost::lock_guard<boost::mutex> lock(this->write_mutex_);
+  this->rmp_io_->sendPacket(packet);
+}
+
+void SegwayRMP::SendPackets_(Packet *packets, size_t count)
+{
+  boost::lock_guard<boost::mutex> lock(this->write_mutex_);
+  this->rmp_io_->sendPackets(packets, count);
+}
+
+void SegwayRMP::SendMotion_(Packet &packet)
+{
+  if (this->command_scheduler_->isRunning()) {
+    this->command_scheduler_->setSetpoint(packet.data);
+  } else {
+    this->SendPacket_(packet);
+  }
+}
+
+void SegwayRMP::SendSafety_(Packet &packet)
+{
+  if (this->command_scheduler_->isRunning()) {
+    this->command_scheduler_->post(packet, transmit_safety);
+  } else {
+    this->SendPacket_(packet);
+  }
+}
+
+void SegwayRMP::SendConfig_(Packet &packet)
+{
+  if (this->command_scheduler_->isRunning()) {
+    this->command_scheduler_->post(packet, transmit_config);
+  } else {
+    this->SendPacket_(packet);
+  }
+}
+
+void SegwayRMP::SendConfigs_(Packet *packets, size_t count)
+{
+  if (this->command_scheduler_->isRunning()) {
+    for (size_t i = 0; i < count; ++i) {
+      this->command_scheduler_->post(packets[i], transmit_config);
+    }
+  } else {
+    this->SendPackets_(packets, count);
+  }
+}
+
+void SegwayRMP::ReportException_(const std::exception &error)
+{
+  this->handle_exception_(error);
+}
+
+void SegwayRMP::RememberConfiguration_(const Packet &packet)
+{
+  unsigned char command = packet.data[5];
+  if (command < SET_MAX_VELOCITY_SCALE_FACTOR
+      || command > SET_CURRENT_LIMIT_SCALE_FACTOR) {
+    return;
+  }
+  boost::lock_guard<boost::mutex> lock(this->configuration_mutex_);
+  this->sent_scale_factors_[command - SET_MAX_VELOCITY_SCALE_FACTOR] =
+    packet.data[7];
+}
+
+void SegwayRMP::ReportConfiguration_(int operational_mode,
+                                     int controller_gain_schedule)
+{
+  this->reported_operational_mode_ = operational_mode;
+  this->reported_controller_gain_schedule_ = controller_gain_schedule;
+  // Stored before the waiters are looked at, a thread which starts waiting
+  // after this sees the new values instead
+  if (this->configuration_waiters_ > 0) {
+    boost::lock_guard<boost::mutex> lock(this->configuration_mutex_);
+    this->configuration_condition_.notify_all();
+  }
+}
+
 void SegwayRMP::setOperationalMode(OperationalMode operational_mode)
 {
   // Ensure we are connected
@@ -439,7 +816,11 @@ void SegwayRMP::setOperationalMode(OperationalMode operational_mode)
     packet.data[6] = 0x00;
     packet.data[7] = (unsigned char)operational_mode;
 
-    this->rmp_io_->sendPacket(packet);
+    if (operational_mode == power_down) {
+      this->SendSafety_(packet);
+    } else {
+      this->SendConfig_(packet);
+    }
 
 //    while(this->segway_status_->operational_mode != operational_mode) {
 //      // Check again in 10 ms
@@ -473,7 +854,7 @@ void SegwayRMP::setControllerGainSchedule(
     packet.data[6] = 0x00;
     packet.data[7] = (unsigned char)controller_gain_schedule;
 
-    this->rmp_io_->sendPacket(packet);
+    this->SendConfig_(packet);
 
 //    while(this->segway_status_->controller_gain_schedule
 //          != controller_gain_schedule)
@@ -511,7 +892,7 @@ void SegwayRMP::setBalanceModeLocking(bool state)
     else
       packet.data[7] = 0x00;
 
-    this->rmp_io_->sendPacket(packet);
+    this->SendConfig_(packet);
   } catch (std::exception &e) {
     std::stringstream ss;
     ss << "Cannot set balance mode lock: " << e.what();
@@ -526,33 +907,24 @@ void SegwayRMP::resetAllIntegrators()
     RMP_THROW_MSG(ConfigurationException, "Cannot reset Integrators: Not "
       "Connected.");
   try {
-    Packet packet;
-
-    packet.id = 0x0413;
-
-    packet.data[0] = 0x00;
-    packet.data[1] = 0x00;
-    packet.data[2] = 0x00;
-    packet.data[3] = 0x00;
-    packet.data[4] = 0x00;
-    packet.data[5] = 0x32;
-    packet.data[6] = 0x00;
-    packet.data[7] = 0x01;
-
-    this->rmp_io_->sendPacket(packet);
-
-    packet.data[7] = 0x02;
-
-    this->rmp_io_->sendPacket(packet);
-
-    packet.data[7] = 0x04;
-
-    this->rmp_io_->sendPacket(packet);
-
-    packet.data[7] = 0x08;
-
-    this->rmp_io_->sendPacket(packet);
+    Packet packets[4];
+
+    for (int i = 0; i < 4; ++i) {
+      packets[i].id = 0x0413;
+
+      packets[i].data[0] = 0x00;
+      packets[i].data[1] = 0x00;
+      packets[i].data[2] = 0x00;
+      packets[i].data[3] = 0x00;
+      packets[i].data[4] = 0x00;
+      packets[i].data[5] = 0x32;
+      packets[i].data[6] = 0x00;
+      // 0x01, 0x02, 0x04 and 0x08, one integrator each
+      packets[i].data[7] = (unsigned char)(1 << i);
+    }
 
+    // All four go out in one write
+    this->SendConfigs_(packets, 4);
   } catch (std::exception &e) {
     std::stringstream ss;
     ss << "Cannot reset Integrators: " << e.what();
@@ -590,7 +962,8 @@ void SegwayRMP::setMaxVelocityScaleFactor(double scalar)
 
     packet.data[7] = (unsigned char)(scalar_int & 0x00FF);
 
-    this->rmp_io_->sendPacket(packet);
+    this->SendConfig_(packet);
+    this->RememberConfiguration_(packet);
   } catch (std::exception &e) {
     std::stringstream ss;
     ss << "Cannot set max velocity scale factor: " << e.what();
@@ -628,7 +1001,8 @@ void SegwayRMP::setMaxAccelerationScaleFactor(double scalar)
 
     packet.data[7] = (unsigned char)(scalar_int & 0x00FF);
 
-    this->rmp_io_->sendPacket(packet);
+    this->SendConfig_(packet);
+    this->RememberConfiguration_(packet);
   } catch (std::exception &e) {
     std::stringstream ss;
     ss << "Cannot set max acceleration scale factor: " << e.what();
@@ -666,7 +1040,8 @@ void SegwayRMP::setMaxTurnScaleFactor(double scalar)
 
     packet.data[7] = (unsigned char)(scalar_int & 0x00FF);
 
-    this->rmp_io_->sendPacket(packet);
+    this->SendConfig_(packet);
+    this->RememberConfiguration_(packet);
   } catch (std::exception &e) {
     std::stringstream ss;
     ss << "Cannot set max turn scale factor: " << e.what();
@@ -704,7 +1079,8 @@ void SegwayRMP::setCurrentLimitScaleFactor(double scalar)
 
     packet.data[7] = (unsigned char)(scalar_int & 0x00FF);
 
-    this->rmp_io_->sendPacket(packet);
+    this->SendConfig_(packet);
+    this->RememberConfiguration_(packet);
   } catch (std::exception &e) {
     std::stringstream ss;
     ss << "Cannot set current limit scale factor: " << e.what();
@@ -712,10 +1088,250 @@ void SegwayRMP::setCurrentLimitScaleFactor(double scalar)
   }
 }
 
+size_t
+SegwayRMP::applyConfiguration(const Configuration &configuration,
+                              int timeout_ms)
+{
+  // Ensure we are connected
+  if (!this->connected_)
+    RMP_THROW_MSG(ConfigurationException, "Cannot apply configuration: "
+      "Not Connected.");
+  if (this->segway_rmp_type_ == rmpx440)
+    RMP_THROW_MSG(ConfigurationException, "Cannot apply configuration: "
+      "The rmpx440 does not take 0x0413 configuration commands.");
+  // The scale factors are not reported, skip those already sent
+  Packet packets[6];
+  size_t count = 0;
+  {
+    boost::lock_guard<boost::mutex> lock(this->configuration_mutex_);
+    const double scale_factors[5] = {
+      configuration.max_velocity_scale_factor_,
+      configuration.max_acceleration_scale_factor_,
+      configuration.max_turn_scale_factor_,
+      -1.0,
+      configuration.current_limit_scale_factor_
+    };
+    for (int i = 0; i < 5; ++i) {
+      if (scale_factors[i] < 0.0) {
+        continue;
+      }
+      unsigned char command =
+        (unsigned char)(SET_MAX_VELOCITY_SCALE_FACTOR + i);
+      unsigned char value = quantizeScaleFactor(scale_factors[i],
+        command == SET_CURRENT_LIMIT_SCALE_FACTOR ? 256.0 : 16.0);
+      if (this->sent_scale_factors_[i] != value) {
+        packets[count++] = makeConfigurationPacket(command, value);
+      }
+    }
+  }
+  bool wait_for_gain_schedule =
+    configuration.has_controller_gain_schedule_
+    && this->reported_controller_gain_schedule_
+       != (int)configuration.controller_gain_schedule_;
+  if (wait_for_gain_schedule) {
+    packets[count++] = makeConfigurationPacket(SET_CONTROLLER_GAIN_SCHEDULE,
+      (unsigned char)configuration.controller_gain_schedule_);
+  }
+  // The mode goes last, so the Segway has the new limits when it changes
+  bool power_down_requested = configuration.has_operational_mode_
+    && configuration.operational_mode_ == power_down;
+  bool wait_for_operational_mode =
+    configuration.has_operational_mode_ && !power_down_requested
+    && this->reported_operational_mode_
+       != (int)configuration.operational_mode_;
+  if (wait_for_operational_mode) {
+    packets[count++] = makeConfigurationPacket(SET_OPERATIONAL_MODE,
+      (unsigned char)configuration.operational_mode_);
+  }
+  try {
+    if (count > 0) {
+      this->SendConfigs_(packets, count);
+      for (size_t i = 0; i < count; ++i) {
+        this->RememberConfiguration_(packets[i]);
+      }
+    }
+    if (power_down_requested) {
+      Packet packet = makeConfigurationPacket(SET_OPERATIONAL_MODE,
+        (unsigned char)power_down);
+      this->SendSafety_(packet);
+      count += 1;
+    }
+  } catch (std::exception &e) {
+    std::stringstream ss;
+    ss << "Cannot apply configuration: " << e.what();
+    RMP_THROW_MSG(ConfigurationException, ss.str().c_str());
+  }
+  if (timeout_ms <= 0
+      || (!wait_for_gain_schedule && !wait_for_operational_mode)) {
+    return count;
+  }
+  // Wait for a 0x0406 with the changes, ParsePacket_ signals each one
+  boost::chrono::steady_clock::time_point deadline =
+    boost::chrono::steady_clock::now()
+    + boost::chrono::milliseconds(timeout_ms);
+  bool applied = false;
+  bool timed_out = false;
+  ++this->configuration_waiters_;
+  {
+    boost::unique_lock<boost::mutex> lock(this->configuration_mutex_);
+    while (true) {
+      // Checked once more after the deadline, it may have just come in
+      applied = (!wait_for_gain_schedule
+                 || this->reported_controller_gain_schedule_
+                    == (int)configuration.controller_gain_schedule_)
+             && (!wait_for_operational_mode
+                 || this->reported_operational_mode_
+                    == (int)configuration.operational_mode_);
+      if (applied || timed_out) {
+        break;
+      }
+      timed_out = this->configuration_condition_.wait_until(lock, deadline)
+                  == boost::cv_status::timeout;
+    }
+  }
+  --this->configuration_waiters_;
+  if (!applied) {
+    std::stringstream ss;
+    ss << "Cannot apply configuration: The Segway did not report the "
+          "changes within " << timeout_ms << " ms.";
+    RMP_THROW_MSG(ConfigurationException, ss.str().c_str());
+  }
+  return count;
+}
+
 void SegwayRMP::setStatusCallback(SegwayStatusCallback callback) {
   this->status_callback_ = callback;
 }
 
+void
+SegwayRMP::setStatusBatchCallback(SegwayStatusBatchCallback callback,
+                                  size_t max_count, int max_age_ms)
+{
+  if (this->connected_) {
+    RMP_THROW_MSG(ConfigurationException, "setStatusBatchCallback: Must be "
+      "called before connecting.");
+  }
+  if (max_count == 0) {
+    RMP_THROW_MSG(ConfigurationException, "setStatusBatchCallback: A batch "
+      "must hold at least one status.");
+  }
+  this->status_batch_callback_ = callback;
+  this->batch_max_count_ = max_count;
+  this->batch_max_age_ = boost::chrono::milliseconds(std::max(max_age_ms, 0));
+  // Allocated once, clearing a vector keeps its capacity
+  this->status_batch_.reserve(max_count);
+}
+
+struct SegwayRMP::StatusSubscriber {
+  int id;
+  SegwayStatusCallback callback;
+  SubscriberOptions options;
+  // Only the read thread touches these
+  unsigned int skipped;
+  bool delivered;
+  boost::chrono::steady_clock::time_point last_delivery;
+};
+
+int
+SegwayRMP::addStatusSubscriber(SegwayStatusCallback callback,
+                               const SubscriberOptions &options)
+{
+  boost::shared_ptr<StatusSubscriber> subscriber(new StatusSubscriber());
+  subscriber->callback = callback;
+  subscriber->options = options;
+  subscriber->options.rate_divisor = std::max(options.rate_divisor, 1u);
+  subscriber->skipped = 0;
+  subscriber->delivered = false;
+  boost::lock_guard<boost::mutex> lock(this->subscribers_mutex_);
+  subscriber->id = this->next_subscriber_id_++;
+  boost::shared_ptr<StatusSubscriberList> subscribers(
+    new StatusSubscriberList(*this->subscribers_));
+  subscribers->push_back(subscriber);
+  this->subscribers_ = subscribers;
+  this->subscribers_version_++;
+  return subscriber->id;
+}
+
+void SegwayRMP::removeStatusSubscriber(int id) {
+  boost::lock_guard<boost::mutex> lock(this->subscribers_mutex_);
+  boost::shared_ptr<StatusSubscriberList> subscribers(
+    new StatusSubscriberList());
+  for (size_t i = 0; i < this->subscribers_->size(); ++i) {
+    if ((*this->subscribers_)[i]->id != id) {
+      subscribers->push_back((*this->subscribers_)[i]);
+    }
+  }
+  this->subscribers_ = subscribers;
+  this->subscribers_version_++;
+}
+
+void SegwayRMP::setStatusDeliveryMode(StatusDeliveryMode mode) {
+  if (this->connected_) {
+    RMP_THROW_MSG(ConfigurationException, "setStatusDeliveryMode: Must be "
+      "called before connecting.");
+  }
+  this->status_delivery_mode_ = mode;
+}
+
+void
+SegwayRMP::setCallbackExecutor(boost::shared_ptr<CallbackExecutor> executor)
+{
+  if (this->connected_) {
+    RMP_THROW_MSG(ConfigurationException, "setCallbackExecutor: Must be "
+      "called before connecting.");
+  }
+  this->callback_executor_ = executor;
+}
+
+void SegwayRMP::setStatusQueue(size_t depth, QueueOverflowPolicy policy) {
+  if (this->connected_) {
+    RMP_THROW_MSG(ConfigurationException, "setStatusQueue: Must be called "
+      "before connecting.");
+  }
+  if (depth == 0) {
+    RMP_THROW_MSG(ConfigurationException, "setStatusQueue: The depth must be "
+      "at least one.");
+  }
+  if (policy == queue_coalesce) {
+    depth = 1;
+  }
+  bool overwritable = (policy == queue_drop_oldest || policy == queue_coalesce);
+  delete this->ss_queue_;
+  this->ss_queue_ = new SPSCRing<SegwayStatus::Ptr>(depth, overwritable);
+  this->status_pool_.reset(new StatusPool(depth + STATUS_POOL_SPARES));
+  this->segway_status_ = this->status_pool_->acquire();
+  this->queue_policy_ = policy;
+}
+
+void SegwayRMP::setCommandRate(double rate_hz) {
+  if (this->connected_) {
+    RMP_THROW_MSG(ConfigurationException, "setCommandRate: Must be called "
+      "before connecting.");
+  }
+  if (rate_hz < 0.0) {
+    RMP_THROW_MSG(ConfigurationException, "setCommandRate: The rate must not "
+      "be negative.");
+  }
+  this->command_rate_hz_ = rate_hz;
+}
+
+CommandStatistics SegwayRMP::getCommandStatistics() {
+  return this->command_scheduler_->getStatistics();
+}
+
+StatusQueueStatistics SegwayRMP::getStatusQueueStatistics() {
+  StatusQueueStatistics statistics;
+  statistics.dropped_oldest = this->dropped_oldest_count_;
+  statistics.dropped_newest = this->dropped_newest_count_;
+  statistics.blocked = this->blocked_count_;
+  statistics.high_water_mark = this->queue_high_water_mark_;
+  return statistics;
+}
+
+bool SegwayRMP::getLatestStatus(SegwayStatus &status) {
+  return this->latest_status_->load(status);
+}
+
 void SegwayRMP::setLogMsgCallback(std::string log_level,
                                     LogMsgCallback callback)
 {
@@ -735,61 +1351,246 @@ void SegwayRMP::setLogMsgCallback(std::string log_level,
 
 void SegwayRMP::setTimestampCallback(GetTimeCallback callback) {
   this->get_time_ = callback;
+  this->use_packet_timestamps_ = false;
 }
 
 void SegwayRMP::setExceptionCallback(ExceptionCallback exception_callback) {
   this->handle_exception_ = exception_callback;
 }
 
+int SegwayRMP::ReadPackets_(bool report_no_data) {
+  // Built once so that reporting errors doesn't allocate
+  static const std::string checksum_mismatch_msg("Checksum mismatch...");
+  static const std::string no_data_msg("No data from Segway...");
+  Packet packets[PACKET_BATCH_SIZE];
+  size_t count = 0;
+  PacketStatus status =
+    this->rmp_io_->tryGetPackets(packets, PACKET_BATCH_SIZE, count);
+  switch (status) {
+    case packet_ok:
+      try {
+        for (size_t i = 0; i < count; ++i) {
+          this->ProcessPacket_(packets[i]);
+        }
+      } catch (std::exception &e) {
+        this->handle_exception_(e);
+      }
+      break;
+    case packet_checksum_mismatch:
+      this->error_(checksum_mismatch_msg);
+      break;
+    case packet_no_data:
+      if (report_no_data) {
+        this->error_(no_data_msg);
+      }
+      break;
+    case packet_canceled: // Shutting down
+      break;
+    case packet_not_connected:
+      this->handle_exception_(PacketRetrievalException(__FILE__, __LINE__,
+        "Not connected.", packet_not_connected));
+      break;
+    case packet_read_failed:
+    default:
+      this->handle_exception_(ReadFailedException(__FILE__, __LINE__,
+        this->rmp_io_->getReadError()));
+      break;
+  }
+  return status;
+}
+
+int SegwayRMP::ReadBuffered_(bool &got_packets) {
+  // Take everything already buffered, readiness only says there is some
+  int status;
+  do {
+    status = this->ReadPackets_(false);
+    got_packets = got_packets || status == packet_ok;
+  } while (status == packet_ok || status == packet_checksum_mismatch);
+  return status;
+}
+
 void SegwayRMP::ReadContinuously_() {
-  Packet packet;
+  int failures = 0;
   while (this->continuously_reading_) {
-    try {
-      this->rmp_io_->getPacket(packet);
-      this->ProcessPacket_(packet);
-    } catch (PacketRetrievalException &e) {
-      if (e.error_number() == 2) // Failed Checksum
-        this->error_("Checksum mismatch...");
-      else if (e.error_number() == 3) // No packet received
-        this->error_("No data from Segway...");
-      else
-        this->handle_exception_(e);
+    int status = this->ReadPackets_(true);
+    if (status == packet_canceled) {
+      return;
+    }
+    // Already reported, a hung up port or a closed socket won't come back,
+    // reading on would only spin
+    if (status == packet_not_connected) {
+      this->error_("Stopped reading: the interface is not connected.");
+      return;
+    }
+    if (status != packet_read_failed) {
+      failures = 0;
+      continue;
     }
+    if (++failures >= MAX_CONSECUTIVE_READ_FAILURES) {
+      std::stringstream ss;
+      ss << "Stopped reading after " << failures
+         << " read failures in a row.";
+      this->error_(ss.str());
+      return;
+    }
+    boost::this_thread::sleep_for(
+      boost::chrono::milliseconds(READ_FAILURE_BACKOFF_MS));
   }
 }
 
 void SegwayRMP::ExecuteCallbacks_() {
   while (this->continuously_reading_) {
-    SegwayStatus::Ptr ss = this->ss_queue_.dequeue();
+    SegwayStatus::Ptr ss;
+    // Wake up in time to deliver a partial batch which is due
+    bool dequeued =
+      this->ss_queue_->dequeue(ss, this->MillisecondsUntilBatchDue_());
     if (this->continuously_reading_) {
-      try {
-        if (ss) {
-          if (this->status_callback_) {
-            this->status_callback_(ss);
-          } // if this->status_callback_
-        } // if ss
-      } catch (std::exception &e) {
-        this->handle_exception_(e);
-      }// try callback
+      if (dequeued) {
+        this->DeliverStatus_(ss);
+      } else if (this->MillisecondsUntilBatchDue_() == 0) {
+        this->FlushBatch_();
+      }
     }// if continuous
   }// while continuous
 }
 
-void SegwayRMP::StartReadingContinuously_() {
+void SegwayRMP::DeliverStatus_(SegwayStatus::Ptr &ss) {
+  if (!this->status_batch_callback_) {
+    this->CallStatusCallback_(ss);
+    return;
+  }
+  if (this->status_batch_.empty()) {
+    this->batch_started_ = boost::chrono::steady_clock::now();
+  }
+  this->status_batch_.push_back(ss);
+  if (this->status_batch_.size() >= this->batch_max_count_
+      || this->MillisecondsUntilBatchDue_() == 0) {
+    this->FlushBatch_();
+  }
+}
+
+int SegwayRMP::MillisecondsUntilBatchDue_() {
+  if (this->status_batch_.empty()) {
+    return -1;
+  }
+  boost::chrono::steady_clock::duration remaining = this->batch_max_age_
+    - (boost::chrono::steady_clock::now() - this->batch_started_);
+  if (remaining <= boost::chrono::steady_clock::duration::zero()) {
+    return 0;
+  }
+  // Round up, waking early would just go back to sleep for nothing
+  return (int)boost::chrono::ceil<boost::chrono::milliseconds>(
+    remaining).count();
+}
+
+void SegwayRMP::FlushBatch_() {
+  if (this->status_batch_.empty()) {
+    return;
+  }
+  try {
+    this->status_batch_callback_(&this->status_batch_[0],
+                                 this->status_batch_.size());
+  } catch (std::exception &e) {
+    this->handle_exception_(e);
+  }
+  // Hands the statuses back to the pool, unless the callback kept them
+  this->status_batch_.clear();
+}
+
+void SegwayRMP::CallStatusCallback_(SegwayStatus::Ptr &ss) {
+  try {
+    if (ss) {
+      if (this->status_callback_) {
+        this->status_callback_(ss);
+      } // if this->status_callback_
+    } // if ss
+  } catch (std::exception &e) {
+    this->handle_exception_(e);
+  }// try callback
+}
+
+void SegwayRMP::DeliverQueued_() {
+  SegwayStatus::Ptr ss;
+  while (this->ss_queue_->tryDequeue(ss)) {
+    this->DeliverStatus_(ss);
+    ss.reset();
+  }
+}
+
+void SegwayRMP::ScheduleDrain_() {
+  // A drain which is already scheduled or running picks up the new status
+  if (!this->drain_scheduled_.exchange(true)) {
+    this->pending_drains_++;
+    this->callback_executor_->post(this->drain_task_);
+  }
+}
+
+void SegwayRMP::DrainCallbacks_() {
+  while (true) {
+    SegwayStatus::Ptr ss;
+    while (this->ss_queue_->tryDequeue(ss)) {
+      if (this->continuously_reading_) {
+        this->DeliverStatus_(ss);
+      }
+      ss.reset();
+    }
+    this->drain_scheduled_ = false;
+    // A status enqueued after the last dequeue did not schedule a drain,
+    // keep going unless the reader scheduled a new one since
+    if (this->ss_queue_->empty() || this->drain_scheduled_.exchange(true)) {
+      break;
+    }
+  }
+  boost::lock_guard<boost::mutex> lock(this->drain_mutex_);
+  this->pending_drains_--;
+  this->drain_condition_.notify_all();
+}
+
+void SegwayRMP::WaitForDrains_() {
+  boost::unique_lock<boost::mutex> lock(this->drain_mutex_);
+  while (this->pending_drains_ > 0) {
+    this->drain_condition_.wait(lock);
+  }
+}
+
+void SegwayRMP::StartDelivering_() {
   this->continuously_reading_ = true;
+  this->ss_queue_->reset();
+  if (this->status_delivery_mode_ == status_callbacks
+      && !this->callback_executor_ && !this->spinning_manually_) {
+    this->callback_execution_thread_ =
+      boost::thread(&SegwayRMP::ExecuteCallbacks_, this);
+  }
+}
+
+void SegwayRMP::StopDelivering_() {
+  this->continuously_reading_ = false;
+  this->ss_queue_->cancel();
+  if (this->callback_execution_thread_.joinable()) {
+    this->callback_execution_thread_.join();
+  }
+  // Nothing schedules a drain once the reading has stopped
+  this->WaitForDrains_();
+  // Nothing else delivers now, hand over what is left of the batch
+  this->FlushBatch_();
+}
+
+void SegwayRMP::StartReadingContinuously_() {
+  this->StartDelivering_();
   this->read_thread_ =
     boost::thread(&SegwayRMP::ReadContinuously_, this);
-  this->callback_execution_thread_ =
-    boost::thread(&SegwayRMP::ExecuteCallbacks_, this);
 }
 
 void SegwayRMP::StopReadingContinuously_()
 {
   this->continuously_reading_ = false;
   this->rmp_io_->cancel();
-  this->read_thread_.join();
-  this->ss_queue_.cancel();
-  this->callback_execution_thread_.join();
+  // The read thread may be waiting for room in the queue
+  this->ss_queue_->cancel();
+  if (this->read_thread_.joinable()) {
+    this->read_thread_.join();
+  }
+  this->StopDelivering_();
 }
 
 void SegwayRMP::SetConstantsBySegwayType_(SegwayRMPType &rmp_type) {
@@ -806,6 +1607,15 @@ void SegwayRMP::SetConstantsBySegwayType_(SegwayRMPType &rmp_type) {
     this->meters_to_counts_ = 40181.0;
     this->rev_to_counts_ = 117031.0;
     this->torque_to_counts_ = 1463.0;
+  } else
+  if (rmp_type == rmpx440) {
+    // Commands are normalized by the maximum velocity, 2.2352 m/s (5 mph),
+    // and the maximum yaw rate, 3.0 rad/s, feedback is already in SI units
+    this->dps_to_counts_ = 1.0 / (3.0 * 57.2957795);
+    this->mps_to_counts_ = 1.0 / 2.2352;
+    this->meters_to_counts_ = 1.0;
+    this->rev_to_counts_ = 1.0;
+    this->torque_to_counts_ = 1.0;
   } else {
     RMP_THROW_MSG(ConfigurationException, "Invalid Segway RMP Type");
   }
@@ -837,7 +1647,11 @@ bool SegwayRMP::ParsePacket_(Packet &packet, SegwayStatus::Ptr &ss_ptr)
   switch (packet.id) {
   case 0x0400: // COMMAND REQUEST
     // This is the first packet of a msg series, timestamp here.
-    ss_ptr->timestamp  = this->get_time_();
+    if (this->use_packet_timestamps_ && packet.timestamp.sec != 0) {
+      ss_ptr->timestamp = packet.timestamp;
+    } else {
+      ss_ptr->timestamp = this->get_time_();
+    }
     break;
   case 0x0401:
     ss_ptr->pitch      = getShortInt(packet.data[0], packet.data[1])
@@ -895,6 +1709,8 @@ bool SegwayRMP::ParsePacket_(Packet &packet, SegwayStatus::Ptr &ss_ptr)
       OperationalMode(getShortInt(packet.data[0], packet.data[1]));
     ss_ptr->controller_gain_schedule  =
       ControllerGainSchedule(getShortInt(packet.data[2], packet.data[3]));
+    this->ReportConfiguration_(ss_ptr->operational_mode,
+                               ss_ptr->controller_gain_schedule);
     ss_ptr->ui_battery_voltage        =
       (
         (((short unsigned int)packet.data[4]) << 8)
@@ -917,6 +1733,19 @@ bool SegwayRMP::ParsePacket_(Packet &packet, SegwayStatus::Ptr &ss_ptr)
     status_updated = true;
     ss_ptr->touched = true;
     break;
+  case X440_FEEDBACK_ID:
+    // A whole cycle of information comes in one x440 feedback message
+    if (this->x440_protocol_ == NULL || !this->x440_protocol_->decodeFeedback(
+          packet.payload, packet.payload_length, *ss_ptr)) {
+      break;
+    }
+    if (this->use_packet_timestamps_ && packet.timestamp.sec != 0) {
+      ss_ptr->timestamp = packet.timestamp;
+    } else {
+      ss_ptr->timestamp = this->get_time_();
+    }
+    status_updated = true;
+    break;
   case 0x0680:
     if (packet.data[3] == 0x80) // Motors Enabled
       ss_ptr->motor_status = 1;
@@ -940,11 +1769,149 @@ void SegwayRMP::ProcessPacket_(Packet &packet)
   //  complete "cycle" of information has been sent every
   //  time we get an 0x0407
   if (status_updated) {
-    if (this->ss_queue_.enqueue(this->segway_status_)) {
-      this->error_("Falling behind, SegwayStatus Queue Full, skipping packet "
-        "report...");
+    this->latest_status_->store(*this->segway_status_);
+    bool published = this->PublishToSubscribers_();
+    if (this->status_delivery_mode_ == status_inline) {
+      this->CallStatusCallback_(this->segway_status_);
+      // The callback may have kept it
+      this->segway_status_ = this->status_pool_->acquire();
+      return;
+    }
+    if (this->status_delivery_mode_ == status_polling
+        || (!this->status_callback_ && !this->status_batch_callback_)) {
+      if (published) {
+        // A subscriber may have kept it
+        this->segway_status_ = this->status_pool_->acquire();
+      } else {
+        // Nobody else holds it, start the next cycle from a clean status
+        *this->segway_status_ = SegwayStatus();
+      }
+      return;
+    }
+    this->EnqueueStatus_();
+    if (this->callback_executor_) {
+      this->ScheduleDrain_();
+    }
+    this->segway_status_ = this->status_pool_->acquire();
+  }
+}
+
+bool SegwayRMP::PublishToSubscribers_() {
+  if (this->subscribers_version_.load(boost::memory_order_acquire)
+      != this->read_subscribers_version_) {
+    boost::lock_guard<boost::mutex> lock(this->subscribers_mutex_);
+    this->read_subscribers_ = this->subscribers_;
+    this->read_subscribers_version_ = this->subscribers_version_;
+  }
+  const StatusSubscriberList &subscribers = *this->read_subscribers_;
+  if (subscribers.empty()) {
+    return false;
+  }
+  bool published = false;
+  boost::chrono::steady_clock::time_point now;
+  bool have_now = false;
+  for (size_t i = 0; i < subscribers.size(); ++i) {
+    StatusSubscriber &subscriber = *subscribers[i];
+    if (subscriber.delivered
+        && ++subscriber.skipped < subscriber.options.rate_divisor) {
+      continue;
+    }
+    if (subscriber.options.min_period_ms > 0) {
+      // Only read the clock for subscribers which need it
+      if (!have_now) {
+        now = boost::chrono::steady_clock::now();
+        have_now = true;
+      }
+      if (subscriber.delivered && now - subscriber.last_delivery
+          < boost::chrono::milliseconds(subscriber.options.min_period_ms)) {
+        continue;
+      }
+      subscriber.last_delivery = now;
+    }
+    subscriber.skipped = 0;
+    subscriber.delivered = true;
+    published = true;
+    if (subscriber.options.executor) {
+      this->pending_drains_++;
+      subscriber.options.executor->post(
+        boost::bind(&SegwayRMP::RunSubscriberTask_, this, subscribers[i],
+                    this->segway_status_));
+    } else {
+      this->CallSubscriber_(subscriber, this->segway_status_);
     }
-    this->segway_status_ = SegwayStatus::Ptr(new SegwayStatus());
+  }
+  return published;
+}
+
+void
+SegwayRMP::CallSubscriber_(StatusSubscriber &subscriber,
+                           SegwayStatus::Ptr &ss)
+{
+  try {
+    subscriber.callback(ss);
+  } catch (std::exception &e) {
+    this->handle_exception_(e);
+  }
+}
+
+void
+SegwayRMP::RunSubscriberTask_(boost::shared_ptr<StatusSubscriber> subscriber,
+                              SegwayStatus::Ptr ss)
+{
+  this->CallSubscriber_(*subscriber, ss);
+  ss.reset();
+  boost::lock_guard<boost::mutex> lock(this->drain_mutex_);
+  this->pending_drains_--;
+  this->drain_condition_.notify_all();
+}
+
+void SegwayRMP::EnqueueStatus_() {
+  // Built once so that reporting errors doesn't allocate
+  static const std::string queue_full_msg("Falling behind, SegwayStatus "
+    "Queue Full, skipping packet report...");
+  switch (this->queue_policy_) {
+    case queue_drop_oldest:
+      if (this->ss_queue_->enqueueOverwriting(this->segway_status_)) {
+        increment(this->dropped_oldest_count_);
+        this->error_(queue_full_msg);
+      }
+      break;
+    case queue_coalesce:
+      // Replacing an undelivered status is the point, nothing to report
+      if (this->ss_queue_->enqueueOverwriting(this->segway_status_)) {
+        increment(this->dropped_oldest_count_);
+      }
+      break;
+    case queue_block:
+      if (this->ss_queue_->tryEnqueue(this->segway_status_)) {
+        break;
+      }
+      increment(this->blocked_count_);
+      if (this->spinning_manually_ && !this->callback_executor_) {
+        // The callbacks run on this thread, make room by running them
+        this->DeliverQueued_();
+        this->ss_queue_->tryEnqueue(this->segway_status_);
+        break;
+      }
+      if (this->callback_executor_) {
+        this->ScheduleDrain_();
+      }
+      if (!this->ss_queue_->enqueue(this->segway_status_)) {
+        // Canceled while waiting, shutting down
+        increment(this->dropped_newest_count_);
+      }
+      break;
+    case queue_drop_newest:
+    default:
+      if (!this->ss_queue_->tryEnqueue(this->segway_status_)) {
+        increment(this->dropped_newest_count_);
+        this->error_(queue_full_msg);
+      }
+      break;
+  }
+  size_t size = this->ss_queue_->size();
+  if (size > this->queue_high_water_mark_.load(boost::memory_order_relaxed)) {
+    this->queue_high_water_mark_.store(size, boost::memory_order_relaxed);
   }
 }
 
@@ -0,0 +1,216 @@
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+#include <segwayrmp/segwayrmp.h>
+#include <segwayrmp/impl/rmp_io.h>
+#include <segwayrmp/impl/spsc_ring.h>
+#include <segwayrmp/impl/wakeup_event.h>
+
+#if defined(__linux__)
+# include <pthread.h>
+# include <sched.h>
+# include <sys/epoll.h>
+# include <unistd.h>
+#endif
+
+using namespace segwayrmp;
+
+// The most events taken from epoll per wakeup
+static const int MAX_EVENTS = 64;
+
+/////////////////////////////////////////////////////////////////////////////
+// SegwayRMPFleet
+
+struct SegwayRMPFleet::EventLoop {
+  EventLoop() : epoll_fd(-1) {}
+  int epoll_fd;
+  // Set to stop the thread, it is in the epoll set too
+  WakeupEvent stop_event;
+  std::vector<SegwayRMP *> segway_rmps;
+  boost::thread thread;
+};
+
+#if defined(__linux__)
+
+inline std::string
+getErrorMessageByErrno(std::string what)
+{
+  std::stringstream msg;
+  msg << "Error while " << what << ": " << strerror(errno);
+  return msg.str();
+}
+
+SegwayRMPFleet::SegwayRMPFleet(size_t thread_count, bool pin_threads)
+: pin_threads_(pin_threads), running_(false)
+{
+  if (thread_count == 0) {
+    RMP_THROW_MSG(ConfigurationException, "A fleet needs at least one "
+      "thread.");
+  }
+  for (size_t i = 0; i < thread_count; ++i) {
+    this->loops_.push_back(new EventLoop());
+  }
+}
+
+SegwayRMPFleet::~SegwayRMPFleet() {
+  this->stop();
+  for (size_t i = 0; i < this->loops_.size(); ++i) {
+    delete this->loops_[i];
+  }
+}
+
+void SegwayRMPFleet::add(SegwayRMP &segway_rmp, bool reset_integrators) {
+  if (this->running_) {
+    RMP_THROW_MSG(ConfigurationException, "SegwayRMP's can only be added "
+      "to a stopped fleet.");
+  }
+  if (segway_rmp.interface_type_ == no_interface) {
+    RMP_THROW_MSG(ConfigurationException, "The SegwayRMP has no interface.");
+  }
+  segway_rmp.ConnectInterface_(reset_integrators);
+  if (segway_rmp.rmp_io_->getFileDescriptor() < 0) {
+    segway_rmp.rmp_io_->disconnect();
+    segway_rmp.connected_ = false;
+    RMP_THROW_MSG(ConfigurationException, "The interface of the SegwayRMP "
+      "has no file descriptor to wait on.");
+  }
+  // The event loop only reads what is already waiting
+  segway_rmp.rmp_io_->setReadTimeout(0);
+  this->segway_rmps_.push_back(&segway_rmp);
+}
+
+void SegwayRMPFleet::start() {
+  if (this->running_) {
+    return;
+  }
+  try {
+    for (size_t i = 0; i < this->loops_.size(); ++i) {
+      EventLoop *loop = this->loops_[i];
+      loop->segway_rmps.clear();
+      loop->stop_event.reset();
+      loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+      if (loop->epoll_fd < 0) {
+        RMP_THROW_MSG(ConfigurationException,
+          getErrorMessageByErrno("creating an epoll set").c_str());
+      }
+      struct epoll_event event;
+      memset(&event, 0, sizeof(event));
+      event.events = EPOLLIN;
+      event.data.ptr = NULL;
+      if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->stop_event.fd(),
+                    &event) != 0) {
+        RMP_THROW_MSG(ConfigurationException,
+          getErrorMessageByErrno("adding the stop event to the epoll "
+                                 "set").c_str());
+      }
+    }
+    // Spread the SegwayRMP's over the loops
+    for (size_t i = 0; i < this->segway_rmps_.size(); ++i) {
+      SegwayRMP *segway_rmp = this->segway_rmps_[i];
+      EventLoop *loop = this->loops_[i % this->loops_.size()];
+      struct epoll_event event;
+      memset(&event, 0, sizeof(event));
+      event.events = EPOLLIN;
+      event.data.ptr = segway_rmp;
+      if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD,
+                    segway_rmp->rmp_io_->getFileDescriptor(), &event) != 0) {
+        RMP_THROW_MSG(ConfigurationException,
+          getErrorMessageByErrno("adding to the epoll set").c_str());
+      }
+      segway_rmp->StartDelivering_();
+      loop->segway_rmps.push_back(segway_rmp);
+    }
+  } catch (std::exception &) {
+    // Leave nothing delivering or open behind
+    for (size_t i = 0; i < this->loops_.size(); ++i) {
+      EventLoop *loop = this->loops_[i];
+      for (size_t j = 0; j < loop->segway_rmps.size(); ++j) {
+        loop->segway_rmps[j]->StopDelivering_();
+      }
+      loop->segway_rmps.clear();
+      if (loop->epoll_fd >= 0) {
+        close(loop->epoll_fd);
+        loop->epoll_fd = -1;
+      }
+    }
+    throw;
+  }
+  this->running_ = true;
+  int cpus = (int)boost::thread::hardware_concurrency();
+  for (size_t i = 0; i < this->loops_.size(); ++i) {
+    EventLoop *loop = this->loops_[i];
+    loop->thread = boost::thread(&SegwayRMPFleet::Run_, this, loop);
+    if (this->pin_threads_ && cpus > 0) {
+      cpu_set_t cpu_set;
+      CPU_ZERO(&cpu_set);
+      CPU_SET((int)i % cpus, &cpu_set);
+      pthread_setaffinity_np(loop->thread.native_handle(),
+                             sizeof(cpu_set), &cpu_set);
+    }
+  }
+}
+
+void SegwayRMPFleet::stop() {
+  if (!this->running_) {
+    return;
+  }
+  for (size_t i = 0; i < this->loops_.size(); ++i) {
+    EventLoop *loop = this->loops_[i];
+    loop->stop_event.set();
+    loop->thread.join();
+    close(loop->epoll_fd);
+    loop->epoll_fd = -1;
+    for (size_t j = 0; j < loop->segway_rmps.size(); ++j) {
+      loop->segway_rmps[j]->StopDelivering_();
+    }
+  }
+  this->running_ = false;
+}
+
+void SegwayRMPFleet::Run_(EventLoop *loop) {
+  struct epoll_event events[MAX_EVENTS];
+  while (true) {
+    int count = epoll_wait(loop->epoll_fd, events, MAX_EVENTS, -1);
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+    for (int i = 0; i < count; ++i) {
+      SegwayRMP *segway_rmp = static_cast<SegwayRMP *>(events[i].data.ptr);
+      if (segway_rmp == NULL) {
+        return;
+      }
+      bool got_packets = false;
+      int status = segway_rmp->ReadBuffered_(got_packets);
+      if (status == packet_read_failed || status == packet_not_connected) {
+        // Already reported, stop listening rather than spin on a dead fd
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL,
+                  segway_rmp->rmp_io_->getFileDescriptor(), NULL);
+      }
+    }
+  }
+}
+
+#else
+
+SegwayRMPFleet::SegwayRMPFleet(size_t thread_count, bool pin_threads)
+: pin_threads_(pin_threads), running_(false)
+{
+  RMP_THROW_MSG(ConfigurationException, "SegwayRMPFleet is only supported "
+    "on Linux.");
+}
+
+SegwayRMPFleet::~SegwayRMPFleet() {}
+
+void SegwayRMPFleet::add(SegwayRMP &segway_rmp, bool reset_integrators) {}
+
+void SegwayRMPFleet::start() {}
+
+void SegwayRMPFleet::stop() {}
+
+void SegwayRMPFleet::Run_(EventLoop *loop) {}
+
+#endif
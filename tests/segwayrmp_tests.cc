@@ -1,13 +1,111 @@
 #include "gtest/gtest.h"
 
+#include <deque>
+#include <new>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <boost/bind.hpp>
+
 // OMG this is so nasty...
 #define private public
 #define protected public
 #include "segwayrmp/segwayrmp.h"
+#include "segwayrmp/impl/command_scheduler.h"
 #include "segwayrmp/impl/rmp_io.h"
+#include "segwayrmp/impl/rmp_x440.h"
+#include "segwayrmp/impl/seqlock.h"
+#include "segwayrmp/impl/spsc_ring.h"
+#include "segwayrmp/impl/status_pool.h"
+#if defined(SEGWAYRMP_USE_TERMIOS)
+# include "segwayrmp/impl/rmp_termios.h"
+#endif
+#if defined(SEGWAYRMP_USE_CAN)
+# include <net/if.h>
+# include "segwayrmp/impl/rmp_can.h"
+#endif
+#if defined(SEGWAYRMP_USE_ETHERNET)
+# include <arpa/inet.h>
+# include <netinet/in.h>
+# include "segwayrmp/impl/rmp_udp.h"
+#endif
 
 using namespace segwayrmp;
 
+// Counts the heap allocations made while counting_allocations is set
+static bool counting_allocations = false;
+static size_t allocation_count = 0;
+
+static void *
+countedNew(size_t size) {
+    if (counting_allocations) {
+        ++allocation_count;
+    }
+    return malloc(size == 0 ? 1 : size);
+}
+
+// Kept out of line, inlined into a delete expression gcc would see free()
+// on memory from operator new and warn about the mismatch
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+static void
+countedDelete(void *p) {
+    free(p);
+}
+
+// Every form is replaced, so that each new is paired with a matching delete
+void *operator new(size_t size) {
+    void *p = countedNew(size);
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new[](size_t size) {
+    void *p = countedNew(size);
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new(size_t size, const std::nothrow_t &) throw() {
+    return countedNew(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) throw() {
+    return countedNew(size);
+}
+
+void operator delete(void *p) throw() {
+    countedDelete(p);
+}
+
+void operator delete[](void *p) throw() {
+    countedDelete(p);
+}
+
+void operator delete(void *p, size_t) throw() {
+    countedDelete(p);
+}
+
+void operator delete[](void *p, size_t) throw() {
+    countedDelete(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) throw() {
+    countedDelete(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) throw() {
+    countedDelete(p);
+}
+
 namespace {
 
 class PacketTests : public ::testing::Test {
@@ -47,6 +145,22 @@ TEST_F(PacketTests, IgnoresCommandRequest) {
     ASSERT_FALSE(ss->touched);
 }
 
+SegwayTime fixedTimestamp() {
+    return SegwayTime(42, 0);
+}
+
+TEST_F(PacketTests, UsesKernelTimestampOfCommandRequest) {
+    pck.timestamp = SegwayTime(1234, 5678);
+    segway_rmp->ParsePacket_(pck, ss);
+    EXPECT_EQ(1234u, ss->timestamp.sec);
+    EXPECT_EQ(5678u, ss->timestamp.nsec);
+    
+    // A timestamp callback set by the user takes precedence
+    segway_rmp->setTimestampCallback(fixedTimestamp);
+    segway_rmp->ParsePacket_(pck, ss);
+    EXPECT_EQ(42u, ss->timestamp.sec);
+}
+
 TEST_F(PacketTests, ParsesPitchRollCorrectly) {
     pck.id = 0x0401;
     pck.data[0] = 0xFF;
@@ -164,6 +278,1953 @@ TEST_F(PacketTests, ParsesStatusesCorrectly) {
 
 // TODO: Add tests for motor enabled/disabled and commanded velocity and yaw rate
 
+// Serves a prerecorded byte stream to the framer in fixed size chunks.
+class FakeRMPIO : public RMPIO {
+public:
+    FakeRMPIO() : position(0), chunk_size(64), reads(0), writes(0) {
+        this->connected = true;
+    }
+    
+    void connect() {}
+    void disconnect() {}
+    
+    int read(unsigned char* buffer, int size) {
+        this->reads += 1;
+        int length = std::min(size, this->chunk_size);
+        length = std::min(length, (int)(this->stream.size() - this->position));
+        if (length > 0)
+            memcpy(buffer, &this->stream[this->position], length);
+        this->position += length;
+        return length;
+    }
+    
+    int write(unsigned char* buffer, int size) {
+        this->writes += 1;
+        this->written.insert(this->written.end(), buffer, buffer + size);
+        return size;
+    }
+    
+    void appendPacket(unsigned short id, unsigned char channel,
+                      unsigned char first_data_byte)
+    {
+        unsigned char usb_packet[18] = {0xF0, 0x55, channel, 0x00,
+                                        (unsigned char)(id >> 3),
+                                        (unsigned char)((id & 7) << 5),
+                                        0x00, 0x00, 0x08, first_data_byte,
+                                        0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                                        0x00, 0x00};
+        usb_packet[17] = this->computeChecksum(usb_packet);
+        this->stream.insert(this->stream.end(), usb_packet, usb_packet + 18);
+    }
+    
+    std::vector<unsigned char> stream;
+    std::vector<unsigned char> written;
+    size_t position;
+    int chunk_size;
+    int reads;
+    int writes;
+};
+
+class FramerTests : public ::testing::Test {
+protected:
+    FakeRMPIO rmp_io;
+    Packet pck;
+};
+
+TEST_F(FramerTests, DecodesBackToBackPackets) {
+    for (int i = 0; i < 8; ++i)
+        rmp_io.appendPacket(0x0400 + i, 0xAA, i);
+    
+    for (int i = 0; i < 8; ++i) {
+        rmp_io.getPacket(pck);
+        EXPECT_EQ(0x0400 + i, pck.id);
+        EXPECT_EQ(0xAA, pck.channel);
+        EXPECT_EQ(i, pck.data[0]);
+    }
+}
+
+TEST_F(FramerTests, SkipsGarbageBeforeHeader) {
+    unsigned char garbage[] = {0x00, 0xF0, 0x12, 0xF0, 0x55, 0x01, 0xF0};
+    rmp_io.stream.insert(rmp_io.stream.end(), garbage, garbage + 7);
+    rmp_io.appendPacket(0x0401, 0xBB, 0x42);
+    
+    rmp_io.getPacket(pck);
+    EXPECT_EQ(0x0401, pck.id);
+    EXPECT_EQ(0xBB, pck.channel);
+    EXPECT_EQ(0x42, pck.data[0]);
+    EXPECT_EQ(7u, rmp_io.getStatistics().skipped_bytes);
+}
+
+TEST_F(FramerTests, ResyncsAfterLongNoise) {
+    rmp_io.chunk_size = 61;
+    for (int i = 0; i < 1000; ++i)
+        rmp_io.stream.push_back((unsigned char)(i % 0xF0));
+    rmp_io.appendPacket(0x0405, 0xAA, 0x07);
+    
+    rmp_io.getPacket(pck);
+    EXPECT_EQ(0x0405, pck.id);
+    EXPECT_EQ(0x07, pck.data[0]);
+    EXPECT_EQ(1000u, rmp_io.getStatistics().skipped_bytes);
+}
+
+TEST_F(FramerTests, DecodesAcrossBufferWrapAround) {
+    // Odd sized reads and noise make packets straddle the end of the ring
+    rmp_io.chunk_size = 7;
+    for (int i = 0; i < 100; ++i) {
+        rmp_io.stream.push_back(0x00);
+        rmp_io.appendPacket(0x0400 + (i % 8), 0xAA, i);
+    }
+    
+    for (int i = 0; i < 100; ++i) {
+        rmp_io.getPacket(pck);
+        EXPECT_EQ(0x0400 + (i % 8), pck.id);
+        EXPECT_EQ(i, pck.data[0]);
+    }
+}
+
+TEST_F(FramerTests, GetsAllBufferedPacketsWithOneRead) {
+    rmp_io.chunk_size = 256;
+    for (int i = 0; i < 8; ++i)
+        rmp_io.appendPacket(0x0400 + i, 0xAA, i);
+    
+    Packet packets[16];
+    ASSERT_EQ(8u, rmp_io.getPackets(packets, 16));
+    EXPECT_EQ(1, rmp_io.reads);
+    for (int i = 0; i < 8; ++i) {
+        EXPECT_EQ(0x0400 + i, packets[i].id);
+        EXPECT_EQ(i, packets[i].data[0]);
+    }
+}
+
+TEST_F(FramerTests, GetPacketsStopsAtMax) {
+    rmp_io.chunk_size = 256;
+    for (int i = 0; i < 8; ++i)
+        rmp_io.appendPacket(0x0400 + i, 0xAA, i);
+    
+    Packet packets[5];
+    ASSERT_EQ(5u, rmp_io.getPackets(packets, 5));
+    ASSERT_EQ(3u, rmp_io.getPackets(packets, 5));
+    EXPECT_EQ(1, rmp_io.reads);
+    EXPECT_EQ(0x0407, packets[2].id);
+}
+
+TEST_F(FramerTests, GetPacketsReturnsGoodPacketsBeforeChecksumMismatch) {
+    rmp_io.chunk_size = 256;
+    rmp_io.appendPacket(0x0400, 0xAA, 0x00);
+    rmp_io.appendPacket(0x0401, 0xAA, 0x00);
+    rmp_io.stream[35] ^= 0xFF;
+    rmp_io.appendPacket(0x0402, 0xAA, 0x00);
+    
+    Packet packets[16];
+    ASSERT_EQ(1u, rmp_io.getPackets(packets, 16));
+    EXPECT_EQ(0x0400, packets[0].id);
+    try {
+        rmp_io.getPackets(packets, 16);
+        FAIL() << "Expected a PacketRetrievalException";
+    } catch (PacketRetrievalException &e) {
+        EXPECT_EQ(2, e.error_number());
+    }
+    ASSERT_EQ(1u, rmp_io.getPackets(packets, 16));
+    EXPECT_EQ(0x0402, packets[0].id);
+}
+
+TEST_F(FramerTests, RecoversPacketStartingInsideCorruptPacket) {
+    // A spurious header whose 18 bytes run into the real packet
+    unsigned char spurious[] = {0xF0, 0x55, 0xAA, 0x00, 0x80};
+    rmp_io.stream.insert(rmp_io.stream.end(), spurious, spurious + 5);
+    rmp_io.appendPacket(0x0403, 0xAA, 0x33);
+    rmp_io.appendPacket(0x0404, 0xAA, 0x44);
+    
+    Packet packets[16];
+    size_t count = 0;
+    EXPECT_EQ(packet_checksum_mismatch,
+              rmp_io.tryGetPackets(packets, 16, count));
+    ASSERT_EQ(packet_ok, rmp_io.tryGetPackets(packets, 16, count));
+    ASSERT_EQ(2u, count);
+    EXPECT_EQ(0x0403, packets[0].id);
+    EXPECT_EQ(0x33, packets[0].data[0]);
+    EXPECT_EQ(0x0404, packets[1].id);
+    
+    PacketStatistics statistics = rmp_io.getStatistics();
+    EXPECT_EQ(1u, statistics.checksum_mismatches);
+    EXPECT_EQ(1u, statistics.recovered_packets);
+    EXPECT_EQ(4u, statistics.skipped_bytes);
+}
+
+TEST_F(FramerTests, ThrowsOnChecksumMismatch) {
+    rmp_io.appendPacket(0x0402, 0xAA, 0x00);
+    rmp_io.stream[17] ^= 0xFF;
+    
+    try {
+        rmp_io.getPacket(pck);
+        FAIL() << "Expected a PacketRetrievalException";
+    } catch (PacketRetrievalException &e) {
+        EXPECT_EQ(2, e.error_number());
+    }
+}
+
+TEST_F(FramerTests, ThrowsWhenNoDataReceived) {
+    rmp_io.appendPacket(0x0402, 0xAA, 0x00);
+    rmp_io.stream.resize(10);
+    
+    try {
+        rmp_io.getPacket(pck);
+        FAIL() << "Expected a PacketRetrievalException";
+    } catch (PacketRetrievalException &e) {
+        EXPECT_EQ(3, e.error_number());
+    }
+}
+
+// Byte at a time reference for findPacketHeader
+size_t referenceFindPacketHeader(const unsigned char *data, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        if (data[i] != 0xF0)
+            continue;
+        if (i + 1 == length)
+            return i;
+        if (data[i + 1] != 0x55)
+            continue;
+        if (i + 2 == length || data[i + 2] == 0xAA || data[i + 2] == 0xBB)
+            return i;
+    }
+    return length;
+}
+
+TEST(PacketHeaderTests, MatchesReferenceOnRandomData) {
+    // Only use header bytes so that candidates are dense
+    const unsigned char alphabet[] = {0xF0, 0x55, 0xAA, 0xBB, 0x00};
+    unsigned int seed = 42;
+    std::vector<unsigned char> data(300);
+    for (int trial = 0; trial < 2000; ++trial) {
+        for (size_t i = 0; i < data.size(); ++i) {
+            seed = seed * 1103515245 + 12345;
+            data[i] = alphabet[(seed >> 16) % 5];
+        }
+        size_t length = (seed >> 8) % data.size();
+        ASSERT_EQ(referenceFindPacketHeader(&data[0], length),
+                  findPacketHeader(&data[0], length)) << "trial " << trial;
+    }
+}
+
+TEST(PacketHeaderTests, ReportsPartialHeaderAtTheEnd) {
+    std::vector<unsigned char> data(100, 0x00);
+    EXPECT_EQ(100u, findPacketHeader(&data[0], data.size()));
+    data[98] = 0xF0;
+    data[99] = 0x55;
+    EXPECT_EQ(98u, findPacketHeader(&data[0], data.size()));
+    data[99] = 0x00;
+    EXPECT_EQ(100u, findPacketHeader(&data[0], data.size()));
+    data[40] = 0xF0;
+    data[41] = 0x55;
+    data[42] = 0xBB;
+    EXPECT_EQ(40u, findPacketHeader(&data[0], data.size()));
+}
+
+TEST_F(FramerTests, TryGetPacketsReportsStatusesAndCounts) {
+    rmp_io.appendPacket(0x0400, 0xAA, 0x00);
+    rmp_io.appendPacket(0x0401, 0xAA, 0x00);
+    rmp_io.stream[35] ^= 0xFF;
+    
+    Packet packets[16];
+    size_t count = 0;
+    EXPECT_EQ(packet_ok, rmp_io.tryGetPackets(packets, 16, count));
+    EXPECT_EQ(1u, count);
+    EXPECT_EQ(packet_checksum_mismatch,
+              rmp_io.tryGetPackets(packets, 16, count));
+    EXPECT_EQ(0u, count);
+    EXPECT_EQ(packet_no_data, rmp_io.tryGetPackets(packets, 16, count));
+    rmp_io.cancel();
+    EXPECT_EQ(packet_canceled, rmp_io.tryGetPackets(packets, 16, count));
+    
+    PacketStatistics statistics = rmp_io.getStatistics();
+    EXPECT_EQ(1u, statistics.packets);
+    EXPECT_EQ(1u, statistics.checksum_mismatches);
+    EXPECT_EQ(1u, statistics.timeouts);
+    EXPECT_EQ(0u, statistics.read_failures);
+}
+
+class FailingRMPIO : public FakeRMPIO {
+public:
+    int read(unsigned char*, int) {
+        RMP_THROW_MSG(ReadFailedException, "cable unplugged");
+    }
+};
+
+TEST_F(FramerTests, SendsPacketsWithOneWrite) {
+    Packet packets[20];
+    for (int i = 0; i < 20; ++i) {
+        packets[i].id = 0x0413;
+        packets[i].data[7] = (unsigned char)i;
+    }
+    rmp_io.sendPackets(packets, 20);
+    // Only as many frames as fit the encode buffer share a write
+    EXPECT_EQ(2, rmp_io.writes);
+    ASSERT_EQ(20u * 18, rmp_io.written.size());
+    for (int i = 0; i < 20; ++i) {
+        unsigned char *usb_packet = &rmp_io.written[i * 18];
+        EXPECT_EQ(0x13, usb_packet[7]);
+        EXPECT_EQ(i, usb_packet[16]);
+        EXPECT_EQ(rmp_io.computeChecksum(usb_packet), usb_packet[17]);
+    }
+}
+
+TEST_F(FramerTests, EncodesTheSameChecksumAsTheFramerChecks) {
+    unsigned int seed = 7;
+    for (int trial = 0; trial < 2000; ++trial) {
+        Packet packet;
+        seed = seed * 1103515245 + 12345;
+        packet.id = (unsigned short)(seed >> 8);
+        packet.channel = (unsigned char)(seed >> 24);
+        for (int i = 0; i < 8; ++i) {
+            seed = seed * 1103515245 + 12345;
+            packet.data[i] = (unsigned char)(seed >> 16);
+        }
+        unsigned char usb_packet[18];
+        rmp_io.encodePacket(packet, usb_packet);
+        ASSERT_EQ(rmp_io.computeChecksum(usb_packet), usb_packet[17])
+            << "trial " << trial;
+        EXPECT_EQ(0, memcmp(packet.data, usb_packet + 9, 8));
+    }
+}
+
+TEST_F(FramerTests, EncodesMovesFromTheMoveTemplate) {
+    unsigned int seed = 11;
+    for (int trial = 0; trial < 2000; ++trial) {
+        Packet packet;
+        packet.id = 0x0413;
+        for (int i = 0; i < 4; ++i) {
+            seed = seed * 1103515245 + 12345;
+            packet.data[i] = (unsigned char)(seed >> 16);
+        }
+        unsigned char usb_packet[18];
+        rmp_io.encodePacket(packet, usb_packet);
+        EXPECT_EQ(0xF0, usb_packet[0]);
+        EXPECT_EQ(0x55, usb_packet[1]);
+        EXPECT_EQ(0x00, usb_packet[2]);
+        EXPECT_EQ(0x04, usb_packet[6]);
+        EXPECT_EQ(0x13, usb_packet[7]);
+        EXPECT_EQ(0, memcmp(packet.data, usb_packet + 9, 8));
+        ASSERT_EQ(rmp_io.computeChecksum(usb_packet), usb_packet[17])
+            << "trial " << trial;
+    }
+}
+
+TEST(FailingFramerTests, ReportsReadFailuresWithoutThrowing) {
+    FailingRMPIO rmp_io;
+    Packet packets[16];
+    size_t count = 0;
+    EXPECT_EQ(packet_read_failed, rmp_io.tryGetPackets(packets, 16, count));
+    EXPECT_TRUE(std::string(rmp_io.getReadError()).find("cable unplugged")
+                != std::string::npos);
+    EXPECT_EQ(1u, rmp_io.getStatistics().read_failures);
+    EXPECT_THROW(rmp_io.getPackets(packets, 16), ReadFailedException);
+}
+
+TEST(RingBufferTests, CopiesAcrossTheEnd) {
+    RingBuffer ring;
+    unsigned char *region;
+    // Move the head and tail near the end of the storage
+    ring.commit(ring.writeRegion(region) - 4);
+    ring.consume(ring.size());
+    
+    size_t length = ring.writeRegion(region);
+    ASSERT_EQ(4u, length);
+    memcpy(region, "\x01\x02\x03\x04", 4);
+    ring.commit(4);
+    length = ring.writeRegion(region);
+    memcpy(region, "\x05\x06", 2);
+    ring.commit(2);
+    
+    unsigned char out[6];
+    ring.copy(out, 6);
+    for (int i = 0; i < 6; ++i)
+        EXPECT_EQ(i + 1, out[i]);
+    EXPECT_EQ(0x05, ring[4]);
+    ring.consume(6);
+    EXPECT_EQ(0u, ring.size());
+}
+
+// Reads from a pipe the way the poll based interfaces do
+class PipeRMPIO : public RMPIO {
+public:
+    PipeRMPIO() {
+        int fds[2];
+        if (pipe(fds) == 0) {
+            read_fd = fds[0];
+            write_fd = fds[1];
+        }
+        this->connected = true;
+    }
+    ~PipeRMPIO() {
+        close(read_fd);
+        close(write_fd);
+    }
+    void connect() {}
+    void disconnect() {}
+    int read(unsigned char* buffer, int size) {
+        if (waitReadable(read_fd, cancel_event, 1000) <= 0)
+            return 0;
+        return ::read(read_fd, buffer, size);
+    }
+    int write(unsigned char*, int size) {return size;}
+    int read_fd;
+    int write_fd;
+};
+
+void getPacketsUntilCanceled(PipeRMPIO *rmp_io, PacketStatus *status) {
+    Packet packets[16];
+    size_t count = 0;
+    do {
+        *status = rmp_io->tryGetPackets(packets, 16, count);
+    } while (*status == packet_no_data);
+}
+
+long millisecondsSince(boost::posix_time::ptime start) {
+    return (boost::posix_time::microsec_clock::universal_time() - start)
+           .total_milliseconds();
+}
+
+TEST(CancelTests, CancelInterruptsBlockedRead) {
+    PipeRMPIO rmp_io;
+    PacketStatus status = packet_ok;
+    boost::thread reader(getPacketsUntilCanceled, &rmp_io, &status);
+    // Give the reader time to block in poll
+    boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+    boost::posix_time::ptime start =
+        boost::posix_time::microsec_clock::universal_time();
+    rmp_io.cancel();
+    reader.join();
+    // The read timeout is a second, cancel must not wait it out
+    EXPECT_LT(millisecondsSince(start), 100);
+    EXPECT_EQ(packet_canceled, status);
+}
+
+TEST(CancelTests, StopsReadingContinuouslyPromptly) {
+    PipeRMPIO rmp_io;
+    SegwayRMP rmp(no_interface);
+    rmp.rmp_io_ = &rmp_io;
+    rmp.StartReadingContinuously_();
+    boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+    boost::posix_time::ptime start =
+        boost::posix_time::microsec_clock::universal_time();
+    rmp.StopReadingContinuously_();
+    long stop_latency = millisecondsSince(start);
+    EXPECT_LT(stop_latency, 100);
+    RecordProperty("stop_latency_ms", (int)stop_latency);
+}
+
+TEST(SPSCRingTests, KeepsOrderAcrossTheEnd) {
+    SPSCRing<int> ring(3);
+    EXPECT_EQ(3u, ring.capacity());
+    int value = 0;
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_TRUE(ring.tryEnqueue(i));
+        ASSERT_TRUE(ring.tryEnqueue(i + 100));
+        ASSERT_TRUE(ring.tryDequeue(value));
+        EXPECT_EQ(i, value);
+        ASSERT_TRUE(ring.tryDequeue(value));
+        EXPECT_EQ(i + 100, value);
+    }
+    EXPECT_FALSE(ring.tryDequeue(value));
+}
+
+TEST(SPSCRingTests, RefusesWhenFull) {
+    SPSCRing<int> ring(4);
+    for (int i = 0; i < 4; ++i) {
+        ASSERT_TRUE(ring.tryEnqueue(i));
+    }
+    EXPECT_FALSE(ring.tryEnqueue(4));
+    EXPECT_EQ(4u, ring.size());
+    int value;
+    ASSERT_TRUE(ring.tryDequeue(value));
+    EXPECT_EQ(0, value);
+    EXPECT_TRUE(ring.tryEnqueue(4));
+}
+
+TEST(SPSCRingTests, ReleasesDequeuedElements) {
+    SPSCRing<SegwayStatus::Ptr> ring(4);
+    SegwayStatus::Ptr status(new SegwayStatus());
+    ring.tryEnqueue(status);
+    SegwayStatus::Ptr dequeued;
+    ring.tryDequeue(dequeued);
+    EXPECT_EQ(status, dequeued);
+    EXPECT_EQ(2, status.use_count());
+}
+
+void
+dequeueInto(SPSCRing<int> *ring, std::vector<int> *values, size_t count) {
+    int value;
+    while (values->size() < count && ring->dequeue(value)) {
+        values->push_back(value);
+    }
+}
+
+TEST(SPSCRingTests, WakesBlockedConsumer) {
+    SPSCRing<int> ring(16);
+    std::vector<int> values;
+    boost::thread consumer(dequeueInto, &ring, &values, 1000);
+    for (int i = 0; i < 1000; ++i) {
+        while (!ring.tryEnqueue(i)) {
+            boost::this_thread::yield();
+        }
+        if (i % 100 == 0) {
+            // Let the consumer fall asleep now and then
+            boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+        }
+    }
+    consumer.join();
+    ASSERT_EQ(1000u, values.size());
+    for (int i = 0; i < 1000; ++i) {
+        ASSERT_EQ(i, values[i]);
+    }
+}
+
+TEST(SPSCRingTests, CancelWakesBlockedConsumer) {
+    SPSCRing<int> ring(16);
+    std::vector<int> values;
+    boost::thread consumer(dequeueInto, &ring, &values, 1);
+    boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+    boost::posix_time::ptime start =
+        boost::posix_time::microsec_clock::universal_time();
+    ring.cancel();
+    consumer.join();
+    EXPECT_LT(millisecondsSince(start), 100);
+    EXPECT_TRUE(values.empty());
+}
+
+TEST(SPSCRingTests, OverwritingDropsTheOldest) {
+    SPSCRing<int> ring(3, true);
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_FALSE(ring.enqueueOverwriting(i));
+    }
+    EXPECT_TRUE(ring.enqueueOverwriting(3));
+    EXPECT_TRUE(ring.enqueueOverwriting(4));
+    EXPECT_EQ(3u, ring.size());
+    int value;
+    for (int i = 2; i < 5; ++i) {
+        ASSERT_TRUE(ring.tryDequeue(value));
+        EXPECT_EQ(i, value);
+    }
+    EXPECT_FALSE(ring.tryDequeue(value));
+}
+
+void
+enqueueAll(SPSCRing<int> *ring, int count, bool *all_enqueued) {
+    *all_enqueued = true;
+    for (int i = 0; i < count; ++i) {
+        *all_enqueued = ring->enqueue(i) && *all_enqueued;
+    }
+}
+
+TEST(SPSCRingTests, WakesBlockedProducer) {
+    SPSCRing<int> ring(2);
+    bool all_enqueued = false;
+    boost::thread producer(enqueueAll, &ring, 1000, &all_enqueued);
+    int value;
+    for (int i = 0; i < 1000; ++i) {
+        while (!ring.tryDequeue(value)) {
+            boost::this_thread::yield();
+        }
+        ASSERT_EQ(i, value);
+        if (i % 100 == 0) {
+            // Let the producer fall asleep now and then
+            boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+        }
+    }
+    producer.join();
+    EXPECT_TRUE(all_enqueued);
+}
+
+TEST(SPSCRingTests, CancelWakesBlockedProducer) {
+    SPSCRing<int> ring(1);
+    bool all_enqueued = true;
+    boost::thread producer(enqueueAll, &ring, 2, &all_enqueued);
+    boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+    boost::posix_time::ptime start =
+        boost::posix_time::microsec_clock::universal_time();
+    ring.cancel();
+    producer.join();
+    EXPECT_LT(millisecondsSince(start), 100);
+    EXPECT_FALSE(all_enqueued);
+}
+
+void
+ignoreMessage(const std::string &) {
+}
+
+void
+sendCycleWithPitch(SegwayRMP &rmp, unsigned char pitch_counts) {
+    Packet packet;
+    packet.channel = 0xAA;
+    memset(packet.data, 0, 8);
+    packet.id = 0x0401;
+    packet.data[1] = pitch_counts;
+    rmp.ProcessPacket_(packet);
+    packet.id = 0x0407;
+    rmp.ProcessPacket_(packet);
+}
+
+TEST(StatusQueueTests, DropNewestKeepsTheQueuedStatuses) {
+    SegwayRMP rmp(no_interface);
+    rmp.setLogMsgCallback("error", ignoreMessage);
+    rmp.setStatusQueue(2, queue_drop_newest);
+    for (int i = 1; i <= 5; ++i) {
+        sendCycleWithPitch(rmp, (unsigned char)(39 * i));
+    }
+    StatusQueueStatistics statistics = rmp.getStatusQueueStatistics();
+    EXPECT_EQ(3u, statistics.dropped_newest);
+    EXPECT_EQ(0u, statistics.dropped_oldest);
+    EXPECT_EQ(2u, statistics.high_water_mark);
+    SegwayStatus::Ptr ss;
+    ASSERT_TRUE(rmp.ss_queue_->tryDequeue(ss));
+    EXPECT_FLOAT_EQ(5.0f, ss->pitch);
+}
+
+TEST(StatusQueueTests, DropOldestKeepsTheNewestStatuses) {
+    SegwayRMP rmp(no_interface);
+    rmp.setLogMsgCallback("error", ignoreMessage);
+    rmp.setStatusQueue(2, queue_drop_oldest);
+    for (int i = 1; i <= 5; ++i) {
+        sendCycleWithPitch(rmp, (unsigned char)(39 * i));
+    }
+    EXPECT_EQ(3u, rmp.getStatusQueueStatistics().dropped_oldest);
+    SegwayStatus::Ptr ss;
+    ASSERT_TRUE(rmp.ss_queue_->tryDequeue(ss));
+    EXPECT_FLOAT_EQ(20.0f, ss->pitch);
+    ASSERT_TRUE(rmp.ss_queue_->tryDequeue(ss));
+    EXPECT_FLOAT_EQ(25.0f, ss->pitch);
+}
+
+TEST(StatusQueueTests, DefaultKeepsTheNewestStatuses) {
+    SegwayRMP rmp(no_interface);
+    rmp.setLogMsgCallback("error", ignoreMessage);
+    for (int i = 1; i <= MAX_SEGWAYSTATUS_QUEUE_SIZE + 3; ++i) {
+        sendCycleWithPitch(rmp, (unsigned char)i);
+    }
+    StatusQueueStatistics statistics = rmp.getStatusQueueStatistics();
+    EXPECT_EQ(3u, statistics.dropped_oldest);
+    EXPECT_EQ(0u, statistics.dropped_newest);
+    SegwayStatus::Ptr ss;
+    ASSERT_TRUE(rmp.ss_queue_->tryDequeue(ss));
+    EXPECT_NEAR(4 / 7.8, ss->pitch, 1e-4);
+    while (rmp.ss_queue_->tryDequeue(ss)) {}
+    EXPECT_NEAR((MAX_SEGWAYSTATUS_QUEUE_SIZE + 3) / 7.8, ss->pitch, 1e-4);
+}
+
+TEST(StatusQueueTests, CoalesceKeepsOnlyTheLatest) {
+    SegwayRMP rmp(no_interface);
+    rmp.setStatusQueue(100, queue_coalesce);
+    for (int i = 1; i <= 3; ++i) {
+        sendCycleWithPitch(rmp, (unsigned char)(39 * i));
+    }
+    StatusQueueStatistics statistics = rmp.getStatusQueueStatistics();
+    EXPECT_EQ(2u, statistics.dropped_oldest);
+    EXPECT_EQ(1u, statistics.high_water_mark);
+    EXPECT_EQ(1u, rmp.ss_queue_->size());
+    SegwayStatus::Ptr ss;
+    ASSERT_TRUE(rmp.ss_queue_->tryDequeue(ss));
+    EXPECT_FLOAT_EQ(15.0f, ss->pitch);
+}
+
+TEST(StatusQueueTests, RejectsAnEmptyQueue) {
+    SegwayRMP rmp(no_interface);
+    EXPECT_THROW(rmp.setStatusQueue(0, queue_block), ConfigurationException);
+}
+
+TEST(StatusPoolTests, RecyclesReleasedStatuses) {
+    boost::shared_ptr<StatusPool> pool(new StatusPool(2));
+    SegwayStatus *first;
+    {
+        SegwayStatus::Ptr status = pool->acquire();
+        first = status.get();
+        status->pitch = 1.0f;
+        EXPECT_EQ(1u, pool->getAvailable());
+    }
+    EXPECT_EQ(2u, pool->getAvailable());
+    SegwayStatus::Ptr status = pool->acquire();
+    EXPECT_EQ(first, status.get());
+    EXPECT_FLOAT_EQ(0.0f, status->pitch);
+}
+
+TEST(StatusPoolTests, AllocatesWhenEmpty) {
+    boost::shared_ptr<StatusPool> pool(new StatusPool(1));
+    SegwayStatus::Ptr first = pool->acquire();
+    SegwayStatus::Ptr second = pool->acquire();
+    ASSERT_TRUE(second);
+    EXPECT_EQ(1u, pool->getMissCount());
+    second.reset();
+    EXPECT_EQ(0u, pool->getAvailable());
+}
+
+TEST(StatusPoolTests, StatusesOutliveThePool) {
+    boost::shared_ptr<StatusPool> pool(new StatusPool(4));
+    SegwayStatus::Ptr status = pool->acquire();
+    boost::weak_ptr<StatusPool> weak_pool = pool;
+    pool.reset();
+    EXPECT_FALSE(weak_pool.expired());
+    status->roll = 2.0f;
+    status.reset();
+    EXPECT_TRUE(weak_pool.expired());
+}
+
+TEST(StatusPoolTests, SteadyStateDoesNotAllocate) {
+    SegwayRMP rmp(no_interface);
+    Packet cycle[8];
+    for (int i = 0; i < 8; ++i) {
+        cycle[i].id = 0x0400 + i;
+        cycle[i].channel = 0xAA;
+    }
+    SegwayStatus::Ptr status;
+    size_t delivered = 0;
+    for (int round = 0; round < 1010; ++round) {
+        // Warm up for a few cycles, then count
+        if (round == 10) {
+            allocation_count = 0;
+            counting_allocations = true;
+        }
+        for (int i = 0; i < 8; ++i) {
+            rmp.ProcessPacket_(cycle[i]);
+        }
+        // Play the callback thread
+        while (rmp.ss_queue_->tryDequeue(status)) {
+            status.reset();
+            ++delivered;
+        }
+    }
+    counting_allocations = false;
+    EXPECT_EQ(1010u, delivered);
+    EXPECT_EQ(0u, allocation_count);
+    EXPECT_EQ(0u, rmp.status_pool_->getMissCount());
+}
+
+TEST(SeqLockTests, PublishesTheLatestValue) {
+    SeqLock<SegwayStatus> latest;
+    SegwayStatus status;
+    EXPECT_FALSE(latest.load(status));
+    status.pitch = 1.0f;
+    latest.store(status);
+    status.pitch = 2.0f;
+    latest.store(status);
+    SegwayStatus loaded;
+    ASSERT_TRUE(latest.load(loaded));
+    EXPECT_FLOAT_EQ(2.0f, loaded.pitch);
+}
+
+void
+storeStatuses(SeqLock<SegwayStatus> *latest, int count) {
+    SegwayStatus status;
+    for (int i = 1; i <= count; ++i) {
+        status.pitch = status.roll = status.yaw_rate = (float)i;
+        status.servo_frames = (float)i;
+        latest->store(status);
+    }
+}
+
+TEST(SeqLockTests, ReadersNeverSeeTornValues) {
+    SeqLock<SegwayStatus> latest;
+    boost::thread writer(storeStatuses, &latest, 200000);
+    SegwayStatus status;
+    float last = 0.0f;
+    int loads = 0;
+    while (last < 200000.0f) {
+        if (!latest.load(status)) {
+            continue;
+        }
+        ASSERT_EQ(status.pitch, status.roll);
+        ASSERT_EQ(status.pitch, status.yaw_rate);
+        ASSERT_EQ(status.pitch, status.servo_frames);
+        ASSERT_GE(status.pitch, last);
+        last = status.pitch;
+        ++loads;
+    }
+    writer.join();
+    EXPECT_GT(loads, 0);
+}
+
+TEST(StatusDeliveryTests, PollingSkipsTheQueue) {
+    SegwayRMP rmp(no_interface);
+    rmp.setStatusDeliveryMode(status_polling);
+    SegwayStatus status;
+    EXPECT_FALSE(rmp.getLatestStatus(status));
+    Packet packet;
+    packet.channel = 0xAA;
+    packet.id = 0x0401;
+    packet.data[0] = 0x00;
+    packet.data[1] = 0x4E; // 78 counts, 10 degrees
+    rmp.ProcessPacket_(packet);
+    packet.id = 0x0407;
+    rmp.ProcessPacket_(packet);
+    ASSERT_TRUE(rmp.getLatestStatus(status));
+    EXPECT_FLOAT_EQ(10.0f, status.pitch);
+    EXPECT_TRUE(rmp.ss_queue_->empty());
+    // The next cycle starts from scratch
+    rmp.ProcessPacket_(packet);
+    ASSERT_TRUE(rmp.getLatestStatus(status));
+    EXPECT_FLOAT_EQ(0.0f, status.pitch);
+}
+
+void
+keepStatus(SegwayStatus::Ptr *kept, SegwayStatus::Ptr status) {
+    *kept = status;
+}
+
+TEST(StatusDeliveryTests, InlineCallsTheCallbackDirectly) {
+    SegwayRMP rmp(no_interface, rmp200, status_inline);
+    SegwayStatus::Ptr kept;
+    rmp.setStatusCallback(boost::bind(keepStatus, &kept, _1));
+    Packet packet;
+    packet.channel = 0xAA;
+    packet.id = 0x0407;
+    rmp.ProcessPacket_(packet);
+    ASSERT_TRUE(kept);
+    EXPECT_TRUE(kept->touched);
+    EXPECT_TRUE(rmp.ss_queue_->empty());
+    // The callback's status is not reused for the next cycle
+    EXPECT_NE(kept, rmp.segway_status_);
+}
+
+// Runs posted tasks on a few threads, in no particular order
+class PoolExecutor : public CallbackExecutor {
+public:
+    explicit PoolExecutor(int threads) : stopped(false), posted(0) {
+        for (int i = 0; i < threads; ++i) {
+            workers.create_thread(boost::bind(&PoolExecutor::work, this));
+        }
+    }
+    ~PoolExecutor() {
+        {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            stopped = true;
+        }
+        condition.notify_all();
+        workers.join_all();
+    }
+    void post(const boost::function<void()> &task) {
+        {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            tasks.push_back(task);
+            ++posted;
+        }
+        condition.notify_one();
+    }
+    void work() {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (true) {
+            while (tasks.empty() && !stopped) {
+                condition.wait(lock);
+            }
+            if (tasks.empty()) {
+                return;
+            }
+            boost::function<void()> task = tasks.front();
+            tasks.pop_front();
+            lock.unlock();
+            task();
+            lock.lock();
+        }
+    }
+    boost::mutex mutex;
+    boost::condition_variable condition;
+    std::deque<boost::function<void()> > tasks;
+    boost::thread_group workers;
+    bool stopped;
+    size_t posted;
+};
+
+// Checks that one SegwayRMP's callbacks come in order and one at a time
+struct OrderChecker {
+    OrderChecker() : last(-1), calls(0), inside(false), overlapped(false),
+                     out_of_order(false) {}
+    void check(SegwayStatus::Ptr status) {
+        if (inside.exchange(true)) {
+            overlapped = true;
+        }
+        int frame = (int)(status->servo_frames * 100.0f + 0.5f);
+        if (frame != last + 1) {
+            out_of_order = true;
+        }
+        last = frame;
+        boost::this_thread::yield();
+        ++calls;
+        inside = false;
+    }
+    int last;
+    boost::atomic<int> calls;
+    boost::atomic<bool> inside;
+    bool overlapped;
+    bool out_of_order;
+};
+
+void
+sendCycles(SegwayRMP *rmp, int cycles) {
+    Packet packet;
+    packet.channel = 0xAA;
+    for (int i = 0; i < cycles; ++i) {
+        packet.id = 0x0402;
+        packet.data[6] = (unsigned char)(i >> 8);
+        packet.data[7] = (unsigned char)(i & 0xFF);
+        rmp->ProcessPacket_(packet);
+        packet.id = 0x0407;
+        rmp->ProcessPacket_(packet);
+    }
+}
+
+TEST(CallbackExecutorTests, DeliversInOrderOnASharedPool) {
+    boost::shared_ptr<PoolExecutor> pool(new PoolExecutor(3));
+    PipeRMPIO rmp_io[2];
+    SegwayRMP *rmps[2];
+    OrderChecker checkers[2];
+    for (int i = 0; i < 2; ++i) {
+        rmps[i] = new SegwayRMP(no_interface);
+        rmps[i]->rmp_io_ = &rmp_io[i];
+        rmps[i]->setCallbackExecutor(pool);
+        // The senders outrun the pool, wait for it rather than drop
+        rmps[i]->setStatusQueue(MAX_SEGWAYSTATUS_QUEUE_SIZE, queue_block);
+        rmps[i]->setStatusCallback(
+            boost::bind(&OrderChecker::check, &checkers[i], _1));
+        rmps[i]->StartReadingContinuously_();
+        EXPECT_FALSE(rmps[i]->callback_execution_thread_.joinable());
+    }
+    boost::thread first(sendCycles, rmps[0], 1000);
+    boost::thread second(sendCycles, rmps[1], 1000);
+    first.join();
+    second.join();
+    for (int i = 0; i < 2; ++i) {
+        while (checkers[i].calls < 1000) {
+            boost::this_thread::yield();
+        }
+        rmps[i]->StopReadingContinuously_();
+        delete rmps[i];
+        EXPECT_FALSE(checkers[i].overlapped);
+        EXPECT_FALSE(checkers[i].out_of_order);
+    }
+    // Statuses which arrive while a drain is scheduled share it
+    EXPECT_LE(pool->posted, 2000u);
+}
+
+TEST(StatusDeliveryTests, PollingRunsNoCallbackThread) {
+    PipeRMPIO rmp_io;
+    SegwayRMP rmp(no_interface);
+    rmp.rmp_io_ = &rmp_io;
+    rmp.setStatusDeliveryMode(status_polling);
+    rmp.StartReadingContinuously_();
+    EXPECT_FALSE(rmp.callback_execution_thread_.joinable());
+    rmp.StopReadingContinuously_();
+}
+
+// Records the batches given to a SegwayStatusBatchCallback
+struct BatchRecorder {
+    BatchRecorder() : delivered(0) {}
+    void record(const SegwayStatus::Ptr *statuses, size_t count) {
+        sizes.push_back(count);
+        for (size_t i = 0; i < count; ++i) {
+            frames.push_back((int)(statuses[i]->servo_frames * 100.0f + 0.5f));
+        }
+        delivered += (int)count;
+    }
+    std::vector<size_t> sizes;
+    std::vector<int> frames;
+    boost::atomic<int> delivered;
+};
+
+TEST(StatusBatchTests, DeliversFullBatches) {
+    PipeRMPIO rmp_io;
+    SegwayRMP rmp(no_interface);
+    rmp.rmp_io_ = &rmp_io;
+    BatchRecorder recorder;
+    rmp.setStatusBatchCallback(
+        boost::bind(&BatchRecorder::record, &recorder, _1, _2), 10, 10000);
+    rmp.StartReadingContinuously_();
+    sendCycles(&rmp, 25);
+    boost::posix_time::ptime start =
+        boost::posix_time::microsec_clock::universal_time();
+    while (recorder.delivered < 20 && millisecondsSince(start) < 2000) {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    }
+    // The rest is delivered on stopping
+    rmp.StopReadingContinuously_();
+    ASSERT_EQ(3u, recorder.sizes.size());
+    EXPECT_EQ(10u, recorder.sizes[0]);
+    EXPECT_EQ(10u, recorder.sizes[1]);
+    EXPECT_EQ(5u, recorder.sizes[2]);
+    for (int i = 0; i < 25; ++i) {
+        EXPECT_EQ(i, recorder.frames[i]);
+    }
+}
+
+TEST(StatusBatchTests, DeliversPartialBatchesOnceDue) {
+    PipeRMPIO rmp_io;
+    SegwayRMP rmp(no_interface);
+    rmp.rmp_io_ = &rmp_io;
+    BatchRecorder recorder;
+    rmp.setStatusBatchCallback(
+        boost::bind(&BatchRecorder::record, &recorder, _1, _2), 100, 20);
+    rmp.StartReadingContinuously_();
+    boost::posix_time::ptime start =
+        boost::posix_time::microsec_clock::universal_time();
+    sendCycles(&rmp, 3);
+    while (recorder.delivered < 3 && millisecondsSince(start) < 2000) {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    }
+    long elapsed = millisecondsSince(start);
+    rmp.StopReadingContinuously_();
+    ASSERT_EQ(1u, recorder.sizes.size());
+    EXPECT_EQ(3u, recorder.sizes[0]);
+    EXPECT_GE(elapsed, 19);
+    EXPECT_LT(elapsed, 500);
+}
+
+TEST(StatusBatchTests, RejectsEmptyBatches) {
+    SegwayRMP rmp(no_interface);
+    BatchRecorder recorder;
+    EXPECT_THROW(rmp.setStatusBatchCallback(
+        boost::bind(&BatchRecorder::record, &recorder, _1, _2), 0),
+        ConfigurationException);
+}
+
+void
+recordFrame(std::vector<int> *frames, SegwayStatus::Ptr status) {
+    frames->push_back((int)(status->servo_frames * 100.0f + 0.5f));
+}
+
+TEST(StatusSubscriberTests, DecimatesEachSubscriber) {
+    SegwayRMP rmp(no_interface, rmp200, status_polling);
+    std::vector<int> every, every_third;
+    rmp.addStatusSubscriber(boost::bind(recordFrame, &every, _1));
+    SubscriberOptions options;
+    options.rate_divisor = 3;
+    rmp.addStatusSubscriber(boost::bind(recordFrame, &every_third, _1),
+                            options);
+    sendCycles(&rmp, 10);
+    EXPECT_EQ(10u, every.size());
+    ASSERT_EQ(4u, every_third.size());
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_EQ(i * 3, every_third[i]);
+    }
+}
+
+TEST(StatusSubscriberTests, LimitsThePeriod) {
+    SegwayRMP rmp(no_interface, rmp200, status_polling);
+    std::vector<int> frames;
+    SubscriberOptions options;
+    options.min_period_ms = 50;
+    rmp.addStatusSubscriber(boost::bind(recordFrame, &frames, _1), options);
+    sendCycles(&rmp, 5);
+    EXPECT_EQ(1u, frames.size());
+    boost::this_thread::sleep(boost::posix_time::milliseconds(60));
+    sendCycles(&rmp, 5);
+    EXPECT_EQ(2u, frames.size());
+}
+
+TEST(StatusSubscriberTests, StopsDeliveringOnceRemoved) {
+    SegwayRMP rmp(no_interface, rmp200, status_inline);
+    rmp.setStatusCallback(SegwayStatusCallback());
+    std::vector<int> kept, removed;
+    rmp.addStatusSubscriber(boost::bind(recordFrame, &kept, _1));
+    int id = rmp.addStatusSubscriber(boost::bind(recordFrame, &removed, _1));
+    sendCycles(&rmp, 2);
+    rmp.removeStatusSubscriber(id);
+    sendCycles(&rmp, 2);
+    EXPECT_EQ(4u, kept.size());
+    EXPECT_EQ(2u, removed.size());
+}
+
+TEST(StatusSubscriberTests, PostsToTheSubscribersExecutor) {
+    boost::shared_ptr<PoolExecutor> pool(new PoolExecutor(1));
+    OrderChecker checker;
+    {
+        SegwayRMP rmp(no_interface);
+        rmp.setStatusCallback(SegwayStatusCallback());
+        SubscriberOptions options;
+        options.rate_divisor = 2;
+        options.executor = pool;
+        rmp.addStatusSubscriber(
+            boost::bind(&OrderChecker::check, &checker, _1), options);
+        sendCycles(&rmp, 1);
+        sendCycles(&rmp, 1);
+        // Skipped statuses are not posted, only the due one
+        EXPECT_EQ(1u, pool->posted);
+        // Nothing else needs the status, so nothing is queued
+        EXPECT_TRUE(rmp.ss_queue_->empty());
+    }
+    // The SegwayRMP waited for the posted call
+    EXPECT_EQ(1, checker.calls);
+}
+
+TEST(SendPacketsTests, ResetsAllIntegratorsWithOneWrite) {
+    FakeRMPIO rmp_io;
+    SegwayRMP rmp(no_interface);
+    rmp.rmp_io_ = &rmp_io;
+    rmp.ConnectInterface_(true);
+    EXPECT_EQ(1, rmp_io.writes);
+    ASSERT_EQ(4u * 18, rmp_io.written.size());
+    for (int i = 0; i < 4; ++i) {
+        unsigned char *usb_packet = &rmp_io.written[i * 18];
+        EXPECT_EQ(0x32, usb_packet[14]);
+        EXPECT_EQ(1 << i, usb_packet[16]);
+        EXPECT_EQ(rmp_io.computeChecksum(usb_packet), usb_packet[17]);
+    }
+}
+
+TEST(CommandSchedulerTests, SendsImmediatelyWithoutARate) {
+    FakeRMPIO rmp_io;
+    SegwayRMP rmp(no_interface);
+    rmp.rmp_io_ = &rmp_io;
+    rmp.ConnectInterface_(false);
+    rmp.moveCounts(3, 4);
+    EXPECT_FALSE(rmp.command_scheduler_->isRunning());
+    ASSERT_EQ(18u, rmp_io.written.size());
+    EXPECT_EQ(0x04, rmp_io.written[12]);
+}
+
+TEST(CommandSchedulerTests, RepeatsTheLatestSetpoint) {
+    FakeRMPIO rmp_io;
+    SegwayRMP rmp(no_interface);
+    rmp.rmp_io_ = &rmp_io;
+    rmp.setCommandRate(100.0);
+    rmp.ConnectInterface_(false);
+    ASSERT_TRUE(rmp.command_scheduler_->isRunning());
+    // Nothing is sent before the first setpoint
+    boost::this_thread::sleep(boost::posix_time::milliseconds(30));
+    EXPECT_EQ(0u, rmp.getCommandStatistics().sent);
+    rmp.moveCounts(1, 2);
+    rmp.moveCounts(3, 4);
+    // move only stores the setpoint
+    EXPECT_TRUE(rmp_io.written.empty());
+    boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+    rmp.command_scheduler_->stop();
+    size_t sent = rmp_io.written.size() / 18;
+    EXPECT_GE(sent, 5u);
+    EXPECT_LE(sent, 12u);
+    const unsigned char *last = &rmp_io.written[(sent - 1) * 18];
+    EXPECT_EQ(0x04, last[6]);
+    EXPECT_EQ(0x13, last[7]);
+    EXPECT_EQ(3, last[10]);
+    EXPECT_EQ(4, last[12]);
+    CommandStatistics statistics = rmp.getCommandStatistics();
+    EXPECT_EQ(sent, statistics.sent);
+    EXPECT_GE(statistics.max_jitter_us, statistics.mean_jitter_us);
+    EXPECT_GT(statistics.max_jitter_us, 0.0);
+}
+
+TEST(CommandSchedulerTests, RejectsARateOnceConnected) {
+    FakeRMPIO rmp_io;
+    SegwayRMP rmp(no_interface);
+    rmp.rmp_io_ = &rmp_io;
+    EXPECT_THROW(rmp.setCommandRate(-1.0), ConfigurationException);
+    rmp.ConnectInterface_(false);
+    EXPECT_THROW(rmp.setCommandRate(50.0), ConfigurationException);
+}
+
+// Holds the first send until opened, then records the last data byte of
+// every packet sent
+struct GatedSender {
+    GatedSender() : entered(false), open(false) {}
+    void send(Packet &packet) {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        entered = true;
+        condition.notify_all();
+        while (!open) {
+            condition.wait(lock);
+        }
+        sent.push_back(packet.data[7]);
+    }
+    void waitUntilEntered() {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!entered) {
+            condition.wait(lock);
+        }
+    }
+    void release() {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        open = true;
+        condition.notify_all();
+    }
+    boost::mutex mutex;
+    boost::condition_variable condition;
+    bool entered;
+    bool open;
+    std::vector<int> sent;
+};
+
+TEST(CommandSchedulerTests, SafetyOvertakesQueuedConfiguration) {
+    GatedSender sender;
+    CommandScheduler scheduler(boost::bind(&GatedSender::send, &sender, _1),
+                               ExceptionCallback());
+    scheduler.start(10.0, 0x0413);
+    Packet packet;
+    packet.data[7] = 1;
+    scheduler.post(packet, transmit_config);
+    // The first send is now in progress, everything else queues behind it
+    sender.waitUntilEntered();
+    for (int i = 2; i <= 3; ++i) {
+        packet.data[7] = (unsigned char)i;
+        scheduler.post(packet, transmit_config);
+    }
+    packet.data[7] = 9;
+    scheduler.post(packet, transmit_safety);
+    sender.release();
+    scheduler.stop();
+    ASSERT_EQ(4u, sender.sent.size());
+    EXPECT_EQ(1, sender.sent[0]);
+    EXPECT_EQ(9, sender.sent[1]);
+    EXPECT_EQ(2, sender.sent[2]);
+    EXPECT_EQ(3, sender.sent[3]);
+    CommandStatistics statistics = scheduler.getStatistics();
+    EXPECT_EQ(1u, statistics.safety_sent);
+    EXPECT_EQ(3u, statistics.config_sent);
+    EXPECT_GT(statistics.max_safety_latency_us, 0.0);
+}
+
+TEST(CommandSchedulerTests, ShutdownStopsTheMotionCommands) {
+    FakeRMPIO rmp_io;
+    SegwayRMP rmp(no_interface);
+    rmp.rmp_io_ = &rmp_io;
+    rmp.setCommandRate(100.0);
+    rmp.ConnectInterface_(false);
+    rmp.moveCounts(3, 4);
+    boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+    rmp.shutdown();
+    boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+    rmp.command_scheduler_->stop();
+    size_t sent = rmp_io.written.size() / 18;
+    ASSERT_GE(sent, 2u);
+    // The shutdown is the last packet, the setpoint was not repeated
+    EXPECT_EQ(0x12, rmp_io.written[(sent - 1) * 18 + 7]);
+    EXPECT_EQ(0x13, rmp_io.written[(sent - 2) * 18 + 7]);
+    EXPECT_EQ(1u, rmp.getCommandStatistics().safety_sent);
+}
+
+// Parses a 0x0406 as the Segway would send it
+void
+reportConfiguration(SegwayRMP *rmp, int operational_mode,
+                    int controller_gain_schedule, int delay_ms)
+{
+    boost::this_thread::sleep(boost::posix_time::milliseconds(delay_ms));
+    Packet packet;
+    packet.id = 0x0406;
+    packet.channel = 0xAA;
+    memset(packet.data, 0, 8);
+    packet.data[1] = (unsigned char)operational_mode;
+    packet.data[3] = (unsigned char)controller_gain_schedule;
+    SegwayStatus::Ptr ss = rmp->status_pool_->acquire();
+    rmp->ParsePacket_(packet, ss);
+}
+
+TEST(ConfigurationTests, SendsOnlyWhatChangedInOneWrite) {
+    FakeRMPIO rmp_io;
+    SegwayRMP rmp(no_interface);
+    rmp.rmp_io_ = &rmp_io;
+    rmp.ConnectInterface_(false);
+    Configuration configuration;
+    configuration.setMaxVelocityScaleFactor(0.5);
+    configuration.setMaxAccelerationScaleFactor(0.25);
+    configuration.setMaxTurnScaleFactor(2.0);
+    configuration.setCurrentLimitScaleFactor(0.5);
+    EXPECT_EQ(4u, rmp.applyConfiguration(configuration, 0));
+    EXPECT_EQ(1, rmp_io.writes);
+    ASSERT_EQ(4u * 18, rmp_io.written.size());
+    const unsigned char commands[4] = {0x0A, 0x0B, 0x0C, 0x0E};
+    const unsigned char values[4] = {8, 4, 16, 128};
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_EQ(commands[i], rmp_io.written[i * 18 + 14]);
+        EXPECT_EQ(values[i], rmp_io.written[i * 18 + 16]);
+    }
+    // Nothing changed, nothing is sent
+    EXPECT_EQ(0u, rmp.applyConfiguration(configuration, 0));
+    EXPECT_EQ(1, rmp_io.writes);
+    // The setters count as sent too
+    rmp.setMaxVelocityScaleFactor(1.0);
+    configuration.setMaxVelocityScaleFactor(1.0);
+    EXPECT_EQ(0u, rmp.applyConfiguration(configuration, 0));
+    EXPECT_EQ(2, rmp_io.writes);
+}
+
+TEST(ConfigurationTests, SkipsWhatTheSegwayReports) {
+    FakeRMPIO rmp_io;
+    SegwayRMP rmp(no_interface);
+    rmp.rmp_io_ = &rmp_io;
+    rmp.ConnectInterface_(false);
+    reportConfiguration(&rmp, tractor, tall, 0);
+    Configuration configuration;
+    configuration.setOperationalMode(tractor);
+    configuration.setControllerGainSchedule(tall);
+    EXPECT_EQ(0u, rmp.applyConfiguration(configuration));
+    EXPECT_EQ(0, rmp_io.writes);
+}
+
+TEST(ConfigurationTests, WaitsForTheSegwayToReportTheChanges) {
+    FakeRMPIO rmp_io;
+    SegwayRMP rmp(no_interface);
+    rmp.rmp_io_ = &rmp_io;
+    rmp.ConnectInterface_(false);
+    Configuration configuration;
+    configuration.setControllerGainSchedule(heavy);
+    configuration.setOperationalMode(balanced);
+    boost::posix_time::ptime start =
+        boost::posix_time::microsec_clock::universal_time();
+    boost::thread reporter(reportConfiguration, &rmp, balanced, heavy, 50);
+    EXPECT_EQ(2u, rmp.applyConfiguration(configuration, 5000));
+    reporter.join();
+    EXPECT_GE(millisecondsSince(start), 45);
+    EXPECT_LT(millisecondsSince(start), 1000);
+    // The mode goes last, in the same write
+    EXPECT_EQ(1, rmp_io.writes);
+    ASSERT_EQ(2u * 18, rmp_io.written.size());
+    EXPECT_EQ(0x0D, rmp_io.written[14]);
+    EXPECT_EQ(0x10, rmp_io.written[18 + 14]);
+    EXPECT_EQ(balanced, rmp_io.written[18 + 16]);
+}
+
+TEST(ConfigurationTests, ThrowsWhenTheChangesAreNotReported) {
+    FakeRMPIO rmp_io;
+    SegwayRMP rmp(no_interface);
+    rmp.rmp_io_ = &rmp_io;
+    rmp.ConnectInterface_(false);
+    Configuration configuration;
+    configuration.setOperationalMode(tractor);
+    EXPECT_THROW(rmp.applyConfiguration(configuration, 20),
+                 ConfigurationException);
+    EXPECT_EQ(0, rmp.configuration_waiters_);
+}
+
+#if defined(SEGWAYRMP_USE_TERMIOS)
+// Connects a TermiosRMPIO to the slave side of a pty pair
+class TermiosTests : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        master = posix_openpt(O_RDWR | O_NOCTTY);
+        ASSERT_GE(master, 0);
+        ASSERT_EQ(0, grantpt(master));
+        ASSERT_EQ(0, unlockpt(master));
+        rmp_io.configure(ptsname(master), 460800);
+        rmp_io.connect();
+    }
+    virtual void TearDown() {
+        rmp_io.disconnect();
+        if (master >= 0)
+            close(master);
+    }
+    void writeToMaster(const std::vector<unsigned char> &data) {
+        ASSERT_EQ((ssize_t)data.size(),
+                  ::write(master, &data[0], data.size()));
+    }
+    int master;
+    TermiosRMPIO rmp_io;
+};
+
+TEST_F(TermiosTests, ReadsPacketsFromPty) {
+    FakeRMPIO frames;
+    frames.appendPacket(0x0401, 0xAA, 1);
+    frames.appendPacket(0x0402, 0xAA, 2);
+    frames.appendPacket(0x0403, 0xAA, 3);
+    writeToMaster(frames.stream);
+    Packet packets[16];
+    size_t count = 0;
+    while (count < 3) {
+        count += rmp_io.getPackets(packets + count, 16 - count);
+    }
+    EXPECT_EQ(3u, count);
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_EQ(0x0401 + i, packets[i].id);
+        EXPECT_EQ(i + 1, packets[i].data[0]);
+    }
+}
+
+TEST_F(TermiosTests, SendsPacketsToPty) {
+    Packet packet;
+    packet.id = 0x0413;
+    packet.channel = 0xBB;
+    memset(packet.data, 0, 8);
+    rmp_io.sendPacket(packet);
+    unsigned char buffer[18];
+    size_t received = 0;
+    while (received < 18) {
+        ssize_t n = ::read(master, buffer + received, 18 - received);
+        ASSERT_GT(n, 0);
+        received += n;
+    }
+    EXPECT_EQ(0xF0, buffer[0]);
+    EXPECT_EQ(0x55, buffer[1]);
+    EXPECT_EQ(0xBB, buffer[2]);
+}
+
+TEST_F(TermiosTests, CancelInterruptsBlockedRead) {
+    boost::posix_time::ptime start =
+        boost::posix_time::microsec_clock::universal_time();
+    boost::thread canceler(&TermiosRMPIO::cancel, &rmp_io);
+    Packet packets[16];
+    size_t count = 0;
+    PacketStatus status;
+    do {
+        status = rmp_io.tryGetPackets(packets, 16, count);
+    } while (status == packet_no_data);
+    canceler.join();
+    EXPECT_EQ(packet_canceled, status);
+    EXPECT_LT(millisecondsSince(start), 100);
+}
+
+TEST_F(TermiosTests, ReportsHangupAsReadFailure) {
+    close(master);
+    master = -1;
+    Packet packets[16];
+    size_t count = 0;
+    EXPECT_EQ(packet_read_failed, rmp_io.tryGetPackets(packets, 16, count));
+    // The hangup is only reported once
+    EXPECT_FALSE(rmp_io.isConnected());
+    EXPECT_EQ(packet_not_connected, rmp_io.tryGetPackets(packets, 16, count));
+}
+
+void
+countException(boost::atomic<int> *count, const std::exception &) {
+    ++*count;
+}
+
+TEST(TermiosReadThreadTests, StopsReadingAfterAHangup) {
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    ASSERT_GE(master, 0);
+    ASSERT_EQ(0, grantpt(master));
+    ASSERT_EQ(0, unlockpt(master));
+    boost::atomic<int> exceptions(0);
+    SegwayRMP rmp(serial);
+    rmp.setLogMsgCallback("error", ignoreMessage);
+    rmp.setExceptionCallback(boost::bind(countException, &exceptions, _1));
+    rmp.configureSerial(ptsname(master), 460800);
+    rmp.connect(false);
+    ASSERT_TRUE(rmp.read_thread_.joinable());
+    close(master);
+    // The read thread stops by itself instead of spinning on the failure
+    EXPECT_TRUE(rmp.read_thread_.try_join_for(boost::chrono::seconds(2)));
+    EXPECT_GE(exceptions, 1);
+    EXPECT_LE(exceptions, 2);
+}
+
+void
+countStatus(boost::atomic<int> *count, SegwayStatus::Ptr) {
+    ++*count;
+}
+
+TEST(FleetTests, DeliversStatusesOfEveryRobot) {
+    const int robots = 5;
+    int masters[robots];
+    SegwayRMP *rmps[robots];
+    boost::atomic<int> counts[robots];
+    SegwayRMPFleet fleet(2);
+    for (int i = 0; i < robots; ++i) {
+        masters[i] = posix_openpt(O_RDWR | O_NOCTTY);
+        ASSERT_GE(masters[i], 0);
+        ASSERT_EQ(0, grantpt(masters[i]));
+        ASSERT_EQ(0, unlockpt(masters[i]));
+        counts[i] = 0;
+        rmps[i] = new SegwayRMP(serial, rmp200, status_inline);
+        rmps[i]->setStatusCallback(boost::bind(countStatus, &counts[i], _1));
+        rmps[i]->configureSerial(ptsname(masters[i]));
+        fleet.add(*rmps[i], false);
+    }
+    EXPECT_EQ((size_t)robots, fleet.size());
+    fleet.start();
+    EXPECT_THROW(fleet.add(*rmps[0]), ConfigurationException);
+    FakeRMPIO cycle;
+    for (unsigned short id = 0x0400; id <= 0x0407; ++id) {
+        cycle.appendPacket(id, 0xAA, 0);
+    }
+    // Robot i gets i + 1 cycles
+    for (int round = 0; round < robots; ++round) {
+        for (int i = round; i < robots; ++i) {
+            ASSERT_EQ((ssize_t)cycle.stream.size(),
+                      ::write(masters[i], &cycle.stream[0],
+                              cycle.stream.size()));
+        }
+    }
+    boost::posix_time::ptime start =
+        boost::posix_time::microsec_clock::universal_time();
+    for (int i = 0; i < robots; ++i) {
+        while (counts[i] < i + 1 && millisecondsSince(start) < 2000) {
+            boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+        }
+    }
+    fleet.stop();
+    for (int i = 0; i < robots; ++i) {
+        EXPECT_EQ(i + 1, counts[i]);
+        delete rmps[i];
+        close(masters[i]);
+    }
+}
+
+TEST(FleetTests, RejectsInterfacesWithoutDescriptor) {
+    SegwayRMPFleet fleet;
+    SegwayRMP rmp(no_interface);
+    EXPECT_THROW(fleet.add(rmp), ConfigurationException);
+}
+
+void
+recordStatusThread(boost::thread::id *thread_id, int *count,
+                   SegwayStatus::Ptr) {
+    *thread_id = boost::this_thread::get_id();
+    ++*count;
+}
+
+TEST(SpinOnceTests, DeliversOnTheCallingThread) {
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    ASSERT_GE(master, 0);
+    ASSERT_EQ(0, grantpt(master));
+    ASSERT_EQ(0, unlockpt(master));
+    boost::thread::id thread_id;
+    int count = 0;
+    {
+        SegwayRMP rmp(serial, rmp200);
+        rmp.setStatusCallback(
+            boost::bind(recordStatusThread, &thread_id, &count, _1));
+        rmp.configureSerial(ptsname(master));
+        EXPECT_EQ(-1, rmp.nativeHandle());
+        rmp.connect(false, false);
+        EXPECT_FALSE(rmp.read_thread_.joinable());
+        EXPECT_FALSE(rmp.callback_execution_thread_.joinable());
+        ASSERT_GE(rmp.nativeHandle(), 0);
+        EXPECT_FALSE(rmp.spinOnce());
+        FakeRMPIO cycle;
+        for (unsigned short id = 0x0400; id <= 0x0407; ++id) {
+            cycle.appendPacket(id, 0xAA, 0);
+        }
+        for (int i = 0; i < 2; ++i) {
+            ASSERT_EQ((ssize_t)cycle.stream.size(),
+                      ::write(master, &cycle.stream[0], cycle.stream.size()));
+        }
+        boost::posix_time::ptime start =
+            boost::posix_time::microsec_clock::universal_time();
+        while (count < 2 && millisecondsSince(start) < 2000) {
+            struct pollfd pfd;
+            pfd.fd = rmp.nativeHandle();
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            if (poll(&pfd, 1, 100) > 0) {
+                rmp.spinOnce();
+            }
+        }
+    }
+    close(master);
+    EXPECT_EQ(2, count);
+    EXPECT_EQ(boost::this_thread::get_id(), thread_id);
+}
+
+TEST(SpinOnceTests, RequiresConnectingWithoutThreads) {
+    SegwayRMP rmp(no_interface);
+    EXPECT_THROW(rmp.spinOnce(), ConfigurationException);
+    EXPECT_EQ(-1, rmp.nativeHandle());
+}
+
+TEST(TermiosConfigurationTests, ThrowsOnMissingPort) {
+    TermiosRMPIO rmp_io;
+    rmp_io.configure("/dev/does_not_exist", 460800);
+    EXPECT_THROW(rmp_io.connect(), ConnectionFailedException);
+}
+#endif
+
+#if defined(SEGWAYRMP_USE_CAN)
+// Plays the RMP on a vcan0 interface, which can be made with:
+//   ip link add dev vcan0 type vcan && ip link set up vcan0
+class CanTests : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        base = -1;
+        unsigned int index = if_nametoindex("vcan0");
+        if (index == 0) {
+            GTEST_SKIP() << "vcan0 is not available";
+        }
+        base = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+        ASSERT_GE(base, 0);
+        struct sockaddr_can address;
+        memset(&address, 0, sizeof(address));
+        address.can_family = AF_CAN;
+        address.can_ifindex = index;
+        ASSERT_EQ(0, bind(base, (struct sockaddr *)&address,
+                          sizeof(address)));
+        rmp_io.configure("vcan0");
+        rmp_io.connect();
+    }
+    virtual void TearDown() {
+        rmp_io.disconnect();
+        if (base >= 0)
+            close(base);
+    }
+    void sendFrame(canid_t id, unsigned char first_data_byte) {
+        struct can_frame frame;
+        memset(&frame, 0, sizeof(frame));
+        frame.can_id = id;
+        frame.can_dlc = 8;
+        frame.data[0] = first_data_byte;
+        ASSERT_EQ((ssize_t)sizeof(frame), ::write(base, &frame, sizeof(frame)));
+    }
+    int base;
+    CanRMPIO rmp_io;
+};
+
+TEST_F(CanTests, ReceivesFramesAsPackets) {
+    sendFrame(0x0401, 1);
+    sendFrame(0x0402, 2);
+    sendFrame(0x0680, 3);
+    Packet packets[16];
+    size_t count = 0;
+    while (count < 3) {
+        count += rmp_io.getPackets(packets + count, 16 - count);
+    }
+    EXPECT_EQ(0x0401, packets[0].id);
+    EXPECT_EQ(0x0402, packets[1].id);
+    EXPECT_EQ(0x0680, packets[2].id);
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_EQ(0xAA, packets[i].channel);
+        EXPECT_EQ(i + 1, packets[i].data[0]);
+    }
+}
+
+TEST_F(CanTests, FiltersOutOtherFrames) {
+    sendFrame(0x0413, 9);
+    sendFrame(0x0407, 7);
+    Packet packet;
+    rmp_io.getPacket(packet);
+    EXPECT_EQ(0x0407, packet.id);
+    EXPECT_EQ(7, packet.data[0]);
+}
+
+TEST_F(CanTests, SendsPacketsAsFrames) {
+    Packet packet;
+    packet.id = 0x0413;
+    packet.data[0] = 0x12;
+    rmp_io.sendPacket(packet);
+    struct can_frame frame;
+    ASSERT_EQ((ssize_t)sizeof(frame), ::read(base, &frame, sizeof(frame)));
+    EXPECT_EQ(0x0413u, frame.can_id);
+    EXPECT_EQ(8, frame.can_dlc);
+    EXPECT_EQ(0x12, frame.data[0]);
+}
+
+TEST(CanConfigurationTests, ThrowsOnMissingInterface) {
+    CanRMPIO rmp_io;
+    rmp_io.configure("does_not_exist0");
+    EXPECT_THROW(rmp_io.connect(), ConnectionFailedException);
+}
+
+TEST(CanConfigurationTests, SegwayRMPSupportsCan) {
+    EXPECT_NO_THROW(SegwayRMP rmp(can));
+}
+#endif
+
+#if defined(SEGWAYRMP_USE_ETHERNET)
+// Opens a UDP socket on the loopback interface to play the RMP, returns port
+int
+openLoopbackBase(int &base) {
+    base = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(base, (struct sockaddr *)&address, sizeof(address));
+    socklen_t length = sizeof(address);
+    getsockname(base, (struct sockaddr *)&address, &length);
+    return ntohs(address.sin_port);
+}
+
+class UdpTests : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        int port = openLoopbackBase(base);
+        ASSERT_GE(base, 0);
+        rmp_io.configure("127.0.0.1", port, 1 << 20, 1 << 16);
+        rmp_io.connect();
+        // The base answers whoever talks to it
+        Packet hello;
+        hello.id = 0x0413;
+        hello.data[0] = 0x12;
+        rmp_io.sendPacket(hello);
+        client_length = sizeof(client);
+        ASSERT_EQ(10, recvfrom(base, received, sizeof(received), 0,
+                               (struct sockaddr *)&client, &client_length));
+    }
+    virtual void TearDown() {
+        rmp_io.disconnect();
+        close(base);
+    }
+    void sendDatagram(unsigned short id, unsigned char first_data_byte,
+                      size_t length = 10) {
+        unsigned char datagram[10] = {(unsigned char)(id >> 8),
+                                      (unsigned char)(id & 0xFF),
+                                      first_data_byte};
+        ASSERT_EQ((ssize_t)length,
+                  sendto(base, datagram, length, 0,
+                         (struct sockaddr *)&client, client_length));
+    }
+    int base;
+    struct sockaddr_in client;
+    socklen_t client_length;
+    unsigned char received[64];
+    UdpRMPIO rmp_io;
+};
+
+TEST_F(UdpTests, SendsPacketsAsDatagrams) {
+    EXPECT_EQ(0x04, received[0]);
+    EXPECT_EQ(0x13, received[1]);
+    EXPECT_EQ(0x12, received[2]);
+}
+
+TEST_F(UdpTests, SendsBatchesAsOneDatagramEach) {
+    Packet packets[10];
+    for (int i = 0; i < 10; ++i) {
+        packets[i].id = 0x0413;
+        packets[i].data[0] = (unsigned char)i;
+    }
+    rmp_io.sendPackets(packets, 10);
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_EQ(10, recv(base, received, sizeof(received), 0));
+        EXPECT_EQ(i, received[2]);
+    }
+}
+
+TEST_F(UdpTests, ReceivesDatagramsWithKernelTimestamps) {
+    sendDatagram(0x0400, 0);
+    sendDatagram(0x0401, 1);
+    sendDatagram(0x0402, 2);
+    Packet packets[16];
+    size_t count = 0;
+    while (count < 3) {
+        count += rmp_io.getPackets(packets + count, 16 - count);
+    }
+    uint32_t now = (uint32_t)time(NULL);
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_EQ(0x0400 + i, packets[i].id);
+        EXPECT_EQ(i, packets[i].data[0]);
+        EXPECT_LE(packets[i].timestamp.sec, now);
+        EXPECT_GE(packets[i].timestamp.sec + 5, now);
+    }
+}
+
+TEST_F(UdpTests, SkipsShortDatagrams) {
+    sendDatagram(0x0401, 1, 4);
+    sendDatagram(0x0402, 2);
+    Packet packet;
+    rmp_io.getPacket(packet);
+    EXPECT_EQ(0x0402, packet.id);
+    EXPECT_EQ(4u, rmp_io.getStatistics().skipped_bytes);
+}
+
+TEST_F(UdpTests, CancelInterruptsBlockedRead) {
+    boost::posix_time::ptime start =
+        boost::posix_time::microsec_clock::universal_time();
+    boost::thread canceler(&UdpRMPIO::cancel, &rmp_io);
+    Packet packets[16];
+    size_t count = 0;
+    PacketStatus status;
+    do {
+        status = rmp_io.tryGetPackets(packets, 16, count);
+    } while (status == packet_no_data);
+    canceler.join();
+    EXPECT_EQ(packet_canceled, status);
+    EXPECT_LT(millisecondsSince(start), 100);
+}
+#endif
+
+// A feedback message carrying the given words, the first one is the frame
+// count when the default bitmaps are selected
+std::vector<unsigned char>
+makeX440Feedback(const float *values, size_t count,
+                 bool frame_count_first = true) {
+    std::vector<unsigned char> message(count * 4);
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t word;
+        memcpy(&word, &values[i], 4);
+        message[i * 4 + 0] = (unsigned char)(word >> 24);
+        message[i * 4 + 1] = (unsigned char)(word >> 16);
+        message[i * 4 + 2] = (unsigned char)(word >> 8);
+        message[i * 4 + 3] = (unsigned char)word;
+    }
+    if (frame_count_first) {
+        // The frame count is an integer, not a float
+        message[0] = 0x00; message[1] = 0x00;
+        message[2] = 0x01; message[3] = 0xF4;
+    }
+    uint16_t crc = computeX440Crc(&message[0], message.size());
+    message.push_back((unsigned char)(crc >> 8));
+    message.push_back((unsigned char)(crc & 0xFF));
+    return message;
+}
+
+const float X440_VALUES[] = {0.0f, 1.5f, -2.0f, 0.25f, 3.0f, 10.0f, 12.5f,
+                             0.5f, 0.75f, 4.0f, 5.0f, 6.0f, 0.4f, 1.0f};
+
+TEST(X440ProtocolTests, ComputesCrc16) {
+    const char *check = "123456789";
+    EXPECT_EQ(0xBB3D,
+              computeX440Crc((const unsigned char *)check, strlen(check)));
+}
+
+TEST(X440ProtocolTests, DecodesDefaultFeedback) {
+    X440Protocol protocol;
+    EXPECT_EQ(14u * 4 + 2, protocol.getFeedbackLength());
+    std::vector<unsigned char> message = makeX440Feedback(X440_VALUES, 14);
+    SegwayStatus status;
+    ASSERT_TRUE(protocol.decodeFeedback(&message[0], message.size() - 2,
+                                        status));
+    EXPECT_TRUE(status.touched);
+    EXPECT_FLOAT_EQ(5.0f, status.servo_frames);
+    EXPECT_FLOAT_EQ(1.5f, status.pitch);
+    EXPECT_FLOAT_EQ(-2.0f, status.pitch_rate);
+    EXPECT_FLOAT_EQ(0.25f, status.roll);
+    EXPECT_FLOAT_EQ(3.0f, status.roll_rate);
+    EXPECT_FLOAT_EQ(10.0f, status.yaw_rate);
+    EXPECT_FLOAT_EQ(12.5f, status.ui_battery_voltage);
+    EXPECT_FLOAT_EQ(0.5f, status.right_wheel_speed);
+    EXPECT_FLOAT_EQ(0.75f, status.left_wheel_speed);
+    EXPECT_FLOAT_EQ(4.0f, status.integrated_right_wheel_position);
+    EXPECT_FLOAT_EQ(5.0f, status.integrated_left_wheel_position);
+    EXPECT_FLOAT_EQ(6.0f, status.integrated_forward_position);
+    EXPECT_FLOAT_EQ(0.4f, status.commanded_velocity);
+    EXPECT_FLOAT_EQ(57.2957795f, status.commanded_yaw_rate);
+}
+
+TEST(X440ProtocolTests, DecodesCustomBitmaps) {
+    X440Protocol protocol;
+    // Only the pitch and the linear position, with an undecoded item between
+    protocol.setFeedbackBitmaps(1u << 18, 1u << 0, 1u << 10, 0);
+    EXPECT_EQ(3u * 4 + 2, protocol.getFeedbackLength());
+    float values[] = {2.0f, 9.0f, 7.0f};
+    std::vector<unsigned char> message = makeX440Feedback(values, 3, false);
+    SegwayStatus status;
+    ASSERT_TRUE(protocol.decodeFeedback(&message[0], 12, status));
+    EXPECT_FLOAT_EQ(2.0f, status.pitch);
+    EXPECT_FLOAT_EQ(7.0f, status.integrated_forward_position);
+    EXPECT_FLOAT_EQ(0.0f, status.roll);
+    EXPECT_FALSE(protocol.decodeFeedback(&message[0], 8, status));
+}
+
+TEST(X440ProtocolTests, EncodesCommandsWithCrc) {
+    Packet packet;
+    packet.id = x440_configuration_command_id;
+    for (int i = 0; i < 8; ++i) {
+        packet.data[i] = (unsigned char)i;
+    }
+    unsigned char message[12];
+    ASSERT_EQ(12u, X440Protocol::encodeCommand(packet, message));
+    EXPECT_EQ(0x05, message[0]);
+    EXPECT_EQ(0x01, message[1]);
+    EXPECT_EQ(0, memcmp(message + 2, packet.data, 8));
+    EXPECT_EQ(computeX440Crc(message, 10),
+              (message[10] << 8) | message[11]);
+}
+
+TEST(X440ProtocolTests, EncodesFeedbackBitmapCommands) {
+    X440Protocol protocol;
+    protocol.setFeedbackBitmaps(0x11, 0x22, 0x33, 0x44);
+    Packet packets[4];
+    protocol.encodeFeedbackBitmapCommands(packets);
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_EQ(x440_configuration_command_id, packets[i].id);
+        EXPECT_EQ(x440_set_user_feedback_1_bitmap + i, packets[i].data[3]);
+        EXPECT_EQ(0x11 * (i + 1), packets[i].data[7]);
+    }
+}
+
+TEST_F(PacketTests, ParsesX440Feedback) {
+    SegwayRMP x440(no_interface, rmpx440);
+    std::vector<unsigned char> message = makeX440Feedback(X440_VALUES, 14);
+    pck.id = X440_FEEDBACK_ID;
+    pck.payload = &message[0];
+    pck.payload_length = message.size() - 2;
+    pck.timestamp = SegwayTime(1234, 5678);
+    ASSERT_TRUE(x440.ParsePacket_(pck, ss));
+    EXPECT_FLOAT_EQ(1.5f, ss->pitch);
+    EXPECT_EQ(1234u, ss->timestamp.sec);
+    // A short message is not a status update
+    pck.payload_length -= 4;
+    EXPECT_FALSE(x440.ParsePacket_(pck, ss));
+}
+
+TEST(X440ConfigurationTests, OnlySupportsEthernet) {
+    EXPECT_THROW(SegwayRMP(serial, rmpx440), ConfigurationException);
+    EXPECT_NO_THROW(SegwayRMP(no_interface, rmpx440));
+}
+
+#if defined(SEGWAYRMP_USE_ETHERNET)
+class X440Tests : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        port = openLoopbackBase(base);
+        ASSERT_GE(base, 0);
+        rmp_io.configure("127.0.0.1", port);
+        rmp_io.connect();
+        Packet hello;
+        hello.id = x440_motion_command_id;
+        rmp_io.sendPacket(hello);
+        client_length = sizeof(client);
+        ASSERT_EQ(12, recvfrom(base, received, sizeof(received), 0,
+                               (struct sockaddr *)&client, &client_length));
+    }
+    virtual void TearDown() {
+        rmp_io.disconnect();
+        close(base);
+    }
+    void sendMessage(const std::vector<unsigned char> &message) {
+        ASSERT_EQ((ssize_t)message.size(),
+                  sendto(base, &message[0], message.size(), 0,
+                         (struct sockaddr *)&client, client_length));
+    }
+    int base;
+    int port;
+    struct sockaddr_in client;
+    socklen_t client_length;
+    unsigned char received[64];
+    X440RMPIO rmp_io;
+};
+
+TEST_F(X440Tests, SendsCommandsWithCrc) {
+    EXPECT_EQ(0x05, received[0]);
+    EXPECT_EQ(0x00, received[1]);
+    EXPECT_EQ(computeX440Crc(received, 10), (received[10] << 8) | received[11]);
+}
+
+TEST_F(X440Tests, ReceivesFeedbackAndDropsBadCrc) {
+    std::vector<unsigned char> corrupt = makeX440Feedback(X440_VALUES, 14);
+    corrupt[5] ^= 0x01;
+    sendMessage(corrupt);
+    sendMessage(makeX440Feedback(X440_VALUES, 14));
+    Packet packet;
+    rmp_io.getPacket(packet);
+    EXPECT_EQ(X440_FEEDBACK_ID, packet.id);
+    EXPECT_EQ(14u * 4, packet.payload_length);
+    EXPECT_NE(0u, packet.timestamp.sec);
+    EXPECT_EQ(1u, rmp_io.getStatistics().checksum_mismatches);
+}
+
+TEST_F(X440Tests, SegwayRMPConfiguresFeedbackAndMoves) {
+    SegwayRMP segway_rmp(ethernet, rmpx440);
+    segway_rmp.setX440FeedbackBitmaps(1, 2, 3, 4);
+    segway_rmp.configureEthernet("127.0.0.1", port);
+    segway_rmp.connect();
+    EXPECT_THROW(segway_rmp.setX440FeedbackBitmaps(1, 2, 3, 4),
+                 ConfigurationException);
+    for (int i = 0; i < 4; ++i) {
+        ASSERT_EQ(12, recv(base, received, sizeof(received), 0));
+        EXPECT_EQ(0x05, received[0]);
+        EXPECT_EQ(0x01, received[1]);
+        EXPECT_EQ(x440_set_user_feedback_1_bitmap + i, received[5]);
+        EXPECT_EQ(i + 1, received[9]);
+    }
+    // Half the maximum velocity, past the maximum yaw rate
+    segway_rmp.move(1.1176f, 1000.0f);
+    ASSERT_EQ(12, recv(base, received, sizeof(received), 0));
+    EXPECT_EQ(0x05, received[0]);
+    EXPECT_EQ(0x00, received[1]);
+    float values[2];
+    for (int i = 0; i < 2; ++i) {
+        uint32_t word = ((uint32_t)received[2 + i * 4] << 24)
+                      | ((uint32_t)received[3 + i * 4] << 16)
+                      | ((uint32_t)received[4 + i * 4] << 8)
+                      | (uint32_t)received[5 + i * 4];
+        memcpy(&values[i], &word, 4);
+    }
+    EXPECT_FLOAT_EQ(0.5f, values[0]);
+    EXPECT_FLOAT_EQ(1.0f, values[1]);
+}
+#endif
+
 }  // namespace
 
 int main(int argc, char **argv) {